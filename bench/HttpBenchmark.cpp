@@ -0,0 +1,42 @@
+// Measures building the messages the balancer sends itself, like health checks and error responses, and framing the
+// messages it relays.
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include "Http.hpp"
+#include "HttpParser.hpp"
+
+using namespace ls;
+
+static void BM_RequestConstruct(benchmark::State &state) {
+    auto request = http::Request::isActiveRequest("10.0.0.1:80");
+    request.headers.insert({"Accept-Encoding", "gzip"});
+    for (auto _ : state) { benchmark::DoNotOptimize(request.construct()); }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RequestConstruct);
+
+static void BM_ResponseConstruct(benchmark::State &state) {
+    auto response = http::Response::respond503();
+    response.body = std::string(static_cast<std::size_t>(state.range(0)), 'x');
+    for (auto _ : state) { benchmark::DoNotOptimize(response.construct()); }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ResponseConstruct)->Arg(0)->Arg(1024)->Arg(64 * 1024);
+
+// Framing a whole response that's already arrived, as a kept-alive connection does for every small response. Bodies
+// with a length are skipped over rather than read, so the time shouldn't grow with the body.
+static void BM_ParseResponse(benchmark::State &state) {
+    auto response = http::Response::respond503();
+    response.body = std::string(static_cast<std::size_t>(state.range(0)), 'x');
+    const auto message = response.construct();
+    for (auto _ : state) {
+        http::Parser parser{http::Parser::Kind::RESPONSE};
+        benchmark::DoNotOptimize(parser.parse(message));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ParseResponse)->Arg(0)->Arg(1024)->Arg(64 * 1024);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,93 @@
+// Measures moving bytes in and out of sockets, and how quickly a server takes on new connections. Sockets are kept on
+// the one machine (a socket pair, or loopback), so the numbers are of the balancer's own overhead.
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+#include "EventLoop.hpp"
+#include "LoadBalancer.hpp"
+#include "Log.hpp"
+#include "Server.hpp"
+#include "Sockets.hpp"
+#include "TimerWheel.hpp"
+
+using namespace ls;
+using namespace std::chrono_literals;
+
+// The port the accepting server listens on. Nothing else should be listening on it while benchmarks run.
+constexpr int accept_port = 40299;
+
+// How many connections are opened at once, before waiting on the server to accept them
+constexpr int accept_batch = 64;
+
+// Reads a message of the given size from one end of a socket pair, as it's written to the other
+static void BM_Collect(benchmark::State &state) {
+    out::level = 0;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0) {
+        state.SkipWithError("Failed to create a socket pair");
+        return;
+    }
+    const sockets::Socket writer{fds[0], "writer"};
+    const sockets::Socket reader{fds[1], "reader"};
+
+    const std::string message(static_cast<std::size_t>(state.range(0)), 'x');
+    std::string received;
+    for (auto _ : state) {
+        received.clear();
+        std::size_t sent = 0;
+        while (received.length() < message.length()) {
+            if (sockets::transmit(writer, message, sent) == sockets::IoStatus::FAILED ||
+                sockets::collect(reader, received) == sockets::IoStatus::FAILED) {
+                state.SkipWithError("Failed to relay through the socket pair");
+                return;
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Collect)->Arg(1024)->Arg(64 * 1024)->Arg(1024 * 1024);
+
+// Connects a batch of clients over loopback, and waits on the server to accept every one of them
+static void BM_ServerAccept(benchmark::State &state) {
+    out::level = 0;
+    EventLoop loop;
+    TimerWheel timers{timeout_tick};
+    const Server server{loop,
+                        timers,
+                        accept_port,
+                        SOMAXCONN,
+                        {.idle_timeout = 60s, .max_requests = 1000},
+                        60s,
+                        [](AcceptData) {}};
+    const auto listening = loop.size();
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(accept_port);
+
+    std::vector<sockets::Socket> clients;
+    for (auto _ : state) {
+        for (int i = 0; i < accept_batch; i++) {
+            clients.emplace_back(sockets::createSocket(), "client");
+            if (connect(clients.back().fd(), sockets::asGeneric(&addr), sizeof(addr)) != 0) {
+                state.SkipWithError("Failed to connect to the server");
+                return;
+            }
+        }
+        while (loop.size() < listening + accept_batch) { loop.poll(0); }
+
+        // Closing is left out of the time, only accepting is measured
+        state.PauseTiming();
+        clients.clear();
+        while (loop.size() > listening) { loop.poll(0); }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * accept_batch);
+}
+BENCHMARK(BM_ServerAccept)->UseRealTime();
+
+BENCHMARK_MAIN();
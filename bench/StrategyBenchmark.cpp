@@ -0,0 +1,166 @@
+// Measures how many servers each strategy can pick per second, for clusters of different sizes. Picks don't touch the
+// network, so the servers are never actually connected to.
+
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "LoadBalancer.hpp"
+#include "Log.hpp"
+
+using namespace ls;
+using namespace std::chrono_literals;
+
+static const std::atomic_bool never_quit{false};
+
+// Balancers are only built once for each cluster size, since adding thousands of servers takes a while
+static LoadBalancer &balancerWith(int servers) {
+    static std::map<int, std::unique_ptr<LoadBalancer>> balancers;
+    auto &balancer = balancers[servers];
+    if (balancer != nullptr) { return *balancer; }
+
+    out::level = 0;
+    balancer = std::make_unique<LoadBalancer>(0, 1, 0, 30s, never_quit);
+    for (int i = 0; i < servers; i++) {
+        auto metadata = Metadata::makeDefault();
+        metadata.weight = 1 + i % 4;
+        balancer->addConnection("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256), 80, metadata);
+    }
+    return *balancer;
+}
+
+static void BM_WeightedRoundRobin(benchmark::State &state) {
+    auto &balancer = balancerWith(static_cast<int>(state.range(0)));
+    balancer.use(LoadBalancer::Strategy::WEIGHTED_ROUND_ROBIN);
+    const AcceptData request{.data = Buffer::copy("GET / HTTP/1.1\r\nHost: bench\r\n\r\n"), .remote = {-1, 0}};
+    LeastLoadedHeap least_loaded; // Only used by least connections, but every pick is made with one
+
+    for (auto _ : state) { benchmark::DoNotOptimize(&balancer.pick(request, least_loaded)); }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WeightedRoundRobin)->Arg(10)->Arg(1000)->Arg(10000);
+
+static void BM_WeightedRandom(benchmark::State &state) {
+    auto &balancer = balancerWith(static_cast<int>(state.range(0)));
+    balancer.use(LoadBalancer::Strategy::RANDOM);
+    balancer.refreshTables();
+    const AcceptData request{.data = Buffer::copy("GET / HTTP/1.1\r\nHost: bench\r\n\r\n"), .remote = {-1, 0}};
+    LeastLoadedHeap least_loaded;
+
+    for (auto _ : state) { benchmark::DoNotOptimize(&balancer.pick(request, least_loaded)); }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WeightedRandom)->Arg(10)->Arg(1000)->Arg(10000);
+
+static void BM_PowerOfTwoChoices(benchmark::State &state) {
+    auto &balancer = balancerWith(static_cast<int>(state.range(0)));
+    balancer.use(LoadBalancer::Strategy::POWER_OF_TWO_CHOICES);
+    const AcceptData request{.data = Buffer::copy("GET / HTTP/1.1\r\nHost: bench\r\n\r\n"), .remote = {-1, 0}};
+    LeastLoadedHeap least_loaded;
+
+    for (auto _ : state) { benchmark::DoNotOptimize(&balancer.pick(request, least_loaded)); }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PowerOfTwoChoices)->Arg(10)->Arg(1000)->Arg(10000);
+
+static void BM_ConsistentHashing(benchmark::State &state) {
+    auto &balancer = balancerWith(static_cast<int>(state.range(0)));
+    balancer.use(LoadBalancer::Strategy::CONSISTENT_HASHING);
+    balancer.refreshTables();
+
+    // Requests are for different paths, so picks land all over the table instead of hitting the same slot every time
+    std::vector<AcceptData> requests;
+    LeastLoadedHeap least_loaded;
+    for (int i = 0; i < 1024; i++) {
+        const auto data = "GET /item/" + std::to_string(i) + " HTTP/1.1\r\nHost: bench\r\n\r\n";
+        requests.push_back(AcceptData{.data = Buffer::copy(data), .remote = {-1, 0}});
+    }
+
+    std::size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(&balancer.pick(requests[next], least_loaded));
+        next = (next + 1) % requests.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConsistentHashing)->Arg(10)->Arg(1000)->Arg(10000);
+
+// The linear scan that least connections used before it kept a heap, kept here to compare against
+static Connection &scanLeastConnections(const std::vector<std::shared_ptr<Connection>> &connections) {
+    auto lightest_connection = std::ref(*connections.front());
+    for (const auto &shared_connection : connections) {
+        auto &connection = *shared_connection;
+        if (connection.is_inactive.load(std::memory_order_relaxed)) { continue; }
+
+        auto transactions = connection.ongoing_transactions.load(std::memory_order_relaxed);
+        auto min_transactions = lightest_connection.get().ongoing_transactions.load(std::memory_order_relaxed);
+
+        bool lightest_inactive = lightest_connection.get().is_inactive.load(std::memory_order_relaxed);
+        bool connection_lightest = transactions < min_transactions;
+        bool same_amount_lowest_weight = transactions == min_transactions &&
+            connection.metadata.weight > lightest_connection.get().metadata.weight;
+        if (lightest_inactive || connection_lightest || same_amount_lowest_weight) {
+            lightest_connection = std::ref(connection);
+        }
+    }
+
+    return lightest_connection;
+}
+
+static void BM_LeastConnectionsScan(benchmark::State &state) {
+    std::vector<std::shared_ptr<Connection>> connections;
+    for (int i = 0; i < state.range(0); i++) {
+        auto metadata = Metadata::makeDefault();
+        metadata.weight = 1 + i % 4;
+        connections.push_back(std::make_shared<Connection>(TcpClient{"10.0.0.1", 80}, metadata));
+    }
+
+    // Each pick starts a transaction, and the oldest of the last few transactions finishes
+    std::vector<Connection *> ongoing(8, nullptr);
+    std::size_t next = 0;
+    for (auto _ : state) {
+        auto &connection = scanLeastConnections(connections);
+        connection.ongoing_transactions++;
+        if (ongoing[next] != nullptr) { ongoing[next]->ongoing_transactions--; }
+        ongoing[next] = &connection;
+        next = (next + 1) % ongoing.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LeastConnectionsScan)->Arg(10)->Arg(1000)->Arg(10000);
+
+static void BM_WeightedLeastConnections(benchmark::State &state) {
+    auto &balancer = balancerWith(static_cast<int>(state.range(0)));
+    balancer.use(LoadBalancer::Strategy::LEAST_CONNECTIONS);
+    const AcceptData request{.data = Buffer::copy("GET / HTTP/1.1\r\nHost: bench\r\n\r\n"), .remote = {-1, 0}};
+    LeastLoadedHeap least_loaded;
+
+    std::vector<Connection *> ongoing(8, nullptr);
+    std::size_t next = 0;
+    for (auto _ : state) {
+        auto &connection = balancer.pick(request, least_loaded);
+        connection.ongoing_transactions++;
+        balancer.updateLoad(connection, least_loaded);
+        if (ongoing[next] != nullptr) {
+            ongoing[next]->ongoing_transactions--;
+            balancer.updateLoad(*ongoing[next], least_loaded);
+        }
+        ongoing[next] = &connection;
+        next = (next + 1) % ongoing.size();
+    }
+
+    // The balancer is shared with other benchmarks, so it's left without any transactions
+    for (auto *connection : ongoing) {
+        if (connection == nullptr) { continue; }
+        connection->ongoing_transactions--;
+        balancer.updateLoad(*connection, least_loaded);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WeightedLeastConnections)->Arg(10)->Arg(1000)->Arg(10000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,194 @@
+#include "LoadGenerator.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+namespace ls {
+
+LoadGenerator::LoadGenerator(Settings settings) : _settings(settings) {
+    for (int path = 0; path < std::max(_settings.paths, 1); path++) {
+        _requests.push_back("GET /item/" + std::to_string(path) + " HTTP/1.1\r\nHost: lb-bench\r\n\r\n");
+    }
+}
+
+LoadGenerator::Report LoadGenerator::run() {
+    const auto interval = clock::duration(std::chrono::seconds(1)) / std::max(_settings.rate, 1);
+    const auto total =
+        static_cast<std::uint64_t>(_settings.rate) * static_cast<std::uint64_t>(_settings.duration.count());
+    const auto start = clock::now();
+    const auto given_up = start + _settings.duration + _settings.drain_timeout;
+    const auto due_at = [&](std::uint64_t request) { return start + interval * static_cast<clock::rep>(request); };
+
+    std::uint64_t due = 0;
+    while (true) {
+        const auto now = clock::now();
+        for (; due < total && due_at(due) <= now; due++) { _backlog.push_back(due_at(due)); }
+        startBacklog();
+
+        const bool is_sending = due < total;
+        if (!is_sending && ((_in_flight == 0 && _backlog.empty()) || now >= given_up)) { break; }
+
+        // Waits for the next request to come due, and only a moment at a time while draining
+        const auto wait = is_sending ? std::chrono::duration_cast<std::chrono::milliseconds>(due_at(due) - now)
+                                     : std::chrono::milliseconds(1);
+        _loop.poll(static_cast<int>(wait.count()));
+    }
+    const auto end = clock::now();
+
+    // Requests that were never answered count against the latency as of when they were given up on
+    const auto unanswered = _in_flight + _backlog.size();
+    for (const auto &[fd, client] : _clients) {
+        if (client->intended.has_value()) { _latency.record(end - *client->intended); }
+        _loop.remove(fd);
+    }
+    for (const auto intended : _backlog) { _latency.record(end - intended); }
+    _clients.clear();
+    _idle.clear();
+    _backlog.clear();
+    _in_flight = 0;
+
+    return {.sent = due,
+            .succeeded = _succeeded,
+            .failed = _failed,
+            .unanswered = unanswered,
+            .elapsed = end - start,
+            .p50_us = _latency.valueAtPercentile(50),
+            .p99_us = _latency.valueAtPercentile(99),
+            .p999_us = _latency.valueAtPercentile(99.9),
+            .max_us = _latency.valueAtPercentile(100)};
+}
+
+void LoadGenerator::startBacklog() {
+    while (!_backlog.empty()) {
+        const auto intended = _backlog.front();
+        if (!_idle.empty()) {
+            const int fd = _idle.back();
+            _idle.pop_back();
+            send(*_clients.at(fd), intended);
+        } else if (_clients.size() < static_cast<std::size_t>(_settings.max_connections)) {
+            open(intended);
+        } else {
+            return;
+        }
+        _backlog.pop_front();
+    }
+}
+
+void LoadGenerator::open(clock::time_point intended) {
+    const int fd = sockets::createSocket(SOCK_NONBLOCK);
+    if (fd < 0) {
+        _latency.record(clock::now() - intended);
+        _failed++;
+        return;
+    }
+
+    auto &client = *_clients.insert_or_assign(fd, std::make_unique<Client>(sockets::Socket{fd, "load generator"}))
+                        .first->second;
+    _loop.add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [this, fd](std::uint32_t events) { handle(fd, events); });
+    send(client, intended);
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(_settings.port);
+    if (connect(fd, sockets::asGeneric(&address), sizeof(address)) < 0 && errno != EINPROGRESS) { fail(fd); }
+}
+
+void LoadGenerator::send(Client &client, clock::time_point intended) {
+    client.intended = intended;
+    client.request = &_requests[_next_request++ % _requests.size()];
+    client.sent = 0;
+    _in_flight++;
+
+    // Connections that are already open won't be told they're writable again, so the request goes out straight away
+    if (client.is_connected && !write(client)) { fail(client.socket.fd()); }
+}
+
+void LoadGenerator::handle(int fd, std::uint32_t events) {
+    const auto found = _clients.find(fd);
+    if (found == _clients.end()) { return; }
+    auto &client = *found->second;
+
+    if (!client.is_connected) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            fail(fd);
+            return;
+        }
+        if (!(events & (EPOLLOUT | EPOLLIN))) { return; }
+        client.is_connected = true;
+    }
+
+    // Idle connections only hear from the balancer when it closes them
+    if (!client.intended.has_value()) {
+        std::string ignored;
+        const auto status = sockets::collect(client.socket, ignored);
+        if (status == sockets::IoStatus::CLOSED || status == sockets::IoStatus::FAILED) { close(fd); }
+        return;
+    }
+
+    if (!write(client)) {
+        fail(fd);
+        return;
+    }
+    if (client.sent < client.request->size()) { return; }
+
+    const auto status = sockets::collect(client.socket, client.received);
+    auto parsed = client.parser.parse(client.received);
+    if (parsed == http::Parser::Status::INCOMPLETE && status == sockets::IoStatus::CLOSED) {
+        parsed = client.parser.finish();
+    }
+
+    if (parsed == http::Parser::Status::COMPLETE) {
+        complete(fd, client);
+    } else if (parsed == http::Parser::Status::INVALID || status == sockets::IoStatus::CLOSED ||
+               status == sockets::IoStatus::FAILED) {
+        fail(fd);
+    }
+}
+
+bool LoadGenerator::write(Client &client) {
+    if (client.sent >= client.request->size()) { return true; }
+    const auto status = sockets::transmit(client.socket, *client.request, client.sent);
+    return status == sockets::IoStatus::COMPLETE || status == sockets::IoStatus::PENDING;
+}
+
+void LoadGenerator::complete(int fd, Client &client) {
+    record(client, client.parser.code() >= 500);
+    if (!client.parser.isKeepAlive()) {
+        close(fd);
+        return;
+    }
+
+    client.received.erase(0, client.parser.length());
+    client.parser.reset();
+    _idle.push_back(fd);
+}
+
+void LoadGenerator::fail(int fd) {
+    auto &client = *_clients.at(fd);
+    if (client.intended.has_value()) { record(client, true); }
+    close(fd);
+}
+
+void LoadGenerator::close(int fd) {
+    _loop.remove(fd);
+    _idle.erase(std::remove(_idle.begin(), _idle.end(), fd), _idle.end());
+    _clients.erase(fd);
+}
+
+void LoadGenerator::record(Client &client, bool is_failed) {
+    _latency.record(clock::now() - *client.intended);
+    if (is_failed) {
+        _failed++;
+    } else {
+        _succeeded++;
+    }
+    client.intended.reset();
+    _in_flight--;
+}
+
+} // namespace ls
@@ -0,0 +1,104 @@
+// Drives the balancer with an open-loop schedule of requests, at a steady rate no matter how quickly they're answered.
+// A closed loop (waiting on a response before sending the next request) sends less when the balancer slows down, so
+// the slowest stretches are measured the least. This is known as coordinated omission.
+//
+// Every request is given the time it was meant to be sent, and its latency is measured from then rather than from when
+// it actually went out. Requests that are due while every connection is busy wait for one to free up, and the wait is
+// counted against them. Connections are kept alive and reused, up to a limit, and are all run from one event loop.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "EventLoop.hpp"
+#include "HttpParser.hpp"
+#include "LatencyHistogram.hpp"
+#include "Sockets.hpp"
+
+namespace ls {
+
+class LoadGenerator {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Settings {
+        int port;                            // The balancer's port, on loopback
+        int rate;                            // Requests sent every second
+        std::chrono::seconds duration;       // How long requests are sent for
+        std::chrono::seconds drain_timeout;  // How long unanswered requests are waited on once sending stops
+        int max_connections;                 // Connections open to the balancer at once
+        int paths;                           // Different paths that requests are spread over
+    };
+
+    struct Report {
+        std::uint64_t sent;       // Requests that were due, whether or not they made it out
+        std::uint64_t succeeded;  // Requests answered with anything but a server error
+        std::uint64_t failed;     // Requests answered with a server error, or whose connection failed
+        std::uint64_t unanswered; // Requests still waiting once the drain timeout ran out
+        std::chrono::nanoseconds elapsed;
+        std::uint64_t p50_us;
+        std::uint64_t p99_us;
+        std::uint64_t p999_us;
+        std::uint64_t max_us;
+    };
+
+    explicit LoadGenerator(Settings settings);
+
+    // No copying or moving a generator, its event loop's handlers hold on to it
+    LoadGenerator(LoadGenerator &) = delete;
+    LoadGenerator operator=(LoadGenerator &) = delete;
+    LoadGenerator(LoadGenerator &&) = delete;
+    LoadGenerator &operator=(LoadGenerator &&) = delete;
+
+    // Sends requests for the whole duration, and waits on the last of them to be answered. Only run once.
+    Report run();
+
+private:
+    struct Client {
+        explicit Client(sockets::Socket socket) : socket(std::move(socket)) {}
+
+    public:
+        sockets::Socket socket;
+        bool is_connected = false;
+        std::optional<clock::time_point> intended; // When the request being sent was due, or nothing when idle
+        const std::string *request = nullptr;
+        std::size_t sent = 0;
+        std::string received;
+        http::Parser parser{http::Parser::Kind::RESPONSE};
+    };
+
+    // Sends the requests that are due, oldest first, on idle connections or new ones while there's room for them.
+    void startBacklog();
+    void open(clock::time_point intended);
+    void send(Client &client, clock::time_point intended);
+    void handle(int fd, std::uint32_t events);
+    bool write(Client &client);
+    void complete(int fd, Client &client);
+    void fail(int fd);
+    void close(int fd);
+    // Records the latency of the client's request, which is over one way or another.
+    void record(Client &client, bool is_failed);
+
+private:
+    const Settings _settings;
+    EventLoop _loop;
+    std::vector<std::string> _requests; // One for each path
+    std::uint64_t _next_request = 0;
+    std::map<int, std::unique_ptr<Client>> _clients;
+    std::vector<int> _idle;                    // Connected clients without a request
+    std::deque<clock::time_point> _backlog;    // Requests that are due, waiting on a connection
+    std::size_t _in_flight = 0;                // Clients with a request
+    LatencyHistogram _latency;
+    std::uint64_t _succeeded = 0;
+    std::uint64_t _failed = 0;
+};
+
+} // namespace ls
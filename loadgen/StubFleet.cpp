@@ -0,0 +1,152 @@
+#include "StubFleet.hpp"
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include "Http.hpp"
+#include "HttpParser.hpp"
+#include "Log.hpp"
+
+namespace ls {
+
+using namespace std::chrono_literals;
+
+// How finely the fleet keeps to its delays
+constexpr std::chrono::milliseconds delay_tick{1};
+
+// Splits a spec like uniform:0:10 into its parts
+static std::vector<std::string> splitSpec(std::string_view spec) {
+    std::vector<std::string> parts;
+    std::size_t start = 0;
+    while (true) {
+        const auto end = spec.find(':', start);
+        parts.emplace_back(spec.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start));
+        if (end == std::string_view::npos) { return parts; }
+        start = end + 1;
+    }
+}
+
+StubFleet::Delay StubFleet::Delay::parse(std::string_view spec) {
+    const auto parts = splitSpec(spec);
+    const auto millis = [&](std::size_t part) {
+        const int value = std::stoi(parts[part]);
+        if (value < 0) { throw std::invalid_argument{std::string{spec} + " can't have a negative delay"}; }
+        return std::chrono::milliseconds(value);
+    };
+
+    if (parts[0] == "fixed" && parts.size() == 2) {
+        return {.kind = Kind::FIXED, .low = millis(1), .high = millis(1), .slow_percent = 0};
+    }
+    if (parts[0] == "uniform" && parts.size() == 3) {
+        const Delay delay{.kind = Kind::UNIFORM, .low = millis(1), .high = millis(2), .slow_percent = 0};
+        if (delay.high < delay.low) { throw std::invalid_argument{std::string{spec} + " has its bounds backwards"}; }
+        return delay;
+    }
+    if (parts[0] == "bimodal" && parts.size() == 4) {
+        const int slow_percent = std::stoi(parts[3]);
+        if (slow_percent < 0 || slow_percent > 100) {
+            throw std::invalid_argument{std::string{spec} + " isn't a valid percentage of slow requests"};
+        }
+        return {.kind = Kind::BIMODAL, .low = millis(1), .high = millis(2), .slow_percent = slow_percent};
+    }
+    throw std::invalid_argument{std::string{spec} + " isn't a valid delay"};
+}
+
+std::chrono::milliseconds StubFleet::Delay::sample(std::mt19937 &random) const {
+    switch (kind) {
+    case Kind::FIXED: return low;
+    case Kind::UNIFORM: {
+        std::uniform_int_distribution<std::chrono::milliseconds::rep> distribution{low.count(), high.count()};
+        return std::chrono::milliseconds(distribution(random));
+    }
+    case Kind::BIMODAL: return std::uniform_int_distribution<int>{1, 100}(random) <= slow_percent ? high : low;
+    }
+    return low;
+}
+
+StubFleet::StubFleet(int first_port, const std::vector<Settings> &servers) :
+    _first_port(first_port), _timers(delay_tick) {
+    _stubs.reserve(servers.size());
+    for (std::size_t stub = 0; stub < servers.size(); stub++) {
+        const auto &settings = servers[stub];
+        const auto succeeded = http::Response{.code = 200,
+                                              .status_text = "OK",
+                                              .headers = {{"Content-Type", "text/plain"}},
+                                              .body = std::string(settings.body_bytes, 'x')}
+                                   .construct();
+        const auto failed = http::Response{.code = 500,
+                                           .status_text = "Internal Server Error",
+                                           .headers = {{"Content-Type", "text/plain"}},
+                                           .body = std::string{"injected failure"}}
+                                .construct();
+
+        // The response to a HEAD request has the same headers as the one to a GET, with nothing after them
+        http::Parser parser{http::Parser::Kind::RESPONSE};
+        parser.parse(succeeded);
+        const auto head = succeeded.substr(0, parser.headersLength());
+
+        auto server = std::make_unique<Server>(_loop, _timers, port(stub), SOMAXCONN,
+                                               Server::KeepAlive{.idle_timeout = 60s, .max_requests = 1000000}, 0s,
+                                               [this, stub](AcceptData request) { receive(stub, request); });
+        _stubs.push_back(Stub{.settings = settings,
+                              .server = std::move(server),
+                              .succeeded = succeeded,
+                              .failed = failed,
+                              .head = head,
+                              .working = 0,
+                              .queued = {}});
+    }
+
+    _thread = std::thread{&StubFleet::run, this};
+}
+
+StubFleet::~StubFleet() {
+    _is_stopped = true;
+    _thread.join();
+}
+
+void StubFleet::receive(std::size_t stub, const AcceptData &request) {
+    auto &target = _stubs[stub];
+    if (request.data.view().substr(0, 5) == "HEAD ") {
+        target.server->respond(request.remote, target.head);
+        return;
+    }
+
+    target.queued.push_back(request.remote);
+    startQueued(stub);
+}
+
+void StubFleet::startQueued(std::size_t stub) {
+    auto &target = _stubs[stub];
+    const auto concurrency = target.settings.concurrency;
+    while (!target.queued.empty() && (concurrency == 0 || target.working < concurrency)) {
+        const auto remote = target.queued.front();
+        target.queued.pop_front();
+
+        const bool is_failed = target.settings.fail_percent > 0 &&
+            std::uniform_int_distribution<int>{1, 100}(_random) <= target.settings.fail_percent;
+        const auto delay = target.settings.delay.sample(_random);
+        if (delay.count() == 0) {
+            target.server->respond(remote, is_failed ? target.failed : target.succeeded);
+            continue;
+        }
+
+        target.working++;
+        _timers.schedule(delay, [this, stub, remote, is_failed] { finish(stub, remote, is_failed); });
+    }
+}
+
+void StubFleet::finish(std::size_t stub, RemoteId remote, bool is_failed) {
+    auto &target = _stubs[stub];
+    target.working--;
+    target.server->respond(remote, is_failed ? target.failed : target.succeeded);
+    startQueued(stub);
+}
+
+void StubFleet::run() {
+    while (!_is_stopped.load()) {
+        _loop.poll(static_cast<int>(delay_tick.count()));
+        _timers.advance();
+    }
+}
+
+} // namespace ls
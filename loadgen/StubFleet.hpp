@@ -0,0 +1,95 @@
+// A fleet of stand-in servers for benchmarking the balancer, all run on one thread of their own on loopback. Each
+// server answers every request with a fixed body after a delay drawn from its delay distribution, and can be made to
+// fail a share of its requests with a server error.
+//
+// Servers answer any number of requests at once by default. Given a concurrency limit, they only work on that many
+// requests at a time, queueing the rest in the order they arrived, like a real server with a fixed number of threads.
+// HEAD requests (which is what the balancer's health checks send) are always answered straight away.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "EventLoop.hpp"
+#include "Server.hpp"
+#include "TimerWheel.hpp"
+
+namespace ls {
+
+class StubFleet {
+public:
+    // How long a server takes to answer a request.
+    struct Delay {
+        // - FIXED: Always takes low
+        // - UNIFORM: Takes anywhere from low to high
+        // - BIMODAL: Takes low, except for slow_percent of requests which take high
+        enum class Kind { FIXED, UNIFORM, BIMODAL };
+
+        // Reads a delay from fixed:MS, uniform:MIN:MAX, or bimodal:FAST:SLOW:PERCENT, in milliseconds.
+        static Delay parse(std::string_view spec);
+
+        [[nodiscard]] std::chrono::milliseconds sample(std::mt19937 &random) const;
+
+    public:
+        Kind kind;
+        std::chrono::milliseconds low;
+        std::chrono::milliseconds high;
+        int slow_percent;
+    };
+
+    struct Settings {
+        Delay delay;
+        std::size_t body_bytes; // The size of every response's body
+        int fail_percent;       // Requests answered with a 500 instead
+        int concurrency;        // Requests worked on at once, or 0 for no limit
+    };
+
+    // Starts a server for each of the settings, on ports counting up from first_port.
+    StubFleet(int first_port, const std::vector<Settings> &servers);
+    ~StubFleet();
+
+    // No copying or moving a fleet, its thread holds on to it
+    StubFleet(StubFleet &) = delete;
+    StubFleet operator=(StubFleet &) = delete;
+    StubFleet(StubFleet &&) = delete;
+    StubFleet &operator=(StubFleet &&) = delete;
+
+    [[nodiscard]] inline int port(std::size_t server) const { return _first_port + static_cast<int>(server); }
+    [[nodiscard]] inline std::size_t size() const { return _stubs.size(); }
+
+private:
+    struct Stub {
+        Settings settings;
+        std::unique_ptr<Server> server;
+        std::string succeeded;       // The response to a request that succeeds
+        std::string failed;          // The response to a request that fails
+        std::string head;            // The response to a HEAD request, which has no body
+        int working = 0;             // Requests being worked on
+        std::deque<RemoteId> queued; // Requests waiting for the server to have room to work on them
+    };
+
+    void receive(std::size_t stub, const AcceptData &request);
+    // Starts on queued requests, for as long as the server has room to work on them.
+    void startQueued(std::size_t stub);
+    void finish(std::size_t stub, RemoteId remote, bool is_failed);
+    void run();
+
+private:
+    const int _first_port;
+    EventLoop _loop;
+    TimerWheel _timers;
+    std::vector<Stub> _stubs;
+    std::mt19937 _random{std::random_device{}()};
+    std::atomic_bool _is_stopped = false;
+    std::thread _thread;
+};
+
+} // namespace ls
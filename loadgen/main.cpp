@@ -0,0 +1,400 @@
+// lb-bench runs the balancer against a fleet of stand-in servers, all in one process on loopback, and drives it with an
+// open-loop load generator. Each strategy is run in turn against the same fleet, and its throughput, latency
+// percentiles, and the CPU time the balancer's own threads spent on each request are written out as a row of a table.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "LoadBalancer.hpp"
+#include "LoadGenerator.hpp"
+#include "Log.hpp"
+#include "StubFleet.hpp"
+
+using namespace ls;
+using namespace std::chrono_literals;
+
+constexpr int default_port = 40193;
+constexpr int default_backend_port = 41000;
+constexpr int default_backends = 10;
+constexpr const char *default_delay = "uniform:0:10";
+constexpr const char *default_weights = "1";
+constexpr int default_body_bytes = 1024;
+constexpr int default_fail_percent = 0;
+constexpr int default_concurrency = 0;
+constexpr int default_rate = 1000;
+constexpr std::chrono::seconds default_duration = 10s;
+constexpr std::chrono::seconds default_drain = 10s;
+constexpr int default_connections = 256;
+constexpr int default_paths = 1024;
+constexpr int default_workers = 1;
+constexpr int default_retries = 3;
+constexpr const char *default_strategies = "robin,least,random,p2c,hash";
+constexpr int default_log_level = 1;
+
+// How long the balancer has to start listening before the run is given up on
+constexpr std::chrono::seconds startup_timeout = 5s;
+
+// --- Function Declarations ---
+
+struct SetupArgs {
+    static SetupArgs getFlags(int argc, char **argv);
+    inline static void printUsageMessage(char **argv) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [-h | --help] [-p | --port PORT] [--backend-port PORT] [--backends SERVERS]"
+                  << " [--delay DELAY[,DELAY...]] [--weights WEIGHT[,WEIGHT...]] [--body BYTES] [--fail PERCENT]"
+                  << " [--concurrency REQUESTS] [--rate REQUESTS] [--duration SECONDS] [--drain SECONDS]"
+                  << " [--connections CONNECTIONS] [--paths PATHS] [-w | --workers WORKERS] [-r | --retries RETRIES]"
+                  << " [--io-uring] [--strategies STRATEGY[,STRATEGY...]] [--scenario SCENARIO] [--log LEVEL]\n \n"
+                  << "Valid delays, in milliseconds (servers take turns through a list of them):\n"
+                  << "\tfixed:MS, uniform:MIN:MAX, bimodal:FAST:SLOW:PERCENT_SLOW\n"
+                  << "Valid strategies: robin, least, random, p2c, hash\n"
+                  << "Valid scenarios (flags after the scenario override it):\n"
+                  << "\tdiff-delay-diff-weights, diff-delay-same-weights, same-delay-same-weights\n";
+    }
+
+public:
+    int port;
+    int backend_port;
+    int backends;
+    std::vector<StubFleet::Delay> delays;
+    std::vector<int> weights;
+    int body_bytes;
+    int fail_percent;
+    int concurrency;
+    int rate;
+    std::chrono::seconds duration;
+    std::chrono::seconds drain;
+    int connections;
+    int paths;
+    int workers;
+    int retries;
+    bool is_io_uring;
+    std::vector<std::pair<std::string, LoadBalancer::Strategy>> strategies;
+};
+
+bool waitUntilListening(int port);
+// The ids of this process' threads.
+std::vector<std::string> threadIds();
+// CPU time the given threads of this process have used so far, in microseconds. Threads that have exited count for
+// nothing.
+std::uint64_t cpuMicros(const std::vector<std::string> &threads);
+void printReport(const std::string &strategy, const LoadGenerator::Report &report, std::uint64_t cpu_us);
+
+// ------
+
+int main(int argc, char **argv) {
+    SetupArgs args;
+    out::level = default_log_level;
+
+    try {
+        args = SetupArgs::getFlags(argc, argv);
+    } catch (const std::logic_error &e) {
+        std::cerr << out::err << e.what() << "\n";
+        SetupArgs::printUsageMessage(argv);
+        return 1;
+    }
+
+    // The generator, the balancer, and the servers all hold their connections open in this one process
+    rlimit files{};
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    std::vector<StubFleet::Settings> servers;
+    for (int i = 0; i < args.backends; i++) {
+        servers.push_back({.delay = args.delays[i % args.delays.size()],
+                           .body_bytes = static_cast<std::size_t>(args.body_bytes),
+                           .fail_percent = args.fail_percent,
+                           .concurrency = args.concurrency});
+    }
+
+    try {
+        StubFleet fleet{args.backend_port, servers};
+
+        std::cout << std::left << std::setw(10) << "strategy" << std::right << std::setw(10) << "sent" << std::setw(10)
+                  << "ok" << std::setw(10) << "failed" << std::setw(12) << "unanswered" << std::setw(12) << "req/s"
+                  << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << std::setw(12) << "p99.9 ms"
+                  << std::setw(12) << "max ms" << std::setw(16) << "lb cpu us/req" << std::endl;
+
+        for (const auto &[name, strategy] : args.strategies) {
+            std::atomic_bool quit{false};
+            LoadBalancer lb{args.port, SOMAXCONN, args.retries, 30s, quit};
+            for (int i = 0; i < args.backends; i++) {
+                auto metadata = Metadata::makeDefault();
+                metadata.weight = args.weights[i % args.weights.size()];
+                lb.addConnection("127.0.0.1", fleet.port(i), metadata);
+            }
+            lb.use(strategy);
+            lb.useWorkers(args.workers);
+            lb.useIoUring(args.is_io_uring);
+
+            // The balancer's CPU time is told apart from the generator's and the servers' by the threads it started
+            const auto threads_before = threadIds();
+            std::thread balancer{[&lb] { lb.start(); }};
+            if (!waitUntilListening(args.port)) {
+                quit = true;
+                balancer.join();
+                std::cerr << out::err << "The balancer didn't start listening on port " << args.port << "\n";
+                out::flush();
+                return 1;
+            }
+
+            LoadGenerator generator{{.port = args.port,
+                                     .rate = args.rate,
+                                     .duration = args.duration,
+                                     .drain_timeout = args.drain,
+                                     .max_connections = args.connections,
+                                     .paths = args.paths}};
+            std::vector<std::string> balancer_threads;
+            for (const auto &thread : threadIds()) {
+                if (std::find(threads_before.begin(), threads_before.end(), thread) == threads_before.end()) {
+                    balancer_threads.push_back(thread);
+                }
+            }
+
+            const auto cpu_start = cpuMicros(balancer_threads);
+            const auto report = generator.run();
+            const auto cpu_used = cpuMicros(balancer_threads) - cpu_start;
+            quit = true;
+            balancer.join();
+
+            printReport(name, report, cpu_used);
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << out::err << e.what() << "\n";
+        out::flush();
+        return 1;
+    }
+
+    out::flush();
+    return 0;
+}
+
+// --- Function Definitions ---
+int getIntMinBounded(std::string s, int min = 0) {
+    int val = std::stoi(s);
+    if (val < min) { throw std::invalid_argument{s + " can't be less than " + std::to_string(min)}; }
+    return val;
+}
+
+std::vector<std::string> splitList(const std::string &s) {
+    std::vector<std::string> items;
+    std::size_t start = 0;
+    while (true) {
+        const auto end = s.find(',', start);
+        items.push_back(s.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos) { return items; }
+        start = end + 1;
+    }
+}
+
+std::vector<StubFleet::Delay> getDelays(const std::string &s) {
+    std::vector<StubFleet::Delay> delays;
+    for (const auto &spec : splitList(s)) { delays.push_back(StubFleet::Delay::parse(spec)); }
+    return delays;
+}
+
+std::vector<int> getWeights(const std::string &s) {
+    std::vector<int> weights;
+    for (const auto &weight : splitList(s)) { weights.push_back(getIntMinBounded(weight, 1)); }
+    return weights;
+}
+
+std::vector<std::pair<std::string, LoadBalancer::Strategy>> getStrategies(const std::string &s) {
+    using Strategy = LoadBalancer::Strategy;
+
+    std::vector<std::pair<std::string, Strategy>> strategies;
+    for (const auto &name : splitList(s)) {
+        if (name == "robin")
+            strategies.emplace_back(name, Strategy::WEIGHTED_ROUND_ROBIN);
+        else if (name == "least")
+            strategies.emplace_back(name, Strategy::LEAST_CONNECTIONS);
+        else if (name == "random")
+            strategies.emplace_back(name, Strategy::RANDOM);
+        else if (name == "p2c")
+            strategies.emplace_back(name, Strategy::POWER_OF_TWO_CHOICES);
+        else if (name == "hash")
+            strategies.emplace_back(name, Strategy::CONSISTENT_HASHING);
+        else
+            throw std::invalid_argument{name + " isn't a valid strategy"};
+    }
+    return strategies;
+}
+
+// The scenarios from docs/Experimentations.md. Each server waits anywhere up to its maximum delay, and like the Python
+// servers the experiments were run against, only works on one request at a time.
+void useScenario(SetupArgs &args, const std::string &scenario) {
+    const std::string different_delays = "uniform:0:1000,uniform:0:1000,uniform:0:1000,uniform:0:2000,uniform:0:2000,"
+                                         "uniform:0:1000,uniform:0:2000,uniform:0:2000,uniform:0:2000,uniform:0:500";
+    if (scenario == "diff-delay-diff-weights") {
+        args.delays = getDelays(different_delays);
+        args.weights = getWeights("2,2,2,1,1,2,1,1,1,3");
+    } else if (scenario == "diff-delay-same-weights") {
+        args.delays = getDelays(different_delays);
+        args.weights = getWeights("1");
+    } else if (scenario == "same-delay-same-weights") {
+        args.delays = getDelays("uniform:0:1000");
+        args.weights = getWeights("1");
+    } else {
+        throw std::invalid_argument{scenario + " isn't a valid scenario"};
+    }
+
+    args.backends = 20;
+    args.concurrency = 1;
+    args.rate = 20;
+}
+
+SetupArgs SetupArgs::getFlags(int argc, char **argv) {
+    SetupArgs args{.port = default_port,
+                   .backend_port = default_backend_port,
+                   .backends = default_backends,
+                   .delays = getDelays(default_delay),
+                   .weights = getWeights(default_weights),
+                   .body_bytes = default_body_bytes,
+                   .fail_percent = default_fail_percent,
+                   .concurrency = default_concurrency,
+                   .rate = default_rate,
+                   .duration = default_duration,
+                   .drain = default_drain,
+                   .connections = default_connections,
+                   .paths = default_paths,
+                   .workers = default_workers,
+                   .retries = default_retries,
+                   .is_io_uring = false,
+                   .strategies = getStrategies(default_strategies)};
+
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "-h" || flag == "--help") {
+            printUsageMessage(argv);
+            exit(0);
+        } else if (flag == "--io-uring") {
+            args.is_io_uring = true;
+            continue;
+        }
+
+        // Every other flag takes an argument
+        if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+        std::string value = argv[++i];
+
+        if (flag == "--log") {
+            out::level = getIntMinBounded(value);
+        } else if (flag == "-p" || flag == "--port") {
+            args.port = getIntMinBounded(value, 1);
+        } else if (flag == "--backend-port") {
+            args.backend_port = getIntMinBounded(value, 1);
+        } else if (flag == "--backends") {
+            args.backends = getIntMinBounded(value, 1);
+        } else if (flag == "--delay") {
+            args.delays = getDelays(value);
+        } else if (flag == "--weights") {
+            args.weights = getWeights(value);
+        } else if (flag == "--body") {
+            args.body_bytes = getIntMinBounded(value);
+        } else if (flag == "--fail") {
+            args.fail_percent = getIntMinBounded(value);
+            if (args.fail_percent > 100) { throw std::invalid_argument{"failures can't be over 100%"}; }
+        } else if (flag == "--concurrency") {
+            args.concurrency = getIntMinBounded(value);
+        } else if (flag == "--rate") {
+            args.rate = getIntMinBounded(value, 1);
+        } else if (flag == "--duration") {
+            args.duration = std::chrono::seconds(getIntMinBounded(value, 1));
+        } else if (flag == "--drain") {
+            args.drain = std::chrono::seconds(getIntMinBounded(value));
+        } else if (flag == "--connections") {
+            args.connections = getIntMinBounded(value, 1);
+        } else if (flag == "--paths") {
+            args.paths = getIntMinBounded(value, 1);
+        } else if (flag == "-w" || flag == "--workers") {
+            args.workers = getIntMinBounded(value, 1);
+        } else if (flag == "-r" || flag == "--retries") {
+            args.retries = getIntMinBounded(value);
+        } else if (flag == "--strategies") {
+            args.strategies = getStrategies(value);
+        } else if (flag == "--scenario") {
+            useScenario(args, value);
+        } else {
+            throw std::invalid_argument{flag + " isn't a valid flag"};
+        }
+    }
+
+    if (args.backend_port + args.backends > 65536) { throw std::invalid_argument{"not enough ports for the servers"}; }
+    if (args.port >= args.backend_port && args.port < args.backend_port + args.backends) {
+        throw std::invalid_argument{"the balancer's port is taken by one of the servers"};
+    }
+    return args;
+}
+
+bool waitUntilListening(int port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    const auto given_up = std::chrono::steady_clock::now() + startup_timeout;
+    while (std::chrono::steady_clock::now() < given_up) {
+        const sockets::Socket probe{sockets::createSocket(), "startup probe"};
+        if (connect(probe.fd(), sockets::asGeneric(&address), sizeof(address)) == 0) { return true; }
+        std::this_thread::sleep_for(10ms);
+    }
+    return false;
+}
+
+std::vector<std::string> threadIds() {
+    std::vector<std::string> threads;
+    for (const auto &task : std::filesystem::directory_iterator{"/proc/self/task"}) {
+        threads.push_back(task.path().filename().string());
+    }
+    return threads;
+}
+
+std::uint64_t cpuMicros(const std::vector<std::string> &threads) {
+    const auto ticks_per_second = static_cast<std::uint64_t>(sysconf(_SC_CLK_TCK));
+    std::uint64_t micros = 0;
+    for (const auto &thread : threads) {
+        std::ifstream stat{"/proc/self/task/" + thread + "/stat"};
+        std::string line;
+        if (!std::getline(stat, line)) { continue; }
+
+        // The user and system times are the 12th and 13th fields after the thread's name, which can hold spaces
+        std::istringstream fields{line.substr(line.rfind(')') + 2)};
+        std::string skipped;
+        for (int field = 0; field < 11; field++) { fields >> skipped; }
+        std::uint64_t user_ticks = 0;
+        std::uint64_t system_ticks = 0;
+        fields >> user_ticks >> system_ticks;
+        micros += (user_ticks + system_ticks) * 1000000 / ticks_per_second;
+    }
+    return micros;
+}
+
+void printReport(const std::string &strategy, const LoadGenerator::Report &report, std::uint64_t cpu_us) {
+    const auto seconds = std::chrono::duration<double>(report.elapsed).count();
+    const auto answered = std::max<std::uint64_t>(report.succeeded + report.failed, 1);
+    const auto millis = [](std::uint64_t us) { return static_cast<double>(us) / 1000; };
+    std::cout << std::left << std::setw(10) << strategy << std::right << std::setw(10) << report.sent
+              << std::setw(10) << report.succeeded << std::setw(10) << report.failed << std::setw(12)
+              << report.unanswered << std::fixed << std::setprecision(1) << std::setw(12)
+              << static_cast<double>(report.succeeded + report.failed) / seconds << std::setprecision(2)
+              << std::setw(12) << millis(report.p50_us) << std::setw(12) << millis(report.p99_us) << std::setw(12)
+              << millis(report.p999_us) << std::setw(12) << millis(report.max_us) << std::setprecision(1)
+              << std::setw(16) << static_cast<double>(cpu_us) / static_cast<double>(answered) << std::endl;
+}
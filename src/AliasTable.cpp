@@ -0,0 +1,53 @@
+#include "AliasTable.hpp"
+
+namespace ls {
+
+static constexpr double coin_sides = 4294967296.0; // 2^32
+
+AliasTable::AliasTable(const std::vector<int> &weights) : _weights(weights) {
+    double total_weight = 0;
+    std::vector<std::uint32_t> servers;
+    for (std::uint32_t i = 0; i < weights.size(); i++) {
+        if (weights[i] <= 0) { continue; }
+        servers.push_back(i);
+        total_weight += weights[i];
+    }
+    if (servers.empty()) { return; }
+
+    // Scales every share so that the average share fills exactly one column
+    std::vector<double> shares;
+    std::vector<std::size_t> small;
+    std::vector<std::size_t> large;
+    for (std::size_t column = 0; column < servers.size(); column++) {
+        shares.push_back(weights[servers[column]] * servers.size() / total_weight);
+        (shares.back() < 1 ? small : large).push_back(column);
+    }
+
+    // Each column that's short of a full share is topped up by a server with more than it needs
+    _columns.resize(servers.size());
+    while (!small.empty() && !large.empty()) {
+        const auto short_column = small.back();
+        const auto donor = large.back();
+        small.pop_back();
+
+        _columns[short_column] = {.threshold = static_cast<std::uint64_t>(shares[short_column] * coin_sides),
+                                  .server = servers[short_column],
+                                  .alias = servers[donor]};
+
+        shares[donor] -= 1 - shares[short_column];
+        if (shares[donor] < 1) {
+            large.pop_back();
+            small.push_back(donor);
+        }
+    }
+
+    // Whatever is left is only off from a full share by rounding errors
+    for (const auto column : large) {
+        _columns[column] = {.threshold = 1ull << 32, .server = servers[column], .alias = servers[column]};
+    }
+    for (const auto column : small) {
+        _columns[column] = {.threshold = 1ull << 32, .server = servers[column], .alias = servers[column]};
+    }
+}
+
+} // namespace ls
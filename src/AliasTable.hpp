@@ -0,0 +1,42 @@
+// A table for picking servers at random in proportion to their weights, using Vose's alias method. Each column of the
+// table holds one server, plus an alias to a second server that fills out the rest of the column's share. A pick
+// chooses a column uniformly, then flips a biased coin between the column's server and its alias, which takes constant
+// time no matter how many servers there are or how their weights are spread.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ls {
+
+class AliasTable {
+public:
+    // Servers with no weight are left out of the table, and are never picked.
+    explicit AliasTable(const std::vector<int> &weights);
+
+    // Returns the index of a server, given a uniformly random number.
+    [[nodiscard]] inline std::size_t sample(std::uint64_t random) const {
+        const auto &column = _columns[(random >> 32) % _columns.size()];
+        return (random & 0xFFFFFFFF) < column.threshold ? column.server : column.alias;
+    }
+
+    [[nodiscard]] inline bool includes(std::size_t server) const { return _weights[server] > 0; }
+    [[nodiscard]] inline std::size_t serverCount() const { return _weights.size(); }
+    [[nodiscard]] inline int weightOf(std::size_t server) const { return _weights[server]; }
+    [[nodiscard]] inline bool isEmpty() const { return _columns.empty(); }
+
+private:
+    struct Column {
+        std::uint64_t threshold; // Out of 2^32, the chance the column's own server is picked over its alias
+        std::uint32_t server;
+        std::uint32_t alias;
+    };
+
+private:
+    std::vector<Column> _columns;
+    std::vector<int> _weights;
+};
+
+} // namespace ls
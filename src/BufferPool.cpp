@@ -0,0 +1,109 @@
+#include "BufferPool.hpp"
+#include <cassert>
+#include <cstring>
+#include <new>
+
+namespace ls {
+
+// Hands the thread's pool over to its blocks once the thread exits, since buffers can outlive it.
+struct BufferPoolOwner {
+    ~BufferPoolOwner() { pool->orphan(); }
+
+public:
+    BufferPool *pool = new BufferPool();
+};
+
+static thread_local BufferPoolOwner pool_owner;
+
+Buffer::~Buffer() { release(); }
+
+char *Buffer::bytes(Header *header) { return reinterpret_cast<char *>(header + 1); }
+
+Buffer Buffer::copy(std::string_view data) {
+    auto *header = BufferPool::local().take(data.length());
+    header->references = 1;
+    header->length = data.length();
+    std::memcpy(bytes(header), data.data(), data.length());
+    return Buffer(header);
+}
+
+Buffer::Buffer(const Buffer &other) : _header(other._header) {
+    if (_header != nullptr) {
+        assert(_header->pool->isUsableHere());
+        _header->references++;
+    }
+}
+
+Buffer &Buffer::operator=(const Buffer &other) {
+    if (other._header != nullptr) {
+        assert(other._header->pool->isUsableHere());
+        other._header->references++;
+    }
+    release();
+    _header = other._header;
+    return *this;
+}
+
+Buffer::Buffer(Buffer &&other) noexcept : _header(other._header) { other._header = nullptr; }
+
+Buffer &Buffer::operator=(Buffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        _header = other._header;
+        other._header = nullptr;
+    }
+    return *this;
+}
+
+std::string_view Buffer::view() const {
+    if (_header == nullptr) { return {}; }
+    return {bytes(_header), _header->length};
+}
+
+void Buffer::release() {
+    if (_header == nullptr) { return; }
+    assert(_header->pool->isUsableHere());
+    if (--_header->references == 0) { _header->pool->give(_header); }
+    _header = nullptr;
+}
+
+BufferPool &BufferPool::local() { return *pool_owner.pool; }
+
+Buffer::Header *BufferPool::take(std::size_t length) {
+    _outstanding++;
+    if (length > Buffer::block_size) {
+        return new (::operator new(sizeof(Buffer::Header) + length)) Buffer::Header{this, 0, length};
+    }
+
+    if (_free.empty()) {
+        auto &slab = _slabs.emplace_back(new std::byte[slab_blocks * slab_stride]);
+        _free.reserve(_slabs.size() * slab_blocks);
+        for (std::size_t block = slab_blocks; block > 0; block--) {
+            _free.push_back(new (slab.get() + (block - 1) * slab_stride) Buffer::Header{this, 0, 0});
+        }
+    }
+
+    auto *block = _free.back();
+    _free.pop_back();
+    return block;
+}
+
+void BufferPool::give(Buffer::Header *block) {
+    // Blocks too large for the slabs were taken from the heap, and their length never changes
+    if (block->length > Buffer::block_size) {
+        ::operator delete(block);
+    } else {
+        _free.push_back(block);
+    }
+    _outstanding--;
+    if (_is_orphaned && _outstanding == 0) { delete this; }
+}
+
+bool BufferPool::isUsableHere() const { return _is_orphaned || _owner == std::this_thread::get_id(); }
+
+void BufferPool::orphan() {
+    _is_orphaned = true;
+    if (_outstanding == 0) { delete this; }
+}
+
+} // namespace ls
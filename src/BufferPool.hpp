@@ -0,0 +1,114 @@
+// Requests are read into a connection's own buffer, then copied out into a buffer of their own that's handed around
+// the worker: to whichever transaction sends it on, to any retries or hedges of it, and back again when it's answered.
+// Buffers are shared by reference rather than copied, so every attempt at a request holds the same bytes.
+//
+// Buffers are taken from a pool of fixed-size blocks kept by each thread, carved out of larger slabs, so copying a
+// request out doesn't touch the heap once the pool has warmed up. Requests too large for a block are given one of
+// their own from the heap instead. That copy is all that's pooled: connections still read into growing strings,
+// responses are still read, cached, and sent as strings, and every transaction still allocates its own state.
+//
+// Neither the reference count nor the pool is thread-safe, so a buffer can only be copied or dropped on the thread it
+// was taken on (or once that thread has exited), which debug builds assert.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ls {
+
+class BufferPool;
+
+class Buffer {
+public:
+    // Bytes that fit in a pooled block, which covers the headers of almost every request
+    static constexpr std::size_t block_size = 4096;
+
+    Buffer() = default;
+    ~Buffer();
+
+    // Copies the data into a buffer from this thread's pool, or from the heap if it's too large for a block.
+    static Buffer copy(std::string_view data);
+
+    // Copies share the same bytes
+    Buffer(const Buffer &other);
+    Buffer &operator=(const Buffer &other);
+    Buffer(Buffer &&other) noexcept;
+    Buffer &operator=(Buffer &&other) noexcept;
+
+    [[nodiscard]] std::string_view view() const;
+    [[nodiscard]] inline operator std::string_view() const { return view(); }
+    [[nodiscard]] inline std::size_t length() const { return view().length(); }
+    [[nodiscard]] inline bool empty() const { return length() == 0; }
+
+private:
+    friend class BufferPool;
+
+    // Sits at the start of every block, ahead of the bytes it holds.
+    struct Header {
+        BufferPool *pool; // The pool of the thread that took the block, which it goes back to unless it's from the heap
+        std::uint32_t references;
+        std::size_t length;
+    };
+
+    explicit Buffer(Header *header) : _header(header) {}
+    // The bytes held by a block, which start right after its header.
+    static char *bytes(Header *header);
+    void release();
+
+private:
+    Header *_header = nullptr;
+};
+
+// The blocks kept by one thread. Blocks are handed out and taken back from a free list, and slabs are only ever
+// freed once the thread has exited and every block in them has come back.
+class BufferPool {
+public:
+    // Blocks carved out of every slab
+    static constexpr std::size_t slab_blocks = 64;
+
+    // The pool for the calling thread, set up on first use.
+    static BufferPool &local();
+
+    // No copying or moving a pool, its blocks point back to it
+    BufferPool(BufferPool &) = delete;
+    BufferPool operator=(BufferPool &) = delete;
+    BufferPool(BufferPool &&) = delete;
+    BufferPool &operator=(BufferPool &&) = delete;
+
+    [[nodiscard]] inline std::size_t slabs() const { return _slabs.size(); }
+    [[nodiscard]] inline std::size_t outstanding() const { return _outstanding; }
+
+private:
+    friend class Buffer;
+    friend struct BufferPoolOwner;
+
+    // Blocks are laid out back to back in a slab, each one's header followed by its bytes
+    static constexpr std::size_t slab_stride = sizeof(Buffer::Header) + Buffer::block_size;
+    static_assert(slab_stride % alignof(Buffer::Header) == 0);
+
+    BufferPool() = default;
+    ~BufferPool() = default;
+
+    // Hands out a block with room for length bytes, from the free list if it fits or from the heap otherwise.
+    Buffer::Header *take(std::size_t length);
+    void give(Buffer::Header *block);
+    // Whether the pool's buffers can be copied and dropped on the calling thread.
+    [[nodiscard]] bool isUsableHere() const;
+    // Called once the owning thread exits. The pool is freed straight away if no blocks are out, or by the last of them
+    // to come back otherwise.
+    void orphan();
+
+private:
+    std::vector<std::unique_ptr<std::byte[]>> _slabs;
+    std::vector<Buffer::Header *> _free;
+    std::size_t _outstanding = 0; // Blocks handed out, including the ones from the heap
+    bool _is_orphaned = false;
+    const std::thread::id _owner = std::this_thread::get_id();
+};
+
+} // namespace ls
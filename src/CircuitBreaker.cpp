@@ -0,0 +1,116 @@
+#include "CircuitBreaker.hpp"
+#include <algorithm>
+
+namespace ls {
+
+static std::int64_t secondOf(CircuitBreaker::clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+double CircuitBreaker::Window::errorRate() const {
+    if (transactions == 0) { return 0; }
+    return static_cast<double>(errors) / static_cast<double>(transactions);
+}
+
+double CircuitBreaker::Window::meanLatency() const {
+    const auto successes = transactions - errors;
+    if (successes == 0) { return 0; }
+    return static_cast<double>(total_latency.count()) / static_cast<double>(successes);
+}
+
+void CircuitBreaker::recordSent() {
+    if (_state.load(std::memory_order_relaxed) != State::HALF_OPEN) { return; }
+
+    std::scoped_lock lock{_mutex};
+    if (_state != State::HALF_OPEN || _is_trial_sent) { return; }
+    _is_trial_sent = true;
+    _is_open = true;
+}
+
+bool CircuitBreaker::record(bool is_success, std::chrono::nanoseconds latency, clock::time_point now) {
+    std::scoped_lock lock{_mutex};
+
+    const auto second = secondOf(now);
+    auto &bucket = _buckets[static_cast<std::uint64_t>(second) % window_seconds];
+    if (bucket.second != second) { bucket = Bucket{.second = second}; }
+    bucket.transactions++;
+    if (is_success) {
+        bucket.total_latency += latency;
+    } else {
+        bucket.errors++;
+    }
+
+    // Requests that were already in progress when the breaker half-opened aren't told apart from the trial, since
+    // they say just as much about whether the server is back
+    if (_state != State::HALF_OPEN || !_is_trial_sent) { return false; }
+    if (is_success) {
+        _buckets = {};
+        _state = State::CLOSED;
+        _is_open = false;
+        _changed = now;
+    } else {
+        _ejections++;
+        open(now, std::min(_ejection_time * 2, _max_ejection_time));
+    }
+    return true;
+}
+
+void CircuitBreaker::recordAbandoned() {
+    if (_state.load(std::memory_order_relaxed) != State::HALF_OPEN) { return; }
+
+    std::scoped_lock lock{_mutex};
+    if (_state != State::HALF_OPEN || !_is_trial_sent) { return; }
+    _is_trial_sent = false;
+    _is_open = false;
+}
+
+CircuitBreaker::clock::duration CircuitBreaker::eject(clock::time_point now, clock::duration base_time,
+                                                      clock::duration max_time) {
+    std::scoped_lock lock{_mutex};
+
+    auto time = std::min(base_time, max_time);
+    for (int i = 0; i < _ejections && time < max_time; i++) { time = std::min(time * 2, max_time); }
+    _ejections++;
+    _max_ejection_time = max_time;
+    open(now, time);
+    return time;
+}
+
+bool CircuitBreaker::update(clock::time_point now) {
+    std::scoped_lock lock{_mutex};
+
+    if (_state == State::OPEN && now - _changed >= _ejection_time) {
+        _state = State::HALF_OPEN;
+        _is_trial_sent = false;
+        _is_open = false;
+        return true;
+    }
+    if (_state == State::CLOSED && _ejections > 0 && now - _changed >= _max_ejection_time) { _ejections = 0; }
+    return false;
+}
+
+CircuitBreaker::Window CircuitBreaker::window(clock::time_point now) const {
+    std::scoped_lock lock{_mutex};
+
+    const auto second = secondOf(now);
+    Window window{.transactions = 0, .errors = 0, .total_latency = std::chrono::nanoseconds(0)};
+    for (const auto &bucket : _buckets) {
+        if (bucket.second <= second - static_cast<std::int64_t>(window_seconds) || bucket.second > second) { continue; }
+        window.transactions += bucket.transactions;
+        window.errors += bucket.errors;
+        window.total_latency += bucket.total_latency;
+    }
+    return window;
+}
+
+void CircuitBreaker::open(clock::time_point now, clock::duration time) {
+    // Whatever the server did before it was ejected shouldn't count against it once it's back
+    _buckets = {};
+    _state = State::OPEN;
+    _is_open = true;
+    _is_trial_sent = false;
+    _ejection_time = time;
+    _changed = now;
+}
+
+} // namespace ls
@@ -0,0 +1,93 @@
+// Keeps track of how a single server has been handling real transactions, and whether it's been ejected for handling
+// them badly. Outcomes are counted in a sliding window of one second buckets, so old failures drop out on their own.
+//
+// The breaker is closed while the server takes requests as usual. Once the OutlierDetector decides the server is an
+// outlier, the breaker opens and the server is ejected for a while, twice as long for every ejection in a row. When
+// the ejection is up, the breaker is half-open, and lets a single trial request through. The breaker closes again if
+// the trial succeeds, and opens for even longer if it fails.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace ls {
+
+class CircuitBreaker {
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class State { CLOSED, OPEN, HALF_OPEN };
+
+    // What happened to the server's transactions over the window.
+    struct Window {
+        std::uint64_t transactions;
+        std::uint64_t errors;
+        std::chrono::nanoseconds total_latency; // Of the transactions that succeeded
+
+    public:
+        [[nodiscard]] double errorRate() const;
+        [[nodiscard]] double meanLatency() const; // In nanoseconds
+    };
+
+    static constexpr std::size_t window_seconds = 10;
+
+    CircuitBreaker() = default;
+
+    // No copying or moving a breaker, it's shared by every worker
+    CircuitBreaker(CircuitBreaker &) = delete;
+    CircuitBreaker operator=(CircuitBreaker &) = delete;
+    CircuitBreaker(CircuitBreaker &&) = delete;
+    CircuitBreaker &operator=(CircuitBreaker &&) = delete;
+
+    // Called as a request is sent to the server. If the breaker is half-open, this request is its trial, and nothing
+    // else is let through until the trial is answered.
+    void recordSent();
+
+    // Adds a transaction's outcome to the window. Returns true if this was a trial, and the breaker opened or closed.
+    bool record(bool is_success, std::chrono::nanoseconds latency, clock::time_point now = clock::now());
+
+    // Called when a request is given up on before it's answered, like the slower copy of a hedged request. Nothing is
+    // added to the window, but if the request was the breaker's trial, another one is let through in its place.
+    void recordAbandoned();
+
+    // Ejects the server for base_time, doubled for every ejection in a row so far, up to max_time. Returns how long
+    // the server is ejected for.
+    clock::duration eject(clock::time_point now, clock::duration base_time, clock::duration max_time);
+
+    // Half-opens the breaker if the server's ejection is up, and forgets about past ejections once the server has been
+    // back for max_time. Returns true if the breaker half-opened.
+    bool update(clock::time_point now);
+
+    [[nodiscard]] Window window(clock::time_point now = clock::now()) const;
+    [[nodiscard]] inline State state() const { return _state.load(std::memory_order_relaxed); }
+
+    // Whether requests are being kept from the server. Read without a lock, on every pick.
+    [[nodiscard]] inline bool isOpen() const { return _is_open.load(std::memory_order_relaxed); }
+
+private:
+    struct Bucket {
+        std::int64_t second = -1; // Which second since the clock's epoch the bucket is counting
+        std::uint64_t transactions = 0;
+        std::uint64_t errors = 0;
+        std::chrono::nanoseconds total_latency{0};
+    };
+
+    void open(clock::time_point now, clock::duration time);
+
+private:
+    std::atomic_bool _is_open = false;
+    std::atomic<State> _state = State::CLOSED; // Only changed while holding the lock
+    mutable std::mutex _mutex;
+    std::array<Bucket, window_seconds> _buckets;
+    bool _is_trial_sent = false;
+    int _ejections = 0; // Ejections in a row, without the server staying back in between
+    clock::duration _ejection_time{0};
+    clock::duration _max_ejection_time{0};
+    clock::time_point _changed; // When the breaker last opened or closed
+};
+
+} // namespace ls
@@ -0,0 +1,338 @@
+#include "EventLoop.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Log.hpp"
+
+namespace ls {
+
+// The event data packs the descriptor alongside the serial of its registration. Descriptors are reused by the kernel as
+// soon as they are closed, so an event still queued for a descriptor that was removed (and then re-added) in the same
+// batch is recognized as stale and dropped.
+static inline std::uint64_t pack(int fd, std::uint32_t serial) {
+    return (static_cast<std::uint64_t>(serial) << 32) | static_cast<std::uint32_t>(fd);
+}
+
+EventLoop::EventLoop(Backend backend) {
+    if (backend == Backend::IO_URING) {
+#if LS_HAS_IO_URING
+        _ring = IoUring::create(ring_entries);
+        if (_ring != nullptr) {
+            _can_multishot = _ring->provideBuffers(receive_buffers, receive_buffer_size);
+            if (!_can_multishot) {
+                std::cerr << out::warn
+                          << "io_uring can't accept and receive on its own here (Linux 6.0 or later is needed), "
+                             "polling sockets for readiness instead\n";
+            }
+            return;
+        }
+        std::cerr << out::warn << "io_uring isn't available, falling back to epoll\n";
+#else
+        std::cerr << out::warn << "This build doesn't support io_uring, falling back to epoll\n";
+#endif
+    }
+    _epoll.emplace(epoll_create1(EPOLL_CLOEXEC), "epoll");
+}
+
+EventLoop::Backend EventLoop::backend() const { return _epoll.has_value() ? Backend::EPOLL : Backend::IO_URING; }
+
+void EventLoop::add(int fd, std::uint32_t events, Handler handler) {
+    const auto serial = _next_serial++;
+    const auto &registration =
+        _registrations
+            .insert_or_assign(fd, Registration{serial, events, std::make_shared<Handler>(std::move(handler))})
+            .first->second;
+
+#if LS_HAS_IO_URING
+    if (_ring != nullptr) {
+        watch(fd, registration);
+        return;
+    }
+#endif
+
+    epoll_event event{.events = events, .data = {.u64 = pack(fd, serial)}};
+    if (epoll_ctl(_epoll->fd(), EPOLL_CTL_ADD, fd, &event) != 0) {
+        _registrations.erase(fd);
+        std::cerr << out::err << "Failed to watch fd " << fd << ": " << std::strerror(errno) << "\n";
+        throw std::runtime_error(std::strerror(errno));
+    }
+}
+
+void EventLoop::modify(int fd, std::uint32_t events) {
+    const auto registration = _registrations.find(fd);
+    if (registration == _registrations.end()) { return; }
+    registration->second.events = events;
+
+#if LS_HAS_IO_URING
+    // A poll's events can't be changed in place, so it's swapped out for a new one under a new serial
+    if (_ring != nullptr) {
+        unwatch(fd, registration->second.serial);
+        registration->second.serial = _next_serial++;
+        watch(fd, registration->second);
+        return;
+    }
+#endif
+
+    epoll_event event{.events = events, .data = {.u64 = pack(fd, registration->second.serial)}};
+    if (epoll_ctl(_epoll->fd(), EPOLL_CTL_MOD, fd, &event) != 0) {
+        std::cerr << out::warn << "Failed to modify watched fd " << fd << ": " << std::strerror(errno) << "\n";
+    }
+}
+
+void EventLoop::rebind(int fd, Handler handler) {
+    const auto registration = _registrations.find(fd);
+    if (registration == _registrations.end()) { return; }
+    registration->second.handler = std::make_shared<Handler>(std::move(handler));
+}
+
+void EventLoop::remove(int fd) {
+#if LS_HAS_IO_URING
+    const auto multishot = _multishots.find(fd);
+    if (multishot != _multishots.end()) {
+        if (multishot->second.is_running) { cancel(pack(fd, multishot->second.serials.back())); }
+        // Connections that were accepted before the cancellation went through have nothing left to hand them to
+        if (multishot->second.on_accept != nullptr) {
+            for (const auto serial : multishot->second.serials) { _abandoned_accepts.insert(pack(fd, serial)); }
+        }
+        _multishots.erase(multishot);
+    }
+#endif
+
+    const auto registration = _registrations.find(fd);
+    if (registration == _registrations.end()) { return; }
+    const auto serial = registration->second.serial;
+    _registrations.erase(registration);
+
+#if LS_HAS_IO_URING
+    if (_ring != nullptr) {
+        unwatch(fd, serial);
+        return;
+    }
+#endif
+
+    epoll_ctl(_epoll->fd(), EPOLL_CTL_DEL, fd, nullptr);
+}
+
+bool EventLoop::acceptEach(int fd, AcceptHandler handler) {
+#if LS_HAS_IO_URING
+    if (!_can_multishot) { return false; }
+    auto &multishot = _multishots[fd];
+    multishot.on_accept = std::make_shared<AcceptHandler>(std::move(handler));
+    submitMultishot(fd, multishot);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool EventLoop::receiveEach(int fd, ReceiveHandler handler) {
+#if LS_HAS_IO_URING
+    if (!_can_multishot) { return false; }
+    auto &multishot = _multishots[fd];
+    multishot.on_receive = std::make_shared<ReceiveHandler>(std::move(handler));
+    if (!multishot.is_running) { submitMultishot(fd, multishot); }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void EventLoop::stopReceiving(int fd) {
+#if LS_HAS_IO_URING
+    const auto multishot = _multishots.find(fd);
+    if (multishot == _multishots.end() || !multishot->second.is_running) { return; }
+    multishot->second.is_running = false;
+    cancel(pack(fd, multishot->second.serials.back()));
+#endif
+}
+
+int EventLoop::poll(int timeout_ms) {
+#if LS_HAS_IO_URING
+    if (_ring != nullptr) { return pollRing(timeout_ms); }
+#endif
+
+    std::array<epoll_event, max_events> events;
+    const int ready = epoll_wait(_epoll->fd(), events.data(), events.size(), timeout_ms);
+    if (ready < 0) {
+        if (errno != EINTR) { std::cerr << out::err << "Failed to wait for events: " << std::strerror(errno) << "\n"; }
+        return 0;
+    }
+
+    int handled = 0;
+    for (int i = 0; i < ready; i++) {
+        const int fd = static_cast<int>(events[i].data.u64 & 0xffffffff);
+        const auto serial = static_cast<std::uint32_t>(events[i].data.u64 >> 32);
+        if (dispatch(fd, serial, events[i].events)) { handled++; }
+    }
+
+    return handled;
+}
+
+bool EventLoop::dispatch(int fd, std::uint32_t serial, std::uint32_t events) {
+    const auto registration = _registrations.find(fd);
+    if (registration == _registrations.end() || registration->second.serial != serial) { return false; }
+
+    // Keep the handler alive even if it removes itself while running
+    const auto handler = registration->second.handler;
+    (*handler)(events);
+    return true;
+}
+
+#if LS_HAS_IO_URING
+
+// Completions of the entries that cancel polls are packed with a descriptor that's never watched, so they're dropped
+static const std::uint64_t unwatched = pack(-1, 0);
+
+void EventLoop::watch(int fd, const Registration &registration) {
+    auto &entry = _ring->prepare();
+    entry.opcode = IORING_OP_POLL_ADD;
+    entry.fd = fd;
+    entry.poll32_events = registration.events;
+    entry.len = IORING_POLL_ADD_MULTI;
+    entry.user_data = pack(fd, registration.serial);
+}
+
+void EventLoop::unwatch(int fd, std::uint32_t serial) {
+    auto &entry = _ring->prepare();
+    entry.opcode = IORING_OP_POLL_REMOVE;
+    entry.fd = -1;
+    entry.addr = pack(fd, serial);
+    entry.user_data = unwatched;
+}
+
+void EventLoop::submitMultishot(int fd, Multishot &multishot) {
+#if LS_HAS_IO_URING_MULTISHOT
+    const auto serial = _next_serial++;
+    multishot.serials.push_back(serial);
+    multishot.is_running = true;
+
+    auto &entry = _ring->prepare();
+    entry.fd = fd;
+    entry.user_data = pack(fd, serial);
+    if (multishot.on_accept != nullptr) {
+        entry.opcode = IORING_OP_ACCEPT;
+        entry.accept_flags = SOCK_NONBLOCK;
+        entry.ioprio = IORING_ACCEPT_MULTISHOT;
+    } else {
+        entry.opcode = IORING_OP_RECV;
+        entry.flags = IOSQE_BUFFER_SELECT;
+        entry.buf_group = IoUring::buffer_group;
+        entry.ioprio = IORING_RECV_MULTISHOT;
+    }
+#endif
+}
+
+void EventLoop::cancel(std::uint64_t user_data) {
+    auto &entry = _ring->prepare();
+    entry.opcode = IORING_OP_ASYNC_CANCEL;
+    entry.fd = -1;
+    entry.addr = user_data;
+    entry.user_data = unwatched;
+}
+
+int EventLoop::pollRing(int timeout_ms) {
+    _ring->submit(timeout_ms);
+
+    std::array<io_uring_cqe, max_events> completions;
+    const auto reaped = _ring->reap(completions.data(), completions.size());
+
+    int handled = 0;
+    for (std::size_t i = 0; i < reaped; i++) {
+        const auto &completion = completions[i];
+        if (complete(completion, handled)) { continue; }
+
+        const int fd = static_cast<int>(completion.user_data & 0xffffffff);
+        const auto serial = static_cast<std::uint32_t>(completion.user_data >> 32);
+
+        const auto registration = _registrations.find(fd);
+        if (registration == _registrations.end() || registration->second.serial != serial) { continue; }
+
+        // A poll that can't be kept up is handed to the handler as an error, which is what epoll would report
+        if (completion.res < 0) {
+            if (dispatch(fd, serial, EPOLLERR)) { handled++; }
+            continue;
+        }
+
+        // The kernel can stop a multishot poll on its own (like when the completion ring overflows), in which case
+        // the descriptor is still being watched, so the poll is started again
+        if (!(completion.flags & IORING_CQE_F_MORE)) { watch(fd, registration->second); }
+        if (dispatch(fd, serial, static_cast<std::uint32_t>(completion.res))) { handled++; }
+    }
+
+    return handled;
+}
+
+bool EventLoop::complete(const io_uring_cqe &completion, int &handled) {
+    const int fd = static_cast<int>(completion.user_data & 0xffffffff);
+    const auto serial = static_cast<std::uint32_t>(completion.user_data >> 32);
+    const bool is_last = !(completion.flags & IORING_CQE_F_MORE);
+
+    const auto abandoned = _abandoned_accepts.find(completion.user_data);
+    if (abandoned != _abandoned_accepts.end()) {
+        if (completion.res >= 0) { close(completion.res); }
+        if (is_last) { _abandoned_accepts.erase(abandoned); }
+        return true;
+    }
+
+    // Receives hand back the buffer they took even once nothing is waiting on them anymore
+    const bool has_buffer = completion.flags & IORING_CQE_F_BUFFER;
+    const auto buffer_id = static_cast<std::uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+    const auto found = _multishots.find(fd);
+    const auto submission = found == _multishots.end()
+        ? std::vector<std::uint32_t>::iterator{}
+        : std::find(found->second.serials.begin(), found->second.serials.end(), serial);
+    if (found == _multishots.end() || submission == found->second.serials.end()) {
+        if (has_buffer) { _ring->recycle(buffer_id); }
+        return has_buffer;
+    }
+
+    // Everything is settled before the handler runs, since it may well remove the descriptor. A submission the kernel
+    // ended on its own is started again, unless there's nothing more to come from it.
+    auto &multishot = found->second;
+    const bool is_latest = multishot.is_running && serial == multishot.serials.back();
+    if (is_last) { multishot.serials.erase(submission); }
+    const int error = completion.res < 0 ? -completion.res : 0;
+    const bool is_over = completion.res == 0 || (error != 0 && error != ENOBUFS);
+
+    if (multishot.on_accept != nullptr) {
+        const auto on_accept = multishot.on_accept;
+        if (is_last && is_latest) { submitMultishot(fd, multishot); }
+        if (error == 0) {
+            (*on_accept)(completion.res);
+            handled++;
+        } else if (error != ECANCELED) {
+            std::cerr << out::err << "Failed to accept a connection: " << std::strerror(error) << "\n";
+        }
+        return true;
+    }
+
+    const auto on_receive = multishot.on_receive;
+    if (is_last && is_latest) {
+        if (is_over) {
+            multishot.is_running = false;
+        } else {
+            submitMultishot(fd, multishot);
+        }
+    }
+
+    // Running out of buffers only means the receive has to wait for some to be handed back
+    if (completion.res > 0) {
+        (*on_receive)(_ring->buffer(buffer_id, static_cast<std::size_t>(completion.res)), 0);
+        handled++;
+    } else if (is_over && error != ECANCELED) {
+        (*on_receive)({}, error);
+        handled++;
+    }
+    if (has_buffer) { _ring->recycle(buffer_id); }
+    return true;
+}
+
+#endif
+
+} // namespace ls
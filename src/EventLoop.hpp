@@ -0,0 +1,131 @@
+// A small reactor built on top of epoll. File descriptors are registered along with a handler, which gets called with
+// the epoll event mask whenever the descriptor becomes ready. Descriptors are expected to be non-blocking and are
+// registered edge-triggered, so handlers must drain their descriptor until it would block.
+//
+// The loop doesn't own the file descriptors it watches, it only keeps track of their handlers. Handlers are free to add
+// or remove descriptors (including their own) while they are running.
+//
+// Readiness can come from io_uring instead of epoll. Each descriptor is then watched by a multishot poll, which is edge
+// triggered like the epoll registration it stands in for. Adding, changing, and removing descriptors only queue
+// entries in the ring, and they're all submitted in the same system call that waits for events, instead of costing an
+// epoll_ctl call each. Loops asked for io_uring fall back to epoll if the kernel can't provide it.
+//
+// On kernels that can (6.0 or later), io_uring also does the accepting and receiving itself. A single multishot
+// submission accepts every connection made to a listening socket, and another receives everything sent on a connected
+// socket into buffers taken from a ring the kernel picks from, so neither costs a system call of its own. Sockets that
+// are received on this way are only polled for being writable.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "FileDescriptor.hpp"
+#include "IoUring.hpp"
+
+namespace ls {
+
+class EventLoop {
+public:
+    using Handler = std::function<void(std::uint32_t events)>;
+    // Called with every connection accepted, which is already non-blocking.
+    using AcceptHandler = std::function<void(int fd)>;
+    // Called with whatever was received, which is only valid during the call. Nothing received means the peer closed
+    // its end, or that receiving failed if error (an errno) is set.
+    using ReceiveHandler = std::function<void(std::string_view received, int error)>;
+
+    enum class Backend { EPOLL, IO_URING };
+
+    explicit EventLoop(Backend backend = Backend::EPOLL);
+    ~EventLoop() = default;
+
+    // No copying or moving an event loop, handlers hold references into it
+    EventLoop(EventLoop &) = delete;
+    EventLoop operator=(EventLoop &) = delete;
+    EventLoop(EventLoop &&) = delete;
+    EventLoop &operator=(EventLoop &&) = delete;
+
+    void add(int fd, std::uint32_t events, Handler handler);
+    void modify(int fd, std::uint32_t events);
+    // Stops watching, accepting on, and receiving on the descriptor.
+    void remove(int fd);
+
+    // Accepts every connection made to a listening socket, without waiting for it to become ready first, until the
+    // socket is removed. Returns false if the loop can't, in which case the socket should be added and accepted from
+    // as usual instead.
+    bool acceptEach(int fd, AcceptHandler handler);
+    // Receives everything sent on a connected socket, until it's stopped or the socket is removed. Returns false if the
+    // loop can't, in which case the socket should be read from as usual instead.
+    bool receiveEach(int fd, ReceiveHandler handler);
+    // Stops receiving on a socket, leaving anything else sent on it in the socket until receiving is started again.
+    // Whatever the kernel already received is still handed over.
+    void stopReceiving(int fd);
+
+    // Swaps out the handler of an already watched descriptor, keeping the events it's watched for.
+    void rebind(int fd, Handler handler);
+
+    // Waits up to timeout_ms milliseconds for events, running the handler of every ready descriptor.
+    // Returns the number of handlers run.
+    int poll(int timeout_ms);
+
+    [[nodiscard]] inline std::size_t size() const { return _registrations.size(); }
+    // The backend that's actually in use, which is epoll if io_uring was asked for but isn't available.
+    [[nodiscard]] Backend backend() const;
+
+private:
+    static constexpr int max_events = 256;
+
+    // How many entries the io_uring submission ring has room for. Entries are only queued between polls, and the ring
+    // is submitted early if it fills up.
+    static constexpr unsigned ring_entries = 1024;
+
+    // The buffers the kernel receives into, which are handed back to it as soon as a handler is done with them
+    static constexpr unsigned receive_buffers = 256;
+    static constexpr unsigned receive_buffer_size = 8192;
+
+    struct Registration {
+        std::uint32_t serial;
+        std::uint32_t events;
+        std::shared_ptr<Handler> handler;
+    };
+
+    // Runs the handler of the descriptor, unless it was removed (or re-added) since the event was queued.
+    bool dispatch(int fd, std::uint32_t serial, std::uint32_t events);
+
+#if LS_HAS_IO_URING
+    // The multishot accepting or receiving on a descriptor. Each time it's started is a submission under a new serial,
+    // which stays live until its last completion comes in, so that nothing received before it was stopped gets lost.
+    struct Multishot {
+        std::vector<std::uint32_t> serials; // Submissions that can still complete, the last one being the latest
+        bool is_running;                    // Whether the latest submission hasn't been stopped
+        std::shared_ptr<AcceptHandler> on_accept;
+        std::shared_ptr<ReceiveHandler> on_receive;
+    };
+
+    void watch(int fd, const Registration &registration);
+    void unwatch(int fd, std::uint32_t serial);
+    void submitMultishot(int fd, Multishot &multishot);
+    void cancel(std::uint64_t user_data);
+    int pollRing(int timeout_ms);
+    // Handles a completion of an accept or a receive, counting it if a handler was run. Returns false if the
+    // completion belongs to a poll instead.
+    bool complete(const io_uring_cqe &completion, int &handled);
+
+    std::unique_ptr<IoUring> _ring; // Only set up when io_uring is in use
+    bool _can_multishot = false;    // Whether the ring can accept and receive on its own
+    std::unordered_map<int, Multishot> _multishots;
+    // Accepts that were cancelled and haven't completed for the last time yet, whose connections have to be closed
+    std::unordered_set<std::uint64_t> _abandoned_accepts;
+#endif
+    std::optional<FileDescriptor> _epoll; // Only set up when epoll is in use
+    std::unordered_map<int, Registration> _registrations;
+    std::uint32_t _next_serial = 0;
+};
+
+} // namespace ls
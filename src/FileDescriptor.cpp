@@ -11,7 +11,21 @@ FileDescriptor::FileDescriptor(int fd, std::string name) : _fd(fd), _name(std::m
     std::cerr << out::debug << "Opening fd: " << _name << "\n";
 }
 
+FileDescriptor::FileDescriptor(FileDescriptor &&other) noexcept : _fd(other._fd), _name(std::move(other._name)) {
+    other._fd = -1;
+}
+
+FileDescriptor &FileDescriptor::operator=(FileDescriptor &&other) noexcept {
+    if (this == &other) { return *this; }
+    if (_fd >= 0) { close(_fd); }
+    _fd = other._fd;
+    _name = std::move(other._name);
+    other._fd = -1;
+    return *this;
+}
+
 FileDescriptor::~FileDescriptor() {
+    if (_fd < 0) { return; }
     close(_fd);
     std::cerr << out::debug << "Closing fd: " << _name << "\n";
 }
@@ -16,8 +16,9 @@ public:
     // We don't want to copy file descriptors, to prevent closing twice
     FileDescriptor operator=(FileDescriptor &) = delete;
 
-    FileDescriptor(FileDescriptor &&) = default;
-    FileDescriptor &operator=(FileDescriptor &&) = default;
+    // Moving hands the descriptor over, leaving the moved-from object without anything to close
+    FileDescriptor(FileDescriptor &&other) noexcept;
+    FileDescriptor &operator=(FileDescriptor &&other) noexcept;
 
     [[nodiscard]] inline int fd() const { return _fd; };
 
@@ -0,0 +1,139 @@
+#include "HealthChecker.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include "Http.hpp"
+#include "LoadBalancer.hpp"
+#include "Log.hpp"
+
+namespace ls {
+
+// How finely check intervals and timeouts are kept to
+static constexpr std::chrono::milliseconds check_tick{10};
+
+HealthChecker::HealthChecker(Settings settings) : _settings(settings), _loop(), _timers(check_tick) {}
+
+void HealthChecker::watch(const std::vector<std::shared_ptr<Connection>> &connections) {
+    for (auto target = _targets.size(); target < connections.size(); target++) {
+        _targets.push_back({.connection = connections[target], .passed = 0, .failed = 0, .probe = nullptr});
+
+        // First checks are spread over the first interval, so servers added together aren't all checked together
+        std::uniform_int_distribution<clock::rep> first{0, std::max<clock::rep>(_settings.interval.count() - 1, 0)};
+        scheduleCheck(target, clock::duration(first(_gen)));
+    }
+}
+
+void HealthChecker::poll(int timeout_ms) {
+    _timers.advance();
+    _loop.poll(timeout_ms);
+    _timers.advance();
+}
+
+void HealthChecker::scheduleCheck(std::size_t target, clock::duration delay) {
+    _timers.schedule(delay, [this, target] { check(target); });
+}
+
+void HealthChecker::check(std::size_t target) {
+    auto &[connection, passed, failed, probe] = _targets[target];
+
+    // A request answered within the last interval already showed the server is up. Checks don't count, or a failed
+    // one would put off the next check that's due within an interval of it.
+    if (!connection->is_inactive && clock::now() - connection->last_refreshed.load() < _settings.interval) {
+        scheduleCheck(target, nextInterval());
+        return;
+    }
+
+    std::cerr << out::verb << "checking if server " << connection->metadata.id << " is up...\n";
+    const int fd = sockets::createSocket(SOCK_NONBLOCK);
+    if (fd < 0) {
+        std::cerr << out::err << "Failed to create a socket to check server " << connection->metadata.id << ": "
+                  << std::strerror(errno) << "\n";
+        scheduleCheck(target, nextInterval());
+        return;
+    }
+
+    probe = std::make_unique<Probe>(
+        Probe{.socket = {fd, "health check"},
+              .request = http::Request::isActiveRequest(connection->client.address()).construct(),
+              .timeout = _timers.schedule(_settings.timeout, [this, target] { finish(target, false); })});
+    probe->parser.expectNoBody();
+
+    auto address = connection->client.socketAddress();
+    if (connect(fd, sockets::asGeneric(&address), sizeof(address)) < 0 && errno != EINPROGRESS) {
+        finish(target, false);
+        return;
+    }
+
+    _loop.add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+              [this, target](std::uint32_t events) { handle(target, events); });
+}
+
+void HealthChecker::handle(std::size_t target, std::uint32_t events) {
+    auto &probe = _targets[target].probe;
+    if (probe == nullptr) { return; }
+
+    if (!probe->is_connected) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(probe->socket.fd(), SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            finish(target, false);
+            return;
+        }
+        if (!(events & (EPOLLOUT | EPOLLIN))) { return; }
+        probe->is_connected = true;
+    }
+
+    if (probe->sent < probe->request.size()) {
+        const auto status = sockets::transmit(probe->socket, probe->request, probe->sent);
+        if (status == sockets::IoStatus::CLOSED || status == sockets::IoStatus::FAILED) {
+            finish(target, false);
+            return;
+        }
+        if (status == sockets::IoStatus::PENDING) { return; }
+    }
+
+    const auto status = sockets::collect(probe->socket, probe->received);
+    auto parsed = probe->parser.parse(probe->received);
+    if (parsed == http::Parser::Status::INCOMPLETE && status == sockets::IoStatus::CLOSED) {
+        parsed = probe->parser.finish();
+    }
+
+    // Servers that answer with a server error are up, but not in any state to handle requests
+    if (parsed == http::Parser::Status::COMPLETE) {
+        finish(target, probe->parser.code() < 500);
+    } else if (parsed == http::Parser::Status::INVALID || status == sockets::IoStatus::CLOSED ||
+               status == sockets::IoStatus::FAILED) {
+        finish(target, false);
+    }
+}
+
+void HealthChecker::finish(std::size_t target, bool is_up) {
+    auto &[connection, passed, failed, probe] = _targets[target];
+    if (probe != nullptr) {
+        _timers.cancel(probe->timeout);
+        _loop.remove(probe->socket.fd());
+        probe.reset();
+    }
+
+    passed = is_up ? passed + 1 : 0;
+    failed = is_up ? 0 : failed + 1;
+    std::cerr << out::verb << "check of server " << connection->metadata.id << (is_up ? " passed" : " failed") << "\n";
+
+    if (is_up && passed >= _settings.rise && connection->is_inactive.exchange(false)) {
+        std::cerr << out::info << "The inactive server " << connection->metadata.id
+                  << " passed its activity checks. Marking it as active...\n";
+    } else if (!is_up && failed >= _settings.fall && !connection->is_inactive.exchange(true)) {
+        std::cerr << out::info << "The active server " << connection->metadata.id
+                  << " failed its activity checks. Marking it as inactive...\n";
+    }
+
+    scheduleCheck(target, nextInterval());
+}
+
+clock::duration HealthChecker::nextInterval() {
+    const auto jitter = _settings.interval * _settings.jitter_percent / 100;
+    std::uniform_int_distribution<clock::rep> spread{-jitter.count(), jitter.count()};
+    return _settings.interval + clock::duration(spread(_gen));
+}
+
+} // namespace ls
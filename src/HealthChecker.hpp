@@ -0,0 +1,86 @@
+// Actively checks that the balancer's servers are up, by sending them HEAD requests on a schedule. The checker runs on
+// a thread of its own, with its own event loop, so checks never hold up requests. Every check is non-blocking, and
+// is timed out through a timer wheel, which also spaces out each server's checks.
+//
+// Real requests already show that a server is up, so active servers that handled a request within the last interval
+// aren't checked. A server is marked inactive after failing fall checks in a row, and active again after passing rise
+// checks in a row.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "EventLoop.hpp"
+#include "HttpParser.hpp"
+#include "Sockets.hpp"
+#include "TimerWheel.hpp"
+
+namespace ls {
+
+struct Connection;
+
+class HealthChecker {
+public:
+    using clock = std::chrono::system_clock; // The clock that servers' last requests are timed by
+
+    struct Settings {
+        clock::duration interval;          // How long a server goes without requests before it's checked
+        int jitter_percent;                // How far each interval is randomly stretched or shrunk, to spread checks
+        int rise;                          // Passed checks in a row that mark an inactive server as active
+        int fall;                          // Failed checks in a row that mark an active server as inactive
+        std::chrono::milliseconds timeout; // How long a check can take before it's failed
+    };
+
+    explicit HealthChecker(Settings settings);
+
+    // No copying or moving a checker, its timers and handlers point back into it
+    HealthChecker(HealthChecker &) = delete;
+    HealthChecker operator=(HealthChecker &) = delete;
+    HealthChecker(HealthChecker &&) = delete;
+    HealthChecker &operator=(HealthChecker &&) = delete;
+
+    // Starts checking any of the connections that aren't being checked yet. Connections are never removed, so only the
+    // ones past the end of the last list are new.
+    void watch(const std::vector<std::shared_ptr<Connection>> &connections);
+
+    // Runs any checks that are due, then handles the sockets of checks in progress for up to timeout_ms milliseconds.
+    void poll(int timeout_ms);
+
+private:
+    struct Probe {
+        sockets::Socket socket;
+        std::string request;
+        std::size_t sent = 0;
+        std::string received;
+        http::Parser parser{http::Parser::Kind::RESPONSE};
+        bool is_connected = false;
+        TimerWheel::TimerId timeout;
+    };
+
+    struct Target {
+        std::shared_ptr<Connection> connection;
+        int passed = 0; // Checks passed in a row
+        int failed = 0; // Checks failed in a row
+        std::unique_ptr<Probe> probe;
+    };
+
+    void scheduleCheck(std::size_t target, clock::duration delay);
+    void check(std::size_t target);
+    void handle(std::size_t target, std::uint32_t events);
+    void finish(std::size_t target, bool is_up);
+    clock::duration nextInterval();
+
+private:
+    const Settings _settings;
+    EventLoop _loop;
+    TimerWheel _timers;
+    std::vector<Target> _targets;
+    std::mt19937 _gen{std::random_device{}()};
+};
+
+} // namespace ls
@@ -35,37 +35,36 @@ std::string Request::construct() {
     request.append(headerString);
 
     if (body.has_value()) {
-        const auto content_length = "Content-Length: " + std::to_string(body->length()) + "\n";
+        const auto content_length = "Content-Length: " + std::to_string(body->length()) + "\r\n";
         request.append(content_length);
-        request.append("\r\n");
-        request.append(*body);
     }
 
-    request.append("\r\n\r\n"); // Marks the request as over.
+    request.append("\r\n"); // Marks the end of the headers.
+    if (body.has_value()) { request.append(*body); }
 
     return request;
 }
 
 std::string Response::construct() const {
     std::string request;
-    const auto startLine = "HTTP/1.1 " + std::to_string(code) + " " + status_text + "\n";
+    const auto startLine = "HTTP/1.1 " + std::to_string(code) + " " + status_text + "\r\n";
     request.append(startLine);
 
     std::string headerString = "";
     for (auto [key, value] : headers) {
-        const auto header = key + ": " + value + "\n";
+        const auto header = key + ": " + value + "\r\n";
         headerString.append(header);
     }
 
     request.append(headerString);
-    if (body.has_value()) {
-        const auto content_length = "Content-Length: " + std::to_string(body->length()) + "\n";
-        request.append(content_length);
-        request.append("\n");
-        request.append(*body);
-    }
+
+    // Responses always give their length, so that clients never have to wait for the connection to close
+    const auto content_length = "Content-Length: " + std::to_string(body.has_value() ? body->length() : 0) + "\r\n";
+    request.append(content_length);
+    request.append("\r\n");
+    if (body.has_value()) { request.append(*body); }
 
     return request;
 }
 
-} // namespace ls::http
\ No newline at end of file
+} // namespace ls::http
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <map>
+#include <optional>
 #include <string>
 
 namespace ls::http {
@@ -12,7 +13,8 @@ std::string messageHtml(std::string message);
 struct Request {
     [[nodiscard]] std::string construct();
     [[nodiscard]] static inline Request isActiveRequest(std::string host) {
-        return {.method = "HEAD", .host = host, .target = "/", .headers = {}};
+        // The connection is closed right after, so servers that keep connections alive don't hold the check open
+        return {.method = "HEAD", .host = host, .target = "/", .headers = {{"Connection", "close"}}};
     }
 
 public:
@@ -25,12 +27,24 @@ public:
 
 struct Response {
     [[nodiscard]] std::string construct() const;
+    [[nodiscard]] static inline Response respond404() {
+        return {.code = 404,
+                .status_text = "Not Found",
+                .headers = {{"Content-Type", "text/html"}},
+                .body = http::messageHtml("Nothing is served here")};
+    }
     [[nodiscard]] static inline Response respond503() {
         return {.code = 503,
                 .status_text = "Service Unavailable",
                 .headers = {{"Content-Type", "text/html"}},
                 .body = http::messageHtml("Unable to connect to server")};
     }
+    [[nodiscard]] static inline Response respond504() {
+        return {.code = 504,
+                .status_text = "Gateway Timeout",
+                .headers = {{"Content-Type", "text/html"}},
+                .body = http::messageHtml("The server took too long to respond")};
+    }
 
 public:
     int code;
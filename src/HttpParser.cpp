@@ -0,0 +1,289 @@
+#include "HttpParser.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+namespace ls::http {
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.length() == b.length() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+bool containsIgnoreCase(std::string_view haystack, std::string_view needle) {
+    return std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           }) != haystack.end();
+}
+
+static std::string_view trim(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) { value.remove_prefix(1); }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) { value.remove_suffix(1); }
+    return value;
+}
+
+Parser::Parser(Kind kind) : _kind(kind) {}
+
+void Parser::reset() {
+    _state = State::START_LINE;
+    _status = Status::INCOMPLETE;
+    _offset = 0;
+    _headers_length = 0;
+    _interim_length = 0;
+    _remaining = 0;
+    _has_content_length = false;
+    _has_transfer_encoding = false;
+    _is_chunked = false;
+    _is_keep_alive = true;
+    _is_head = false;
+    _expects_no_body = false;
+    _code = 0;
+}
+
+void Parser::discard(std::size_t length) {
+    length = std::min(length, _offset);
+    _offset -= length;
+    _headers_length -= std::min(length, _headers_length);
+    _interim_length -= std::min(length, _interim_length);
+}
+
+Parser::Status Parser::parse(std::string_view buffer) {
+    std::string_view line;
+
+    while (_status == Status::INCOMPLETE) {
+        switch (_state) {
+        case State::START_LINE:
+            if (!nextLine(buffer, line)) { return _status; }
+            if (line.empty()) { continue; } // Stray line breaks between messages are allowed
+            if (!parseStartLine(line)) {
+                _status = Status::INVALID;
+                break;
+            }
+            _state = State::HEADERS;
+            break;
+        case State::HEADERS:
+            if (!nextLine(buffer, line)) { return _status; }
+            if (line.empty()) {
+                _headers_length = _offset;
+                if (!startBody()) { _status = Status::INVALID; }
+                break;
+            }
+            if (!parseHeader(line)) { _status = Status::INVALID; }
+            break;
+        case State::BODY:
+        case State::CHUNK_DATA:
+            consumeBody(buffer);
+            if (_remaining != 0) { return _status; }
+            if (_state == State::BODY) {
+                _state = State::DONE;
+                _status = Status::COMPLETE;
+            } else {
+                _state = State::CHUNK_DATA_END;
+            }
+            break;
+        case State::CHUNK_SIZE: {
+            if (!nextLine(buffer, line)) { return _status; }
+            line = trim(line.substr(0, line.find(';'))); // Chunk extensions are ignored
+            const auto result = std::from_chars(line.data(), line.data() + line.length(), _remaining, 16);
+            if (result.ec != std::errc() || line.empty() || result.ptr != line.data() + line.length()) {
+                _status = Status::INVALID;
+                break;
+            }
+            _state = _remaining == 0 ? State::TRAILERS : State::CHUNK_DATA;
+            break;
+        }
+        case State::CHUNK_DATA_END:
+            if (!nextLine(buffer, line)) { return _status; }
+            if (!line.empty()) {
+                _status = Status::INVALID;
+                break;
+            }
+            _state = State::CHUNK_SIZE;
+            break;
+        case State::TRAILERS:
+            if (!nextLine(buffer, line)) { return _status; }
+            if (line.empty()) {
+                _state = State::DONE;
+                _status = Status::COMPLETE;
+            }
+            break;
+        case State::BODY_UNTIL_CLOSE:
+            _offset = buffer.length();
+            return _status;
+        case State::DONE: return _status;
+        }
+    }
+
+    return _status;
+}
+
+Parser::Status Parser::finish() {
+    if (_status != Status::INCOMPLETE) { return _status; }
+
+    _status = _state == State::BODY_UNTIL_CLOSE ? Status::COMPLETE : Status::INVALID;
+    _state = State::DONE;
+    return _status;
+}
+
+bool Parser::nextLine(std::string_view buffer, std::string_view &line) {
+    const auto line_end = buffer.find('\n', _offset);
+    if (line_end == std::string_view::npos) {
+        // Anything this long without an end to its headers isn't going to be a message we can handle
+        if (buffer.length() > max_headers_length && _headers_length == 0) { _status = Status::INVALID; }
+        return false;
+    }
+
+    // Lines end with CRLF, though a lone LF is accepted as well
+    line = buffer.substr(_offset, line_end - _offset);
+    if (!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+    _offset = line_end + 1;
+    return true;
+}
+
+bool Parser::parseStartLine(std::string_view line) {
+    const auto first_space = line.find(' ');
+    if (first_space == std::string_view::npos) { return false; }
+
+    if (_kind == Kind::REQUEST) {
+        // method SP target SP version
+        const auto last_space = line.rfind(' ');
+        if (last_space == first_space) { return false; }
+
+        _is_head = line.substr(0, first_space) == "HEAD";
+        _is_keep_alive = line.substr(last_space + 1) != "HTTP/1.0";
+        return true;
+    }
+
+    // version SP code SP reason
+    const auto version = line.substr(0, first_space);
+    if (version.substr(0, 5) != "HTTP/") { return false; }
+    _is_keep_alive = version != "HTTP/1.0";
+
+    const auto code = line.substr(first_space + 1, 3);
+    const auto result = std::from_chars(code.data(), code.data() + code.length(), _code);
+    return result.ec == std::errc() && code.length() == 3;
+}
+
+bool Parser::parseHeader(std::string_view line) {
+    // Anything the parser can't be sure of is rejected rather than guessed at, since a server reading the same message
+    // differently would see a request smuggled inside it, and answer it on a connection another client gets next
+    const auto colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0) { return false; }
+
+    const auto name = line.substr(0, colon);
+    const auto value = trim(line.substr(colon + 1));
+    if (name.find_first_of(" \t") != std::string_view::npos) { return false; }
+
+    if (equalsIgnoreCase(name, "Content-Length")) {
+        std::uint64_t length = 0;
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.length(), length);
+        if (error != std::errc() || value.empty() || end != value.data() + value.length()) { return false; }
+        if (_has_content_length && length != _remaining) { return false; }
+        _has_content_length = true;
+        _remaining = length;
+    } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+        // Only the last coding frames the message, and the body's only framed when that's chunked
+        const auto last_comma = value.rfind(',');
+        const auto last = trim(last_comma == std::string_view::npos ? value : value.substr(last_comma + 1));
+        _has_transfer_encoding = true;
+        _is_chunked = equalsIgnoreCase(last, "chunked");
+    } else if (equalsIgnoreCase(name, "Connection")) {
+        if (containsIgnoreCase(value, "close")) {
+            _is_keep_alive = false;
+        } else if (containsIgnoreCase(value, "keep-alive")) {
+            _is_keep_alive = true;
+        }
+    }
+    return true;
+}
+
+bool Parser::startBody() {
+    // A length and a transfer coding together can be read two ways, and a coding that isn't chunked has no end
+    if (_has_transfer_encoding && (_has_content_length || !_is_chunked)) { return false; }
+
+    // Interim responses (like 100 Continue or 103 Early Hints) come ahead of the final response, which is parsed next.
+    // Switching protocols is final, since nothing after it is HTTP.
+    if (_kind == Kind::RESPONSE && _code >= 100 && _code < 200 && _code != 101) {
+        _interim_length = _offset;
+        _headers_length = 0;
+        _has_content_length = false;
+        _has_transfer_encoding = false;
+        _is_chunked = false;
+        _is_keep_alive = true;
+        _code = 0;
+        _state = State::START_LINE;
+        return true;
+    }
+
+    // Responses to HEAD requests, along with 101, 204 and 304 responses never have a body
+    const bool has_no_body =
+        _kind == Kind::RESPONSE && (_expects_no_body || _code == 101 || _code == 204 || _code == 304);
+
+    if (has_no_body) {
+        _state = State::DONE;
+        _status = Status::COMPLETE;
+    } else if (_is_chunked) {
+        _state = State::CHUNK_SIZE;
+    } else if (_has_content_length) {
+        _state = State::BODY;
+    } else if (_kind == Kind::REQUEST) {
+        // Requests without a length have no body
+        _state = State::DONE;
+        _status = Status::COMPLETE;
+    } else {
+        // Responses without one run until the connection closes, so the connection can't be reused
+        _state = State::BODY_UNTIL_CLOSE;
+        _is_keep_alive = false;
+    }
+    return true;
+}
+
+std::optional<std::string> findHeader(std::string_view message, std::string_view name) {
+    std::optional<std::string> found;
+
+    // The start line is skipped, it can't have a colon before its first line break in a way that matters here
+    auto line_start = message.find('\n');
+    while (line_start != std::string_view::npos) {
+        line_start++;
+        const auto line_end = message.find('\n', line_start);
+        auto line = message.substr(line_start, line_end == std::string_view::npos ? line_end : line_end - line_start);
+        if (!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+        if (line.empty()) { break; }
+
+        const auto colon = line.find(':');
+        if (colon != std::string_view::npos && equalsIgnoreCase(trim(line.substr(0, colon)), name)) {
+            const auto value = trim(line.substr(colon + 1));
+            found = found.has_value() ? *found + ", " + std::string(value) : std::string(value);
+        }
+        line_start = line_end;
+    }
+
+    return found;
+}
+
+int statusCode(std::string_view response) {
+    // The status line is "HTTP/x.y ddd reason"
+    constexpr std::size_t code_start = 9;
+    if (response.size() < code_start + 3 || response.substr(0, 5) != "HTTP/") { return 0; }
+
+    int code = 0;
+    for (std::size_t i = code_start; i < code_start + 3; i++) {
+        if (response[i] < '0' || response[i] > '9') { return 0; }
+        code = code * 10 + (response[i] - '0');
+    }
+    return code;
+}
+
+bool isIdempotent(std::string_view request) {
+    return request.substr(0, 4) == "GET " || request.substr(0, 5) == "HEAD ";
+}
+
+void Parser::consumeBody(std::string_view buffer) {
+    const auto available = buffer.length() - _offset;
+    const auto taken = std::min<std::uint64_t>(available, _remaining);
+    _offset += taken;
+    _remaining -= taken;
+}
+
+} // namespace ls::http
@@ -0,0 +1,108 @@
+// A resumable HTTP/1.1 message framer. It doesn't build up a request or response object, it only works out where a
+// message ends (along with the few details needed for that, like the body length and whether the connection is kept
+// alive), so that it can tell a message is complete as soon as its last byte arrives.
+//
+// The parser doesn't hold on to any data itself. Each call to parse takes the whole buffer the message is being read
+// into, and picks up from where the last call left off, so every byte is only looked at once.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace ls::http {
+
+class Parser {
+public:
+    enum class Kind { REQUEST, RESPONSE };
+    enum class Status { INCOMPLETE, COMPLETE, INVALID };
+
+    explicit Parser(Kind kind);
+
+    // Continues parsing the message at the start of buffer. The buffer must start with the same bytes as the last call.
+    Status parse(std::string_view buffer);
+
+    // Tells the parser the connection was closed, which completes responses that run until the connection closes.
+    Status finish();
+
+    // Readies the parser for the next message on the same connection.
+    void reset();
+
+    // Tells the parser the first length bytes of the buffer, which it must have already parsed, were removed from it.
+    // Messages can then be passed on as they're parsed, without the buffer holding the whole message.
+    void discard(std::size_t length);
+
+    // Responses to HEAD requests have no body, which can't be told from the response itself.
+    inline void expectNoBody() { _expects_no_body = true; }
+
+    [[nodiscard]] inline Status status() const { return _status; }
+    // The length of the message, once it's complete.
+    [[nodiscard]] inline std::size_t length() const { return _offset; }
+    [[nodiscard]] inline std::size_t headersLength() const { return _headers_length; }
+    [[nodiscard]] inline bool isKeepAlive() const { return _is_keep_alive; }
+    [[nodiscard]] inline bool isChunked() const { return _is_chunked; }
+    [[nodiscard]] inline bool isHead() const { return _is_head; }
+    [[nodiscard]] inline int code() const { return _code; }
+    // The bytes taken up by interim (1xx) responses ahead of the final response. They answer no request themselves, so
+    // they're left out of what's passed on.
+    [[nodiscard]] inline std::size_t interimLength() const { return _interim_length; }
+    // The bytes of a body with a Content-Length that haven't been parsed yet, or 0 for any other kind of body.
+    [[nodiscard]] inline std::uint64_t remainingBody() const { return _state == State::BODY ? _remaining : 0; }
+
+private:
+    enum class State {
+        START_LINE,
+        HEADERS,
+        BODY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILERS,
+        BODY_UNTIL_CLOSE,
+        DONE
+    };
+
+    static constexpr std::size_t max_headers_length = 64 * 1024;
+
+    bool nextLine(std::string_view buffer, std::string_view &line);
+    bool parseStartLine(std::string_view line);
+    // Both return false if the message can't be framed without guessing.
+    bool parseHeader(std::string_view line);
+    bool startBody();
+    void consumeBody(std::string_view buffer);
+
+private:
+    const Kind _kind;
+    State _state = State::START_LINE;
+    Status _status = Status::INCOMPLETE;
+    std::size_t _offset = 0;
+    std::size_t _headers_length = 0;
+    std::size_t _interim_length = 0;
+    std::uint64_t _remaining = 0;
+    bool _has_content_length = false;
+    bool _has_transfer_encoding = false;
+    bool _is_chunked = false;
+    bool _is_keep_alive = true;
+    bool _is_head = false;
+    bool _expects_no_body = false;
+    int _code = 0;
+};
+
+// Looks up a header in a message's headers, stopping at the first blank line. Headers that appear more than once have
+// their values joined with commas.
+[[nodiscard]] std::optional<std::string> findHeader(std::string_view message, std::string_view name);
+
+// Reads the status code from a response's status line, or returns 0 if it doesn't start with one.
+[[nodiscard]] int statusCode(std::string_view response);
+
+// Whether a request is a GET or HEAD, which only read from the server and so are safe to send to it more than once.
+[[nodiscard]] bool isIdempotent(std::string_view request);
+
+// Compares two strings, ignoring the case of any letters. Header names (and many header values) aren't case sensitive.
+[[nodiscard]] bool equalsIgnoreCase(std::string_view a, std::string_view b);
+[[nodiscard]] bool containsIgnoreCase(std::string_view haystack, std::string_view needle);
+
+} // namespace ls::http
@@ -0,0 +1,265 @@
+#include "IoUring.hpp"
+
+#if LS_HAS_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Log.hpp"
+
+namespace ls {
+
+// Everything the event loop relies on besides multishot polls: completions that are never dropped, and waiting with a
+// timeout (5.11). Kernels that can't map both rings at once are still handled.
+constexpr unsigned required_features = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+// Enough room to hear about every opcode the kernel has
+constexpr unsigned probed_opcodes = 256;
+
+// The completion ring is made bigger than the submission ring, since every watched descriptor can complete many times
+// for each submission
+constexpr unsigned completions_per_entry = 4;
+
+// Stands in for the descriptors of the entries used to try out multishot polls, which the event loop never watches
+constexpr std::uint64_t probe_data = ~0ULL;
+
+template <typename T>
+static inline T *at(void *base, std::size_t offset) {
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+static void *mapRing(int fd, std::size_t size, off_t offset) {
+    void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return mapped == MAP_FAILED ? nullptr : mapped;
+}
+
+std::unique_ptr<IoUring> IoUring::create(unsigned entries) {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * completions_per_entry;
+
+    const int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+        std::cerr << out::warn << "Failed to set up io_uring: " << std::strerror(errno) << "\n";
+        return nullptr;
+    }
+
+    std::unique_ptr<IoUring> ring{new IoUring()};
+    ring->_fd = fd;
+    if ((params.features & required_features) != required_features) {
+        std::cerr << out::warn << "io_uring can't "
+                  << (params.features & IORING_FEAT_NODROP ? "wait with a timeout" : "keep every completion")
+                  << " on this kernel (5.11 or later is needed)\n";
+        return nullptr;
+    }
+
+    const auto sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const auto cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool is_single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    ring->_rings_size = is_single_mapping ? std::max(sq_size, cq_size) : sq_size;
+    ring->_rings = mapRing(fd, ring->_rings_size, IORING_OFF_SQ_RING);
+    void *cq_ring = ring->_rings;
+    if (!is_single_mapping && ring->_rings != nullptr) {
+        ring->_cq_ring_size = cq_size;
+        ring->_cq_ring = mapRing(fd, cq_size, IORING_OFF_CQ_RING);
+        cq_ring = ring->_cq_ring;
+    }
+    if (ring->_rings == nullptr || cq_ring == nullptr) {
+        std::cerr << out::warn << "Failed to map io_uring's rings: " << std::strerror(errno) << "\n";
+        return nullptr;
+    }
+
+    ring->_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    auto *sqes = mapRing(fd, ring->_sqes_size, IORING_OFF_SQES);
+    if (sqes == nullptr) {
+        std::cerr << out::warn << "Failed to map io_uring's submission entries: " << std::strerror(errno) << "\n";
+        return nullptr;
+    }
+    ring->_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    ring->_sq_head = at<unsigned>(ring->_rings, params.sq_off.head);
+    ring->_sq_tail = at<unsigned>(ring->_rings, params.sq_off.tail);
+    ring->_sq_mask = *at<unsigned>(ring->_rings, params.sq_off.ring_mask);
+    ring->_sq_entries = *at<unsigned>(ring->_rings, params.sq_off.ring_entries);
+    ring->_sq_array = at<unsigned>(ring->_rings, params.sq_off.array);
+    ring->_sq_pending_tail = *ring->_sq_tail;
+
+    ring->_cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+    ring->_cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+    ring->_cq_mask = *at<unsigned>(cq_ring, params.cq_off.ring_mask);
+    ring->_cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+    // Kernels from before the probe (5.6) can't do multishot polls either, so they're turned away below
+    const auto probe_size = sizeof(io_uring_probe) + probed_opcodes * sizeof(io_uring_probe_op);
+    ring->_probe = std::make_unique<unsigned char[]>(probe_size);
+    std::memset(ring->_probe.get(), 0, probe_size);
+    syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, ring->_probe.get(), probed_opcodes);
+
+    if (!ring->canPollMultishot()) {
+        std::cerr << out::warn << "io_uring can't poll multishot on this kernel (5.13 or later is needed)\n";
+        return nullptr;
+    }
+    return ring;
+}
+
+bool IoUring::isSupported(unsigned opcode) const {
+    const auto *probe = reinterpret_cast<const io_uring_probe *>(_probe.get());
+    return opcode <= probe->last_op && opcode < probe->ops_len && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+bool IoUring::canPollMultishot() {
+    // Watches a pipe that's always writable. Older kernels turn the multishot flag down outright, while newer ones
+    // report the pipe as ready and keep the poll going.
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) { return false; }
+
+    auto &poll = prepare();
+    poll.opcode = IORING_OP_POLL_ADD;
+    poll.fd = pipe_fds[1];
+    poll.poll32_events = POLLOUT;
+    poll.len = IORING_POLL_ADD_MULTI;
+    poll.user_data = probe_data;
+    submit(1000);
+
+    io_uring_cqe completion{};
+    const bool is_multishot = reap(&completion, 1) == 1 && completion.res > 0 && (completion.flags & IORING_CQE_F_MORE);
+
+    // The poll is taken down again, and everything it completed with is cleared out of the ring
+    if (is_multishot) {
+        auto &remove = prepare();
+        remove.opcode = IORING_OP_POLL_REMOVE;
+        remove.fd = -1;
+        remove.addr = probe_data;
+        remove.user_data = probe_data;
+        int remaining = 2; // The removal's completion, and the poll's last
+        for (int waits = 0; waits < 2 && remaining > 0; waits++) {
+            submit(1000);
+            while (remaining > 0 && reap(&completion, 1) == 1) {
+                if (!(completion.flags & IORING_CQE_F_MORE)) { remaining--; }
+            }
+        }
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return is_multishot;
+}
+
+IoUring::~IoUring() {
+    if (_fd >= 0) { close(_fd); }
+    if (_sqes != nullptr) { munmap(_sqes, _sqes_size); }
+    if (_cq_ring != nullptr) { munmap(_cq_ring, _cq_ring_size); }
+    if (_rings != nullptr) { munmap(_rings, _rings_size); }
+#if LS_HAS_IO_URING_MULTISHOT
+    if (_buffer_ring != nullptr) { munmap(_buffer_ring, _buffer_ring_size); }
+#endif
+}
+
+io_uring_sqe &IoUring::prepare() {
+    if (_sq_pending_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+        submit(0);
+        if (_sq_pending_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+            throw std::runtime_error("io_uring's submission ring is full");
+        }
+    }
+
+    const auto index = _sq_pending_tail & _sq_mask;
+    auto &entry = _sqes[index];
+    std::memset(&entry, 0, sizeof(entry));
+    _sq_array[index] = index;
+    _sq_pending_tail++;
+    return entry;
+}
+
+void IoUring::submit(int timeout_ms) {
+    // Entries the kernel didn't take last time are still in the ring, so they're submitted again along with new ones
+    __atomic_store_n(_sq_tail, _sq_pending_tail, __ATOMIC_RELEASE);
+    const unsigned to_submit = _sq_pending_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    const bool is_completed = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head;
+    const bool is_waiting = timeout_ms != 0 && !is_completed;
+    if (to_submit == 0 && !is_waiting) { return; }
+
+    __kernel_timespec timeout{.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000LL};
+    io_uring_getevents_arg arg{};
+    if (timeout_ms > 0) { arg.ts = reinterpret_cast<std::uint64_t>(&timeout); }
+
+    const unsigned flags = is_waiting ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+    const auto result = is_waiting ? syscall(__NR_io_uring_enter, _fd, to_submit, 1, flags, &arg, sizeof(arg))
+                                   : syscall(__NR_io_uring_enter, _fd, to_submit, 0, flags, nullptr, 0);
+    if (result < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+        std::cerr << out::err << "Failed to submit to io_uring: " << std::strerror(errno) << "\n";
+    }
+}
+
+std::size_t IoUring::reap(io_uring_cqe *completions, std::size_t max) {
+    auto head = *_cq_head;
+    const auto tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+
+    std::size_t reaped = 0;
+    for (; head != tail && reaped < max; head++, reaped++) { completions[reaped] = _cqes[head & _cq_mask]; }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+#if LS_HAS_IO_URING_MULTISHOT
+
+bool IoUring::provideBuffers(unsigned count, unsigned size) {
+    // Buffer rings arrived with multishot accepts, and multishot receives with zero-copy sends
+    if (!isSupported(IORING_OP_SOCKET) || !isSupported(IORING_OP_SEND_ZC)) { return false; }
+
+    // The ring has to start on a page of its own, so it's mapped in rather than allocated
+    _buffer_ring_size = count * sizeof(io_uring_buf);
+    auto *buffer_ring = mmap(nullptr, _buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer_ring == MAP_FAILED) { return false; }
+    _buffer_ring = static_cast<io_uring_buf_ring *>(buffer_ring);
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<std::uint64_t>(_buffer_ring);
+    registration.ring_entries = count;
+    registration.bgid = buffer_group;
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0) {
+        std::cerr << out::warn << "Failed to provide buffers to io_uring: " << std::strerror(errno) << "\n";
+        munmap(_buffer_ring, _buffer_ring_size);
+        _buffer_ring = nullptr;
+        return false;
+    }
+
+    _buffers = std::make_unique<char[]>(static_cast<std::size_t>(count) * size);
+    _buffer_size = size;
+    _buffer_mask = count - 1;
+    for (unsigned id = 0; id < count; id++) { recycle(static_cast<std::uint16_t>(id)); }
+    return true;
+}
+
+std::string_view IoUring::buffer(std::uint16_t id, std::size_t length) const {
+    return {_buffers.get() + static_cast<std::size_t>(id) * _buffer_size, length};
+}
+
+void IoUring::recycle(std::uint16_t id) {
+    // The entries start right at the beginning of the ring, overlapping its tail. C++ doesn't lay out the header's
+    // flexible array that way (it's preceded by an empty struct), so they're indexed by hand.
+    auto &entry = reinterpret_cast<io_uring_buf *>(_buffer_ring)[_buffer_tail & _buffer_mask];
+    entry.addr = reinterpret_cast<std::uint64_t>(_buffers.get() + static_cast<std::size_t>(id) * _buffer_size);
+    entry.len = _buffer_size;
+    entry.bid = id;
+    __atomic_store_n(&_buffer_ring->tail, ++_buffer_tail, __ATOMIC_RELEASE);
+}
+
+#else
+
+bool IoUring::provideBuffers(unsigned, unsigned) { return false; }
+std::string_view IoUring::buffer(std::uint16_t, std::size_t) const { return {}; }
+void IoUring::recycle(std::uint16_t) {}
+
+#endif
+
+} // namespace ls
+
+#endif
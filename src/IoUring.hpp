@@ -0,0 +1,119 @@
+// A thin wrapper around an io_uring instance, set up through the raw system calls so that liburing isn't needed. It
+// only does what the event loop needs of it: handing out submission entries, submitting them along with waiting for
+// completions in a single system call, reading the completions back out, and keeping a ring of buffers that the kernel
+// receives into.
+//
+// A ring is only ever used from the thread that owns it.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define LS_HAS_IO_URING 1
+#else
+#define LS_HAS_IO_URING 0
+#endif
+
+// Multishot accepts and receives, and the buffer rings receives pick from, need newer headers than the ring itself
+#if LS_HAS_IO_URING && defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_RECV_MULTISHOT)
+#define LS_HAS_IO_URING_MULTISHOT 1
+#else
+#define LS_HAS_IO_URING_MULTISHOT 0
+#endif
+
+namespace ls {
+
+#if LS_HAS_IO_URING
+
+class IoUring {
+public:
+    // The group that receives pick their buffers from, once buffers are provided
+    static constexpr std::uint16_t buffer_group = 0;
+
+    // Sets up a ring with room for the given number of submissions. Returns nothing if io_uring can't be used, like on
+    // kernels too old for multishot polls, or where it's been turned off, logging why.
+    static std::unique_ptr<IoUring> create(unsigned entries);
+    ~IoUring();
+
+    // No copying or moving a ring, its memory is mapped in for it
+    IoUring(IoUring &) = delete;
+    IoUring operator=(IoUring &) = delete;
+    IoUring(IoUring &&) = delete;
+    IoUring &operator=(IoUring &&) = delete;
+
+    // Hands out a cleared submission entry, submitting everything queued so far first if the ring is full. The entry
+    // is submitted on the next call to submit.
+    io_uring_sqe &prepare();
+
+    // Submits every queued entry, and waits up to timeout_ms for a completion if there isn't one already. A negative
+    // timeout waits as long as it takes, and 0 doesn't wait at all.
+    void submit(int timeout_ms);
+
+    // Copies out up to max completions, and returns how many there were. The completions are freed up straight away.
+    std::size_t reap(io_uring_cqe *completions, std::size_t max);
+
+    // Sets up count buffers (a power of two) of size bytes each, for receives to pick from. Returns false if the kernel
+    // can't receive into buffers it picks itself (before 6.0), or can't accept connections one submission after
+    // another (before 5.19), since the event loop only uses either along with the other.
+    bool provideBuffers(unsigned count, unsigned size);
+
+    // The bytes a receive left in one of the provided buffers.
+    [[nodiscard]] std::string_view buffer(std::uint16_t id, std::size_t length) const;
+
+    // Hands a provided buffer back to the kernel, once whatever was received into it has been used.
+    void recycle(std::uint16_t id);
+
+private:
+    IoUring() = default;
+
+    // Whether the kernel supports an opcode, according to its probe.
+    bool isSupported(unsigned opcode) const;
+    // Whether polls can be multishot (5.13), which has no feature flag or opcode of its own, so it's tried out.
+    bool canPollMultishot();
+
+private:
+    int _fd = -1;
+    unsigned _sq_pending_tail = 0; // Where the submission ring's tail will be, once the prepared entries are submitted
+
+    // Both rings are mapped in together where the kernel allows it, with the submission entries mapped in separately
+    void *_rings = nullptr;
+    std::size_t _rings_size = 0;
+    void *_cq_ring = nullptr; // Only mapped in on its own for kernels that can't map both rings together
+    std::size_t _cq_ring_size = 0;
+    io_uring_sqe *_sqes = nullptr;
+    std::size_t _sqes_size = 0;
+
+    // Pointers into the submission ring
+    unsigned *_sq_head = nullptr;
+    unsigned *_sq_tail = nullptr;
+    unsigned _sq_mask = 0;
+    unsigned _sq_entries = 0;
+    unsigned *_sq_array = nullptr;
+
+    // Pointers into the completion ring
+    unsigned *_cq_head = nullptr;
+    unsigned *_cq_tail = nullptr;
+    unsigned _cq_mask = 0;
+    io_uring_cqe *_cqes = nullptr;
+
+    std::unique_ptr<unsigned char[]> _probe; // The opcodes the kernel supports
+
+#if LS_HAS_IO_URING_MULTISHOT
+    // The provided buffers, and the ring they're handed to the kernel through
+    io_uring_buf_ring *_buffer_ring = nullptr;
+    std::size_t _buffer_ring_size = 0;
+    std::unique_ptr<char[]> _buffers;
+    unsigned _buffer_size = 0;
+    unsigned _buffer_mask = 0;
+    std::uint16_t _buffer_tail = 0;
+#endif
+};
+
+#endif
+
+} // namespace ls
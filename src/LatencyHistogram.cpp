@@ -0,0 +1,62 @@
+#include "LatencyHistogram.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace ls {
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency) {
+    const auto value = static_cast<std::uint64_t>(
+        std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 0));
+    addOwned(_buckets[bucketOf(value)], 1);
+    addOwned(_count, 1);
+    addOwned(_sum_us, value);
+}
+
+std::uint64_t LatencyHistogram::countAtMost(std::uint64_t bound_us) const {
+    std::uint64_t count = 0;
+    for (std::size_t bucket = 0; bucket < bucket_count && upperBoundOf(bucket) <= bound_us; bucket++) {
+        count += _buckets[bucket].load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+std::uint64_t LatencyHistogram::valueAtPercentile(double percentile) const {
+    const auto total = count();
+    if (total == 0) { return 0; }
+
+    // The rank of the value that's wanted, counting from 1, so the 100th percentile is the largest value
+    const auto rank = std::clamp<std::uint64_t>(
+        static_cast<std::uint64_t>(std::ceil(percentile / 100 * static_cast<double>(total))), 1, total);
+    std::uint64_t count = 0;
+    for (std::size_t bucket = 0; bucket < bucket_count; bucket++) {
+        count += _buckets[bucket].load(std::memory_order_relaxed);
+        if (count >= rank) { return upperBoundOf(bucket); }
+    }
+
+    // Buckets are read one at a time while they're being written to, so they may not quite add up to the count
+    return upperBoundOf(bucket_count - 1);
+}
+
+std::size_t LatencyHistogram::bucketOf(std::uint64_t value_us) {
+    constexpr std::uint64_t sub_buckets = 1 << sub_bucket_bits;
+    constexpr std::uint64_t max_value = (std::uint64_t{1} << max_value_bits) - 1;
+    const auto value = std::min(value_us, max_value);
+    if (value < sub_buckets) { return value; }
+
+    // The value's top bits pick the bucket within its power of two
+    const auto exponent = static_cast<std::size_t>(63 - __builtin_clzll(value));
+    const auto shift = exponent - sub_bucket_bits;
+    const auto mantissa = value >> shift;
+    return (shift + 1) * sub_buckets + (mantissa - sub_buckets);
+}
+
+std::uint64_t LatencyHistogram::upperBoundOf(std::size_t bucket) {
+    constexpr std::uint64_t sub_buckets = 1 << sub_bucket_bits;
+    if (bucket < sub_buckets) { return bucket; }
+
+    const auto shift = bucket / sub_buckets - 1;
+    const auto mantissa = bucket % sub_buckets + sub_buckets;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+} // namespace ls
@@ -0,0 +1,62 @@
+// A histogram of latencies in the style of HdrHistogram, with buckets that grow with the values they hold, so that
+// every value is kept to within about 3% whether it's a few microseconds or a few minutes. Values below 32 µs each get
+// a bucket of their own, and every power of two above that is split into 32 buckets of equal width.
+//
+// A histogram only ever has one writer, the worker it belongs to, so recording is a couple of plain loads and stores
+// with no locked instructions. Any other thread can read it at the same time, seeing each bucket as of some recent
+// point, which is all a scrape needs.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace ls {
+
+// Adds to a counter that only one thread ever writes. Other threads can read it at any time, but there's no need for
+// an atomic read-modify-write.
+inline void addOwned(std::atomic_uint64_t &counter, std::uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+class LatencyHistogram {
+public:
+    static constexpr std::size_t sub_bucket_bits = 5;
+    static constexpr std::size_t max_value_bits = 32; // Values are capped at 2^32 µs, a little over an hour
+    static constexpr std::size_t bucket_count = (max_value_bits - sub_bucket_bits + 1) << sub_bucket_bits;
+
+    LatencyHistogram() = default;
+
+    // No copying or moving a histogram, it's read by other threads
+    LatencyHistogram(LatencyHistogram &) = delete;
+    LatencyHistogram operator=(LatencyHistogram &) = delete;
+    LatencyHistogram(LatencyHistogram &&) = delete;
+    LatencyHistogram &operator=(LatencyHistogram &&) = delete;
+
+    // Adds a value. Only ever called by the histogram's one writer.
+    void record(std::chrono::nanoseconds latency);
+
+    // Adds up how many values are at or below the given bound, in microseconds.
+    [[nodiscard]] std::uint64_t countAtMost(std::uint64_t bound_us) const;
+
+    // The largest value (in microseconds) of the bucket that the given percentile of values falls into, or 0 if there
+    // aren't any values yet.
+    [[nodiscard]] std::uint64_t valueAtPercentile(double percentile) const;
+
+    [[nodiscard]] inline std::uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+    [[nodiscard]] inline std::uint64_t sumMicroseconds() const { return _sum_us.load(std::memory_order_relaxed); }
+
+    // Which bucket a value (in microseconds) falls into, and the largest value that falls into a bucket.
+    [[nodiscard]] static std::size_t bucketOf(std::uint64_t value_us);
+    [[nodiscard]] static std::uint64_t upperBoundOf(std::size_t bucket);
+
+private:
+    std::array<std::atomic_uint64_t, bucket_count> _buckets{};
+    std::atomic_uint64_t _count = 0;
+    std::atomic_uint64_t _sum_us = 0;
+};
+
+} // namespace ls
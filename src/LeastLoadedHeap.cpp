@@ -0,0 +1,71 @@
+#include "LeastLoadedHeap.hpp"
+
+namespace ls {
+
+void LeastLoadedHeap::push(Load load) {
+    const auto server = _loads.size();
+    _loads.push_back(load);
+    _positions.push_back(_heap.size());
+    _heap.push_back(server);
+    siftUp(_heap.size() - 1);
+}
+
+void LeastLoadedHeap::update(std::size_t server, Load load) {
+    _loads[server] = load;
+    siftUp(_positions[server]);
+    siftDown(_positions[server]);
+}
+
+bool LeastLoadedHeap::isLighter(std::size_t a, std::size_t b) const {
+    const auto &a_load = _loads[a];
+    const auto &b_load = _loads[b];
+    if (a_load.is_inactive != b_load.is_inactive) { return b_load.is_inactive; }
+
+    const bool a_has_weight = a_load.weight > 0;
+    const bool b_has_weight = b_load.weight > 0;
+    if (a_has_weight != b_has_weight) { return a_has_weight; }
+
+    // Compares ongoing_a / weight_a against ongoing_b / weight_b without dividing. Servers without any weight are
+    // compared by their transactions alone.
+    const std::uint64_t a_weight = a_has_weight ? a_load.weight : 1;
+    const std::uint64_t b_weight = b_has_weight ? b_load.weight : 1;
+    const auto a_cost = a_load.ongoing * b_weight;
+    const auto b_cost = b_load.ongoing * a_weight;
+    if (a_cost != b_cost) { return a_cost < b_cost; }
+
+    // Ties go to the heavier server, which has more room for the next transaction, then to the one added first
+    return a_weight != b_weight ? a_weight > b_weight : a < b;
+}
+
+void LeastLoadedHeap::place(std::size_t position, std::size_t server) {
+    _heap[position] = server;
+    _positions[server] = position;
+}
+
+void LeastLoadedHeap::siftUp(std::size_t position) {
+    const auto server = _heap[position];
+    while (position > 0) {
+        const auto parent = (position - 1) / 2;
+        if (!isLighter(server, _heap[parent])) { break; }
+        place(position, _heap[parent]);
+        position = parent;
+    }
+    place(position, server);
+}
+
+void LeastLoadedHeap::siftDown(std::size_t position) {
+    const auto server = _heap[position];
+    while (true) {
+        const auto left = 2 * position + 1;
+        if (left >= _heap.size()) { break; }
+
+        const auto right = left + 1;
+        const auto lighter = right < _heap.size() && isLighter(_heap[right], _heap[left]) ? right : left;
+        if (!isLighter(_heap[lighter], server)) { break; }
+        place(position, _heap[lighter]);
+        position = lighter;
+    }
+    place(position, server);
+}
+
+} // namespace ls
@@ -0,0 +1,54 @@
+// A min-heap of servers ordered by their load, the number of transactions they have in progress divided by their
+// weight. The heap remembers where each server sits in it, so a server's load can be changed in place as transactions
+// start and finish, in logarithmic time, while the least loaded server is always found at the top.
+//
+// A heap isn't thread-safe, so every worker keeps one of its own rather than sharing one behind a lock.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ls {
+
+class LeastLoadedHeap {
+public:
+    struct Load {
+        std::uint32_t ongoing;
+        int weight;       // Servers without any weight are only picked if every other server is busier than them
+        bool is_inactive; // Inactive servers sink below every active one
+
+    public:
+        [[nodiscard]] inline bool operator==(const Load &other) const {
+            return ongoing == other.ongoing && weight == other.weight && is_inactive == other.is_inactive;
+        }
+        [[nodiscard]] inline bool operator!=(const Load &other) const { return !(*this == other); }
+    };
+
+    // Adds a server, which is known by the number of servers added before it.
+    void push(Load load);
+
+    // Changes a server's load, moving it up or down the heap to match.
+    void update(std::size_t server, Load load);
+
+    // Returns the least loaded server. The heap can't be empty.
+    [[nodiscard]] inline std::size_t top() const { return _heap.front(); }
+    [[nodiscard]] inline bool isEmpty() const { return _heap.empty(); }
+    [[nodiscard]] inline std::size_t size() const { return _heap.size(); }
+    // The load the server was last given.
+    [[nodiscard]] inline const Load &load(std::size_t server) const { return _loads[server]; }
+
+private:
+    [[nodiscard]] bool isLighter(std::size_t a, std::size_t b) const;
+    void place(std::size_t position, std::size_t server);
+    void siftUp(std::size_t position);
+    void siftDown(std::size_t position);
+
+private:
+    std::vector<std::size_t> _heap;      // Servers, with the least loaded first
+    std::vector<std::size_t> _positions; // Where each server is in the heap
+    std::vector<Load> _loads;
+};
+
+} // namespace ls
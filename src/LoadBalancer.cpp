@@ -6,32 +6,134 @@
 #include <ios>
 #include <iostream>
 #include <iterator>
-#include <mutex>
-#include <shared_mutex>
+#include <pthread.h>
+#include <sched.h>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 #include "Http.hpp"
+#include "HttpParser.hpp"
 #include "Log.hpp"
 #include "Server.hpp"
 #include "TcpClient.hpp"
+#include "Worker.hpp"
 
 namespace ls {
 
+Connection::Connection(TcpClient client, Metadata metadata) :
+    client(std::move(client)), metadata(metadata), last_refreshed(clock::time_point{}) {}
+
+// How much of the previous latency is left after elapsed nanoseconds
+static double latencyDecay(std::chrono::steady_clock::rep elapsed) {
+    const auto decay_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(latency_decay_time);
+    return std::exp(-static_cast<double>(std::max<std::chrono::steady_clock::rep>(elapsed, 0)) / decay_time.count());
+}
+
+void Connection::recordLatency(std::chrono::nanoseconds latency) {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    const auto elapsed = now - latency_updated.exchange(now, std::memory_order_relaxed);
+    const auto sample = static_cast<double>(latency.count());
+
+    // Workers record latencies at the same time, so the average is swapped in only if no one else changed it first
+    auto previous = latency_ewma.load(std::memory_order_relaxed);
+    while (true) {
+        const auto decay = latencyDecay(elapsed);
+        const auto next = sample > previous ? sample : previous * decay + sample * (1 - decay);
+        if (latency_ewma.compare_exchange_weak(previous, next, std::memory_order_relaxed)) { return; }
+    }
+}
+
+double Connection::loadCost() const {
+    // A busy server with no responses yet is assumed to be slow, until it proves otherwise
+    static constexpr double unmeasured_penalty = 1e12;
+
+    const auto ongoing = ongoing_transactions.load(std::memory_order_relaxed);
+    const auto ewma = latency_ewma.load(std::memory_order_relaxed);
+    if (ewma == 0) { return ongoing == 0 ? 0 : unmeasured_penalty + ongoing; }
+
+    // Latencies decay while nothing is recorded, so a server that was slow once gets another chance later on
+    const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    const auto decayed = ewma * latencyDecay(now - latency_updated.load(std::memory_order_relaxed));
+    return decayed * (ongoing + 1);
+}
 
 LoadBalancer::LoadBalancer(int port, int connections_accepted, int retries, clock::duration stale_timeout,
                            const std::atomic_bool &quit_signal) :
-    _proxy(port, connections_accepted),
-    _retries(retries), _connections(), _stale_timout(stale_timeout), _quit_signal(quit_signal) {}
+    _health_checks{.interval = stale_timeout,
+                   .jitter_percent = 10,
+                   .rise = 1,
+                   .fall = 1,
+                   .timeout = std::chrono::seconds(10)},
+    _port(port), _connections_accepted(connections_accepted), _retries(retries), _quit_signal(quit_signal),
+    _stale_timout(stale_timeout) {}
+
+// Whether turn a comes before turn b. A connection with weight w takes its k-th turn at (k + 1/2) / w of the way
+// through the schedule, so a connection's turns are spread out instead of coming in a burst of w. Ties go to the
+// connection that was added first.
+static bool isTurnBefore(const Schedule &schedule, const Schedule::Turn &a, const Schedule::Turn &b) {
+    const auto a_position = (2 * static_cast<std::uint64_t>(a.number) + 1) * schedule.weights[b.connection];
+    const auto b_position = (2 * static_cast<std::uint64_t>(b.number) + 1) * schedule.weights[a.connection];
+    return a_position != b_position ? a_position < b_position : a.connection < b.connection;
+}
 
-void LoadBalancer::addConnection(std::string ip, int port, Metadata metadata) {
-    static int unique_id = 1;
-    if (metadata.id == -1) { metadata.id = unique_id++; }
+static std::vector<Schedule::Turn> turnsOf(std::uint32_t connection, std::uint32_t weight) {
+    std::vector<Schedule::Turn> turns;
+    for (std::uint32_t number = 0; number < weight; number++) { turns.push_back({connection, number}); }
+    return turns;
+}
 
-    {
-        std::scoped_lock lock{_connections_mutex};
-        _connections.push_back({TcpClient{ip, port}, metadata});
+// Lays out every connection's turns from scratch, scaling the weights down if there would be too many turns.
+static Schedule interleaveTurns(const std::vector<std::shared_ptr<Connection>> &connections) {
+    Schedule schedule;
+    std::uint64_t total_weight = 0;
+    for (const auto &connection : connections) {
+        schedule.weights.push_back(static_cast<std::uint32_t>(std::max(connection->metadata.weight, 0)));
+        total_weight += schedule.weights.back();
     }
+    if (total_weight > max_schedule_length) {
+        for (auto &weight : schedule.weights) {
+            if (weight != 0) { weight = std::max<std::uint64_t>(weight * max_schedule_length / total_weight, 1); }
+        }
+    }
+
+    for (std::uint32_t i = 0; i < schedule.weights.size(); i++) {
+        const auto turns = turnsOf(i, schedule.weights[i]);
+        schedule.turns.insert(schedule.turns.end(), turns.begin(), turns.end());
+    }
+    std::sort(schedule.turns.begin(), schedule.turns.end(),
+              [&schedule](const auto &a, const auto &b) { return isTurnBefore(schedule, a, b); });
+    return schedule;
+}
+
+// Adds the last of the connections to the schedule, merging its turns in between everyone else's.
+static Schedule withNewestTurns(const Schedule &previous, const std::vector<std::shared_ptr<Connection>> &connections) {
+    const auto weight = static_cast<std::uint32_t>(std::max(connections.back()->metadata.weight, 0));
+    if (previous.turns.size() + weight > max_schedule_length || previous.weights.size() + 1 != connections.size()) {
+        return interleaveTurns(connections);
+    }
+
+    Schedule schedule{.weights = previous.weights, .turns = {}};
+    schedule.weights.push_back(weight);
+
+    const auto added = turnsOf(static_cast<std::uint32_t>(connections.size() - 1), weight);
+    schedule.turns.reserve(previous.turns.size() + added.size());
+    std::merge(previous.turns.begin(), previous.turns.end(), added.begin(), added.end(),
+               std::back_inserter(schedule.turns),
+               [&schedule](const auto &a, const auto &b) { return isTurnBefore(schedule, a, b); });
+    return schedule;
+}
+
+void LoadBalancer::addConnection(std::string ip, int port, Metadata metadata) {
+    if (metadata.id == -1) { metadata.id = _next_id++; }
+
+    auto connection = std::make_shared<Connection>(TcpClient{ip, port}, metadata);
+    _backends.update([&connection](Backends &backends) {
+        connection->index = backends.connections.size();
+        backends.connections.push_back(std::move(connection));
+        const auto previous = backends.schedule != nullptr ? *backends.schedule : Schedule{};
+        backends.schedule = std::make_shared<const Schedule>(withNewestTurns(previous, backends.connections));
+    });
     std::cerr << out::info << "Added a new server: (id: " << metadata.id << ", weight: " << metadata.weight << ")\n";
 }
 
@@ -43,300 +145,438 @@ void LoadBalancer::use(Strategy strategy) {
         std::cerr << out::info << "\tLEAST CONNECTIONS\n";
     } else if (strategy == Strategy::RANDOM) {
         std::cerr << out::info << "\tRANDOM\n";
+    } else if (strategy == Strategy::POWER_OF_TWO_CHOICES) {
+        std::cerr << out::info << "\tPOWER OF TWO CHOICES\n";
+    } else if (strategy == Strategy::CONSISTENT_HASHING) {
+        std::cerr << out::info << "\tCONSISTENT HASHING\n";
     } else {
         std::cerr << out::info << "\tUNKNOWN\n";
     }
     _strategy = strategy;
 }
 
-void LoadBalancer::start() {
-    std::cerr << out::info << "Starting the load balancer: Stale timeout of "
-              << std::chrono::duration_cast<std::chrono::seconds>(_stale_timout).count() << " seconds, retrying "
-              << _retries << " times before giving up.\n";
-    switch (_strategy) {
-    case Strategy::WEIGHTED_ROUND_ROBIN: startWeightedRoundRobin(); break;
-    case Strategy::LEAST_CONNECTIONS: startLeastConnections(); break;
-    case Strategy::RANDOM: startRandom(); break;
-    }
+void LoadBalancer::useWorkers(int workers, bool pin_to_cores) {
+    std::cerr << out::info << "load balancer is running on " << workers << " worker(s)"
+              << (pin_to_cores ? ", each pinned to a core" : "") << "\n";
+    _worker_count = std::max(workers, 1);
+    _pin_workers = pin_to_cores;
 }
 
-TransactionResult queryClient(std::shared_mutex &mutex, Connection &connection,
-                              const AcceptData &client_request) noexcept {
-    try {
-        auto &[data, remote_fd] = client_request;
+void LoadBalancer::useIoUring(bool is_io_uring) {
+    if (is_io_uring) { std::cerr << out::info << "workers wait on their sockets through io_uring\n"; }
+    _is_io_uring = is_io_uring;
+}
 
-        if (!data.has_value()) { return {remote_fd, std::nullopt, connection, mutex}; }
+void LoadBalancer::usePool(UpstreamPool::Limits limits) {
+    std::cerr << out::info << "keeping up to " << limits.max_idle << " idle connection(s) to each server open for "
+              << limits.idle_timeout.count() << " seconds";
+    if (limits.max_connections != 0) {
+        std::cerr << out::info << ", with at most " << limits.max_connections << " open at once";
+    }
+    std::cerr << out::info << "\n";
+    std::cerr << out::info << "giving servers " << limits.connect_timeout.count() << " seconds to connect, and "
+              << limits.first_byte_timeout.count() << " seconds to start responding (0 for no limit)\n";
+    _pool_limits = limits;
+}
 
-        std::unique_lock lock{mutex};
-        auto &[client, metadata, ongoing_transactions] = connection;
-        std::cerr << out::verb << std::boolalpha << "querying server " << metadata.id << " (weight: " << metadata.weight
-                  << ", is active?: " << !metadata.is_inactive << ")\n";
-        ongoing_transactions++;
-        metadata.last_refreshed = clock::now();
-        lock.unlock();
-        const auto response = client.query(*data);
-        lock.lock();
-        ongoing_transactions--;
-        lock.unlock();
+void LoadBalancer::useKeepAlive(Server::KeepAlive keep_alive) {
+    if (keep_alive.idle_timeout.count() == 0) {
+        std::cerr << out::info << "client connections are closed after every response\n";
+    } else {
+        std::cerr << out::info << "keeping client connections open for " << keep_alive.idle_timeout.count()
+                  << " idle seconds, for up to " << keep_alive.max_requests << " request(s) each\n";
+    }
+    _keep_alive = keep_alive;
+}
 
-        return {remote_fd, response, connection, mutex};
-    } catch (std::runtime_error e) { perror("queryClient::LoadBalancer"); }
+void LoadBalancer::useHealthChecks(HealthChecker::Settings settings) {
+    std::cerr << out::info << "checking servers after "
+              << std::chrono::duration_cast<std::chrono::seconds>(settings.interval).count()
+              << " idle seconds (give or take " << settings.jitter_percent << "%), timing checks out after "
+              << settings.timeout.count() << " ms, marking servers inactive after " << settings.fall
+              << " failed check(s) and active after " << settings.rise << " passed check(s)\n";
+    _health_checks = settings;
+}
 
-    return {-1, std::nullopt, connection, mutex};
+void LoadBalancer::useOutlierDetection(OutlierDetector::Settings settings) {
+    if (settings.isEnabled()) {
+        std::cerr << out::info << "ejecting servers that fail " << settings.error_percent
+                  << "% of their transactions (0 to never) or are " << settings.latency_factor
+                  << " times slower than usual (0 to never), with at most " << settings.max_ejected_percent
+                  << "% of servers ejected at once\n";
+    }
+    _outlier_detection = settings;
 }
 
-void LoadBalancer::resolveFinishedTransactions() {
-    using namespace std::chrono_literals;
+void LoadBalancer::useTimeouts(std::chrono::seconds header_timeout, std::chrono::seconds request_timeout) {
+    std::cerr << out::info << "giving clients " << header_timeout.count() << " seconds (0 for no limit) to send a"
+              << " request's headers, and answering requests within " << request_timeout.count()
+              << " seconds (0 for no limit)\n";
+    _header_timeout = header_timeout;
+    _request_timeout = request_timeout;
+}
 
-    for (auto &transaction : _transactions) {
-        auto &[result, created, request, attempted] = transaction;
+void LoadBalancer::useRetryBudget(int percent) {
+    const RetryBudget::Settings settings{.percent = percent, .min_per_second = min_retries_per_second};
+    if (!settings.isEnabled()) {
+        _retry_budget.reset();
+        return;
+    }
 
-        if (!result.valid()) { continue; }
+    std::cerr << out::info << "retrying (and hedging) at most " << percent << "% of requests, plus "
+              << min_retries_per_second << " request(s) a second\n";
+    _retry_budget = std::make_unique<RetryBudget>(settings);
+}
 
-        const auto state = result.wait_for(10ms);
-        if (state != std::future_status::ready) { continue; }
+void LoadBalancer::useHedging(Hedging hedging) {
+    if (hedging.percentile > 0) {
+        std::cerr << out::info << "hedging GET requests that take longer than " << hedging.percentile
+                  << "% of recent responses\n";
+    } else if (hedging.delay.count() > 0) {
+        std::cerr << out::info << "hedging GET requests that take longer than " << hedging.delay.count() << " ms\n";
+    }
+    _hedging = hedging;
+}
 
-        auto [remote_fd, response_string, connection, mutex] = result.get();
-        std::unique_lock lock{mutex};
+void LoadBalancer::useStreaming(bool is_streaming) {
+    if (is_streaming) {
+        std::cerr << out::info << "responses are streamed to clients as soon as their headers arrive\n";
+    }
+    _is_streaming = is_streaming;
+}
 
-        if (response_string.has_value()) {
-            _proxy.respond(remote_fd, *response_string);
-            connection.metadata.is_inactive = false;
-        } else {
-            if (attempted > _retries) {
-                std::cerr << out::info << "failed to get data \n";
-                _proxy.respond(remote_fd, http::Response::respond503().construct());
-            } else {
-                std::cerr << out::debug << "attempting to retry the response (" << attempted << "<" << _retries
-                          << ")\n";
-                connection.metadata.is_inactive = true;
-                _failures.push({remote_fd, request.value(), connection, attempted});
-            }
-        }
+void LoadBalancer::useCache(std::size_t max_bytes) {
+    if (max_bytes == 0) {
+        _cache.reset();
+        return;
     }
 
-    const auto is_transaction_complete = [](const Transaction &t) { return !t.result.valid(); };
-    std::remove_if(_transactions.begin(), _transactions.end(), is_transaction_complete);
+    std::cerr << out::info << "caching fresh responses in up to " << max_bytes / (1024 * 1024) << " MiB of memory\n";
+    _cache = std::make_unique<ResponseCache>(max_bytes);
 }
 
-AcceptData LoadBalancer::checkForNewQueries() {
-    const auto client_request = _proxy.tryAcceptLatest(accept_timout_ms);
-    if (!client_request.data.has_value()) { return AcceptData{.remote_fd = -1}; }
+void LoadBalancer::useHashKey(HashKey key) {
+    _hash_key = std::move(key);
+}
 
-    // Ignore transactions if there are no server connections
-    if (_connections.size() == 0) {
-        std::cerr << "(error): No connected servers to query. Responding with 503...\n";
-        _proxy.respond(client_request.remote_fd, http::Response::respond503().construct());
-        return {.remote_fd = -1};
-    }
+void LoadBalancer::useMetrics(int port) {
+    if (port != 0) { std::cerr << out::info << "serving metrics at http://localhost:" << port << "/metrics\n"; }
+    _metrics_port = port;
+}
+
+void LoadBalancer::start() {
+    std::cerr << out::info << "Starting the load balancer: Stale timeout of "
+              << std::chrono::duration_cast<std::chrono::seconds>(_stale_timout).count() << " seconds, retrying "
+              << _retries << " times before giving up.\n";
 
-    const bool are_all_servers_down = std::all_of(_connections.begin(), _connections.end(),
-                                                  [](const Connection &c) { return c.metadata.is_inactive; });
-    if (are_all_servers_down) {
-        std::cerr << "(error): All connected servers are down. Responding with 503...\n";
-        _proxy.respond(client_request.remote_fd, http::Response::respond503().construct());
-        return {.remote_fd = -1};
+    // The health checker reads the servers from a thread of its own, after every worker
+    _backends.useReaders(_worker_count + 1);
+    refreshTables();
+    if (_metrics_port != 0) {
+        _metrics = std::make_unique<Metrics>(_worker_count, _backends.read().connections.size());
     }
 
-    return client_request;
-}
+    // Every worker gets its own listening socket, so they're all bound before any of them start accepting
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int id = 0; id < _worker_count; id++) {
+        workers.push_back(std::make_unique<Worker>(*this, id, _port, _connections_accepted));
+    }
 
-void LoadBalancer::testServers() {
-    using namespace std::chrono_literals;
+    std::vector<std::thread> threads;
+    for (auto worker = std::next(workers.begin()); worker != workers.end(); worker++) {
+        threads.emplace_back(&LoadBalancer::runWorker, this, std::ref(**worker));
+    }
 
-    bool runs_testing = false;
+    threads.emplace_back(&LoadBalancer::runHealthChecks, this);
 
-    for (auto &connection : _connections) {
-        std::shared_lock lock{_connections_mutex};
+    // The first worker runs on the calling thread, which is also left in charge of rebuilding the strategy's tables
+    runWorker(*workers.front());
+    for (auto &thread : threads) { thread.join(); }
 
-        auto &[client, metadata, ongoing_transactions] = connection;
-        const auto last_accessed = clock::now() - metadata.last_refreshed;
-        if (last_accessed >= _stale_timout && !metadata.is_being_tested) {
-            metadata.is_being_tested = true;
-            runs_testing = true;
-            const auto host = client.address();
-            const AcceptData is_active_request{.data = http::Request::isActiveRequest(host).construct(),
-                                               .remote_fd = -1};
+    if (_cache != nullptr) {
+        const auto stats = _cache->stats();
+        std::cerr << out::info << "response cache: " << stats.hits << " hit(s), " << stats.misses << " miss(es), "
+                  << stats.stores << " store(s), " << stats.evictions << " eviction(s)\n";
+    }
+}
 
-            // Creates a new thread to query the server
-            auto transaction = std::async(std::launch::async, &ls::queryClient, std::ref(_connections_mutex),
-                                          std::ref(connection), is_active_request);
-            _personalTransactions.push_back({std::move(transaction), clock::now(), is_active_request.data});
+void LoadBalancer::runWorker(Worker &worker) {
+    if (_pin_workers) {
+        const auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(worker.id() % cores, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+            std::cerr << out::warn << "Failed to pin worker " << worker.id() << " to core " << worker.id() % cores
+                      << "\n";
         }
     }
 
-    if (runs_testing) {
-        std::cerr << out::info << std::boolalpha << "running standard check to test if servers are active...\n";
+    const bool refreshes_tables = worker.id() == 0;
+    OutlierDetector outliers{_outlier_detection};
+    auto last_tidied = clock::now();
+    while (true) {
+        if (_quit_signal.load()) { break; }
+
+        worker.poll(housekeeping_interval_ms);
+        if (refreshes_tables) {
+            outliers.evaluate(_backends.read().connections);
+            if (_retry_budget != nullptr) { _retry_budget->replenish(); }
+            refreshTables();
+            _backends.reclaim();
+        }
+
+        if (clock::now() - last_tidied >= std::chrono::milliseconds(housekeeping_interval_ms)) {
+            worker.tidy();
+            last_tidied = clock::now();
+        }
     }
+}
 
-    for (auto &transaction : _personalTransactions) {
-        auto &[result, created, request, attempted] = transaction;
+void LoadBalancer::runHealthChecks() {
+    // Health changes are seen by workers straight away, and by the strategy's tables on the first worker's next pass
+    HealthChecker checker{_health_checks};
+    const auto reader = static_cast<std::size_t>(_worker_count);
+    while (!_quit_signal.load()) {
+        checker.watch(_backends.read().connections);
+        _backends.quiescent(reader);
+        checker.poll(housekeeping_interval_ms);
+    }
+}
 
-        if (!result.valid()) { continue; }
+void LoadBalancer::refreshTables() {
+    // Workers mark servers inactive as soon as they fail, and outliers are ejected on the first worker, so tables are
+    // brought in line with them here instead
+    if (_strategy == Strategy::RANDOM) { refreshAliasTable(); }
+    if (_strategy == Strategy::CONSISTENT_HASHING) { refreshHashTable(); }
+}
 
-        const auto state = result.wait_for(10ms);
-        if (state != std::future_status::ready) { continue; }
+void LoadBalancer::refreshAliasTable() {
+    const auto &backends = _backends.read();
+    const auto &connections = backends.connections;
+    const auto &alias_table = backends.alias_table;
 
-        auto [remote_fd, response_string, connection, mutex] = result.get();
-        std::unique_lock lock{mutex};
+    // Inactive (and ejected) servers are left out of the table by giving them no weight
+    std::vector<int> weights;
+    for (const auto &connection : connections) {
+        const bool is_active = connection->isAvailable();
+        weights.push_back(is_active ? std::max(connection->metadata.weight, 0) : 0);
+    }
 
-        connection.metadata.is_being_tested = false;
-        std::cerr << out::verb << "test for server " << connection.metadata.id << " complete...\n";
-        if (response_string.has_value()) {
-            if (connection.metadata.is_inactive) {
-                std::cerr << out::info << "The inactive server " << connection.metadata.id
-                          << " responded to a activity check. Marking it as active...\n";
-            }
-            connection.metadata.is_inactive = false;
-        } else {
-            if (!connection.metadata.is_inactive) {
-                std::cerr << out::info << "The active server " << connection.metadata.id
-                          << " didn't respond to a regular check. Marking it as inactive...\n";
-            }
-            connection.metadata.is_inactive = true;
-        }
+    bool needs_rebuild = alias_table == nullptr || alias_table->serverCount() != connections.size();
+    for (std::size_t i = 0; i < connections.size() && !needs_rebuild; i++) {
+        needs_rebuild = alias_table->weightOf(i) != weights[i];
     }
+    if (!needs_rebuild) { return; }
 
-    const auto is_transaction_complete = [](const Transaction &t) { return !t.result.valid(); };
-    std::remove_if(_personalTransactions.begin(), _personalTransactions.end(), is_transaction_complete);
+    auto next = std::make_shared<const AliasTable>(weights);
+    std::cerr << out::verb << "rebuilt the weighted random table\n";
+    _backends.update([&next](Backends &backends) { backends.alias_table = std::move(next); });
 }
 
-void LoadBalancer::createTransaction(Connection &connection, const AcceptData &client_request, int attempted) {
-    // Creates a new thread to query the server
-    auto transaction = std::async(std::launch::async, &ls::queryClient, std::ref(_connections_mutex),
-                                  std::ref(connection), client_request);
-    _transactions.push_back({std::move(transaction), clock::now(), client_request.data, attempted});
-}
+void LoadBalancer::refreshHashTable() {
+    const auto &backends = _backends.read();
+    const auto &connections = backends.connections;
+    const auto &hash_table = backends.hash_table;
+    std::vector<std::size_t> failed;
+    bool needs_rebuild = hash_table == nullptr || hash_table->backendCount() != connections.size();
+    for (std::size_t i = 0; i < connections.size() && !needs_rebuild; i++) {
+        const bool is_active = connections[i]->isAvailable();
+        if (is_active && !hash_table->isActive(i)) { needs_rebuild = true; }
+        if (!is_active && hash_table->isActive(i)) { failed.push_back(i); }
+    }
+    if (!needs_rebuild && failed.empty()) { return; }
+
+    // Servers going down only have their own keys moved. Servers coming back (or being added) get a fresh table, which
+    // moves back the keys they had before.
+    std::shared_ptr<const MaglevTable> next;
+    if (needs_rebuild) {
+        std::vector<MaglevTable::Backend> backends;
+        for (const auto &connection : connections) {
+            backends.push_back({.name = connection->client.address() + "#" + std::to_string(connection->metadata.id),
+                                .weight = connection->metadata.weight,
+                                .is_active = connection->isAvailable()});
+        }
+        next = std::make_shared<const MaglevTable>(backends);
+    } else {
+        next = std::make_shared<const MaglevTable>(hash_table->without(failed));
+    }
 
-void LoadBalancer::startWeightedRoundRobin() {
-    std::shared_lock lock{_connections_mutex};
-    static auto current = _connections.begin();
-    lock.unlock();
+    std::cerr << out::verb << "rebuilt the consistent hashing table\n";
+    _backends.update([&next](Backends &backends) { backends.hash_table = std::move(next); });
+}
 
-    static int times_connected = 0;
+Connection &LoadBalancer::pick(const AcceptData &request, LeastLoadedHeap &least_loaded) {
+    switch (_strategy) {
+    case Strategy::WEIGHTED_ROUND_ROBIN: return pickWeightedRoundRobin();
+    case Strategy::LEAST_CONNECTIONS: return pickLeastConnections(least_loaded);
+    case Strategy::RANDOM: return pickRandom();
+    case Strategy::POWER_OF_TWO_CHOICES: return pickPowerOfTwoChoices();
+    case Strategy::CONSISTENT_HASHING: return pickConsistentHashing(request);
+    }
 
-    while (true) {
-        if (_quit_signal.load()) { break; }
+    throw std::logic_error("unknown strategy");
+}
 
-        resolveFinishedTransactions();
-        testServers();
+Connection &LoadBalancer::pickWeightedRoundRobin() {
+    // Every worker shares the rotation, taking turns through a counter instead of a lock. Turns are looked up in the
+    // interleaved schedule. Turns belonging to inactive connections are skipped by taking the next turn from the
+    // rotation, so the remaining connections keep to their weights between themselves.
+    const auto &backends = _backends.read();
+    const auto &connections = backends.connections;
+    const auto &turns = backends.schedule->turns;
+
+    // Servers are simply taken in order if none of them have any weight
+    const auto owner = [&](std::uint64_t position) -> Connection & {
+        if (turns.empty()) { return *connections[position % connections.size()]; }
+        return *connections[turns[position % turns.size()].connection];
+    };
+
+    const auto length = turns.empty() ? connections.size() : turns.size();
+    const auto first_turn = _rotation.fetch_add(1, std::memory_order_relaxed);
+    if (auto &connection = owner(first_turn); connection.isAvailable()) {
+        return connection;
+    }
 
-        if (!_failures.empty()) {
-            auto &[socket_fd, data, connection, attempted] = _failures.front();
-            std::cerr << out::info << "retrying a request made to " << connection.metadata.id << "...\n";
-            AcceptData request{data, socket_fd};
-            createTransaction(*current, request, attempted + 1);
-            _failures.pop();
-        } else {
-            const auto client_request = checkForNewQueries();
-            if (!client_request.data.has_value()) { continue; }
+    for (std::size_t attempts = 1; attempts < length; attempts++) {
+        auto &connection = owner(_rotation.fetch_add(1, std::memory_order_relaxed));
+        if (connection.isAvailable()) { return connection; }
+    }
+    return owner(first_turn);
+}
 
-            createTransaction(*current, client_request);
-        }
+static LeastLoadedHeap::Load loadOf(const Connection &connection) {
+    return {.ongoing = connection.ongoing_transactions.load(std::memory_order_relaxed),
+            .weight = connection.metadata.weight,
+            .is_inactive = !connection.isAvailable()};
+}
 
-        lock.lock();
-        times_connected++;
-        if (times_connected >= current->metadata.weight || current->metadata.is_inactive) {
-            const int timeout = _connections.size() + 4;
-            int attempts = 0;
-            times_connected = 0;
-            while (true) {
-                times_connected++;
-                std::advance(current, 1);
-                if (current == _connections.end()) { current = _connections.begin(); }
-
-                if (!current->metadata.is_inactive) { break; }
-                if (times_connected > timeout) {
-                    current = _connections.begin();
-                    break;
-                }
-            }
-        }
-        lock.unlock();
+// Adds any servers that were added to the balancer since the heap last saw its connections. Connections are never
+// removed, so only the ones past the end of the heap are new.
+static void takeInNewServers(LeastLoadedHeap &least_loaded,
+                             const std::vector<std::shared_ptr<Connection>> &connections) {
+    for (auto server = least_loaded.size(); server < connections.size(); server++) {
+        least_loaded.push(loadOf(*connections[server]));
     }
 }
 
-void LoadBalancer::startLeastConnections() {
-    while (true) {
-        if (_quit_signal.load()) { break; }
+Connection &LoadBalancer::pickLeastConnections(LeastLoadedHeap &least_loaded) {
+    // The worker's heap has the connection with the fewest transactions for its weight on top, as far as the worker
+    // knows. Other workers' transactions (and health changes) only reach it between polls, so the server on top is
+    // checked against its shared counter first, and put back in its place if it's since become busier or gone down.
+    // A server that's become less busy stays on top, so the first one found up to date is the least loaded.
+    const auto &connections = _backends.read().connections;
+    takeInNewServers(least_loaded, connections);
+    for (std::size_t checked = 0; checked < connections.size(); checked++) {
+        const auto server = least_loaded.top();
+        const auto load = loadOf(*connections[server]);
+        if (load == least_loaded.load(server)) { break; }
+        least_loaded.update(server, load);
+    }
+    return *connections[least_loaded.top()];
+}
 
-        resolveFinishedTransactions();
-        testServers();
-
-        AcceptData request;
-        int attempt_number = 0;
-        {
-            std::shared_lock lock{_connections_mutex};
-            if (!_failures.empty()) {
-                auto &[socket_fd, data, connection, attempted] = _failures.front();
-                std::cerr << out::debug << "Setting up the request\n";
-                request = {data, socket_fd};
-                attempt_number = attempted + 1;
-                _failures.pop();
-            } else {
-                request = checkForNewQueries();
-            }
-        }
+void LoadBalancer::updateLoad(const Connection &connection, LeastLoadedHeap &least_loaded) const {
+    if (_strategy != Strategy::LEAST_CONNECTIONS) { return; }
 
+    // Servers the heap hasn't seen yet are taken in with their current load on the next pick
+    if (connection.index < least_loaded.size()) { least_loaded.update(connection.index, loadOf(connection)); }
+}
 
-        if (!request.data.has_value()) { continue; }
+void LoadBalancer::reconcile(LeastLoadedHeap &least_loaded) const {
+    if (_strategy != Strategy::LEAST_CONNECTIONS) { return; }
 
-        {
-            std::shared_lock lock{_connections_mutex};
-            auto lightest_connection = std::ref(_connections.front());
-            for (auto &connection : _connections) {
-                if (connection.metadata.is_inactive) { continue; }
+    const auto &connections = _backends.read().connections;
+    takeInNewServers(least_loaded, connections);
+    for (const auto &connection : connections) { least_loaded.update(connection->index, loadOf(*connection)); }
+}
 
-                auto transactions = connection.ongoing_transactions;
-                auto min_transactions = lightest_connection.get().ongoing_transactions;
+Connection &LoadBalancer::pickRandom() {
+    // Servers that were inactive when the table was last refreshed can't be sampled at all, so only servers that failed
+    // since then are ever sampled and passed over
+    const auto &backends = _backends.read();
+    if (backends.alias_table == nullptr || backends.alias_table->isEmpty()) { return pickWeightedRoundRobin(); }
 
-                bool lightest_inactive = lightest_connection.get().metadata.is_inactive;
-                bool connection_lightest = transactions < min_transactions;
-                bool same_amount_lowest_weight = transactions == min_transactions &&
-                    connection.metadata.weight > lightest_connection.get().metadata.weight;
-                if (lightest_inactive || connection_lightest || same_amount_lowest_weight) {
-                    lightest_connection = std::ref(connection);
-                }
-            }
-            lock.unlock();
+    static thread_local std::mt19937_64 gen{std::random_device{}()};
+    for (std::size_t attempts = 0; attempts < max_random_samples; attempts++) {
+        auto &connection = *backends.connections[backends.alias_table->sample(gen())];
+        if (connection.isAvailable()) { return connection; }
+    }
+    return pickWeightedRoundRobin();
+}
 
-            createTransaction(lightest_connection, request, attempt_number);
+Connection &LoadBalancer::pickPowerOfTwoChoices() {
+    // Two different servers are sampled, and the one expected to answer sooner is picked. Comparing only two keeps each
+    // pick cheap no matter how many servers there are, while still steering clear of slow or overloaded servers.
+    const auto &connections = _backends.read().connections;
+    if (connections.size() == 1) { return *connections.front(); }
+
+    static thread_local std::mt19937 gen{std::random_device{}()};
+    std::uniform_int_distribution<std::size_t> first_dist{0, connections.size() - 1};
+    std::uniform_int_distribution<std::size_t> offset_dist{1, connections.size() - 1};
+    const auto first = first_dist(gen);
+    auto &a = *connections[first];
+    auto &b = *connections[(first + offset_dist(gen)) % connections.size()];
+
+    const bool is_a_inactive = !a.isAvailable();
+    const bool is_b_inactive = !b.isAvailable();
+    if (is_a_inactive && is_b_inactive) {
+        for (std::size_t attempts = 1; attempts < connections.size(); attempts++) {
+            auto &connection = *connections[(first + attempts) % connections.size()];
+            if (connection.isAvailable()) { return connection; }
         }
+        return a;
     }
+    if (is_a_inactive) { return b; }
+    if (is_b_inactive) { return a; }
+
+    return a.loadCost() <= b.loadCost() ? a : b;
 }
 
-void LoadBalancer::startRandom() {
-    while (true) {
-        if (_quit_signal.load()) { break; }
+// Returns the request's target, as given in its request line.
+static std::string_view findTarget(std::string_view request) {
+    const auto line = request.substr(0, request.find("\r\n"));
+    const auto target_start = line.find(' ');
+    if (target_start == std::string_view::npos) { return {}; }
 
-        resolveFinishedTransactions();
-        testServers();
-
-        AcceptData request;
-        int attempt_number = 0;
-        {
-            std::shared_lock lock{_connections_mutex};
-            if (!_failures.empty()) {
-                auto &[socket_fd, data, connection, attempted] = _failures.front();
-                std::cerr << out::debug << "Setting up the request\n";
-                request = {data, socket_fd};
-                attempt_number = attempted + 1;
-                _failures.pop();
-            } else {
-                request = checkForNewQueries();
-            }
-        }
+    const auto target = line.substr(target_start + 1);
+    return target.substr(0, target.find(' '));
+}
+
+Connection &LoadBalancer::pickConsistentHashing(const AcceptData &request) {
+    const auto &backends = _backends.read();
+    const auto &connections = backends.connections;
+    const auto &hash_table = backends.hash_table;
+    if (hash_table == nullptr || hash_table->isEmpty()) { return pickWeightedRoundRobin(); }
+
+    // Requests missing the key can go anywhere, instead of all being sent to the server an empty key hashes to
+    std::optional<std::string> header;
+    std::string_view key;
+    switch (_hash_key.kind) {
+    case HashKey::Kind::TARGET: key = findTarget(request.data); break;
+    case HashKey::Kind::CLIENT_IP:
+        key = {reinterpret_cast<const char *>(&request.client_address), sizeof(request.client_address)};
+        break;
+    case HashKey::Kind::HOST:
+    case HashKey::Kind::HEADER:
+        header = http::findHeader(request.data, _hash_key.kind == HashKey::Kind::HOST ? "Host" : _hash_key.header);
+        if (!header.has_value()) { return pickWeightedRoundRobin(); }
+        key = *header;
+        break;
+    }
 
-        if (!request.data.has_value()) { continue; }
+    // Servers that failed since the table was last refreshed are skipped by moving on to the next slot, which belongs
+    // to an unrelated server, so a failed server's keys are still spread out
+    const auto hash = std::hash<std::string_view>{}(key);
+    for (std::size_t offset = 0; offset < max_hash_probes; offset++) {
+        const auto index = hash_table->lookup(hash, offset);
+        if (index >= connections.size()) { break; }
 
-        {
-            std::shared_lock lock{_connections_mutex};
-            std::uniform_int_distribution<std::size_t> dist{0, _connections.size() - 1};
-            size_t indx = dist(gen);
-            lock.unlock();
-            createTransaction(_connections[indx], request);
-        }
+        auto &connection = *connections[index];
+        if (connection.isAvailable()) { return connection; }
     }
+
+    return pickWeightedRoundRobin();
 }
 
-} // namespace ls
\ No newline at end of file
+} // namespace ls
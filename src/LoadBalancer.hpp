@@ -2,70 +2,171 @@
 
 #include <atomic>
 #include <chrono>
-#include <future>
-#include <queue>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <random>
-#include <shared_mutex>
 #include <string>
 #include <sys/types.h>
 #include <vector>
+#include "AliasTable.hpp"
+#include "CircuitBreaker.hpp"
+#include "HealthChecker.hpp"
+#include "LeastLoadedHeap.hpp"
+#include "MaglevTable.hpp"
+#include "Metrics.hpp"
+#include "OutlierDetector.hpp"
+#include "Rcu.hpp"
+#include "RetryBudget.hpp"
+#include "ResponseCache.hpp"
 #include "Server.hpp"
 #include "Sockets.hpp"
 #include "TcpClient.hpp"
+#include "UpstreamPool.hpp"
 
 namespace ls {
 
 using clock = std::chrono::system_clock;
 
-constexpr int accept_timout_ms = 10;
+// How finely each worker keeps to its timeouts.
+constexpr std::chrono::milliseconds timeout_tick{10};
 
+// How long the balancer waits on its event loop before running housekeeping (like rebuilding the strategy's tables)
+// when no sockets are ready. Ready sockets are handled as soon as they become ready, regardless of this value.
+constexpr int housekeeping_interval_ms = 100;
+
+// The longest weighted round robin schedule that's built. Servers whose weights add up to more than this have their
+// weights scaled down to fit, which only matters for weights in the hundreds of thousands.
+constexpr std::size_t max_schedule_length = 1 << 20;
+
+// How many servers weighted random samples before giving up on finding an active one, and falling back to weighted
+// round robin. The sampled servers only come up inactive if they failed since the sampling table was last refreshed.
+constexpr std::size_t max_random_samples = 4;
+
+// How many slots of the consistent hashing table are tried before a request whose servers are all inactive is sent
+// wherever weighted round robin picks instead.
+constexpr std::size_t max_hash_probes = 16;
+
+// Counters that every worker writes to are kept on cache lines of their own, so that updating one doesn't stall the
+// workers reading (or writing) another.
+constexpr std::size_t cache_line_size = 64;
+
+// How quickly a server's measured latency decays back down after a slow response. A server's latency drops to about a
+// third of its peak once this much time has passed without anything slower coming in.
+constexpr std::chrono::seconds latency_decay_time{10};
+
+// How many retries the retry budget allows every second, however little traffic is coming in.
+constexpr int min_retries_per_second = 10;
+
+// How many of each worker's latest response times are kept for hedging by a percentile, and how many it needs before
+// it starts hedging at all.
+constexpr std::size_t hedge_samples = 1024;
+constexpr std::size_t min_hedge_samples = 100;
+
+// How many times the strategy is asked for a server other than the one a request was first sent to, before the request
+// is left unhedged. Consistent hashing always picks the same server for a request, so its requests are never hedged.
+constexpr std::size_t max_hedge_picks = 4;
+
+// A server's settings, which stay the same once it's added to the balancer.
 struct Metadata {
-    inline static Metadata makeDefault() {
-        return {.weight = 1,
-                .id = -1,
-                .is_inactive = false,
-                .is_being_tested = false,
-                .last_refreshed = std::chrono::system_clock::now()};
-    }
+    inline static Metadata makeDefault() { return {.weight = 1, .id = -1}; }
 
 public:
     int weight;
     int id;
-    bool is_inactive;
-    bool is_being_tested;
-    clock::time_point last_refreshed;
 };
 
 struct Connection {
+    Connection(TcpClient client, Metadata metadata);
+
+    // Adds a response time to the server's peak-EWMA latency, which jumps straight up to slower responses and decays
+    // back down over time as faster ones come in.
+    void recordLatency(std::chrono::nanoseconds latency);
+
+    // The server's latency (in nanoseconds, as of now) weighed by how many transactions it has in progress. Servers
+    // that haven't responded yet cost nothing unless they're already busy, so new servers are tried straight away.
+    [[nodiscard]] double loadCost() const;
+
+    // Whether the server can be picked, being neither inactive nor ejected as an outlier.
+    [[nodiscard]] inline bool isAvailable() const {
+        return !is_inactive.load(std::memory_order_relaxed) && !breaker.isOpen();
+    }
+
     TcpClient client;
-    Metadata metadata;
-    unsigned int ongoing_transactions = 0;
+    const Metadata metadata;
+    std::size_t index = 0; // Where the connection is in the balancer's list of connections
+
+    alignas(cache_line_size) std::atomic_uint ongoing_transactions = 0;
+    alignas(cache_line_size) std::atomic<clock::time_point> last_refreshed; // When a request was last answered, if ever
+    alignas(cache_line_size) std::atomic_bool is_inactive = false;
+    alignas(cache_line_size) std::atomic<double> latency_ewma = 0; // In nanoseconds
+    std::atomic<std::chrono::steady_clock::rep> latency_updated = 0;
+    alignas(cache_line_size) CircuitBreaker breaker;
+};
+
+// The order that connections take their turns in the weighted round robin.
+struct Schedule {
+    struct Turn {
+        std::uint32_t connection;
+        std::uint32_t number; // Which of the connection's turns this is
+    };
+
+public:
+    std::vector<std::uint32_t> weights; // Each connection's number of turns
+    std::vector<Turn> turns;
+};
+
+// The balancer's servers, as of some point in time. Connections are never removed, so a connection picked from one
+// snapshot stays valid after it's replaced by another.
+struct Backends {
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::shared_ptr<const Schedule> schedule;      // Shared between snapshots, since it only changes with the servers
+    std::shared_ptr<const AliasTable> alias_table; // Only built for weighted random
+    std::shared_ptr<const MaglevTable> hash_table; // Only built for consistent hashing
+};
+
+// The part of a request that consistent hashing sends to the same server every time.
+struct HashKey {
+    enum class Kind { TARGET, HOST, CLIENT_IP, HEADER };
+
+public:
+    Kind kind;
+    std::string header; // The header's name, for HEADER keys
+};
+
+// Sending a second copy of a slow GET (or HEAD) request to another server, and using whichever answers first.
+struct Hedging {
+    std::chrono::milliseconds delay; // How long the first server has to answer before the copy is sent, or 0
+    int percentile;                  // Waits as long as this percentile of recent response times instead, if not 0
+
+public:
+    [[nodiscard]] inline bool isEnabled() const { return delay.count() > 0 || percentile > 0; }
 };
 
 struct TransactionFailure {
-    int socket_fd;
-    std::string request;
+    AcceptData request;
     const Connection &connection;
     int attempted;
-};
-
-struct TransactionResult {
-    int socket_fd;
-    sockets::data data;
-    Connection &connection;
-    std::shared_mutex &mutex;
+    std::chrono::steady_clock::time_point deadline;
 };
 
 struct Transaction {
-    std::future<TransactionResult> result;
-    clock::time_point created;
-    sockets::data request;
+    std::chrono::steady_clock::time_point deadline; // When the client is given up on, carried over between retries
+    std::chrono::steady_clock::time_point sent;     // When the server was queried, for measuring its latency
+    AcceptData request;
+    Connection &connection;
     int attempted;
+    std::optional<std::uint64_t> sibling;     // The other copy of a hedged request, while it's still waiting on a server
+    std::optional<TimerWheel::TimerId> hedge; // Sends a copy of the request elsewhere, if it's taking too long
+    TcpClient::Cancel cancel;
 };
 
+class Worker;
+
 class LoadBalancer {
 public:
-    enum class Strategy { WEIGHTED_ROUND_ROBIN, LEAST_CONNECTIONS, RANDOM };
+    enum class Strategy { WEIGHTED_ROUND_ROBIN, LEAST_CONNECTIONS, RANDOM, POWER_OF_TWO_CHOICES, CONSISTENT_HASHING };
 
     LoadBalancer(int port, int connections_accepted, int retries, clock::duration stale_timeout,
                  const std::atomic_bool &quit_signal);
@@ -73,32 +174,85 @@ public:
 
 
     void use(Strategy strategy);
+    void useWorkers(int workers, bool pin_to_cores = false);
+    void useIoUring(bool is_io_uring);
+    void usePool(UpstreamPool::Limits limits);
+    void useKeepAlive(Server::KeepAlive keep_alive);
+    void useHealthChecks(HealthChecker::Settings settings);
+    void useOutlierDetection(OutlierDetector::Settings settings);
+    void useTimeouts(std::chrono::seconds header_timeout, std::chrono::seconds request_timeout);
+    void useRetryBudget(int percent);
+    void useHedging(Hedging hedging);
+    void useStreaming(bool is_streaming);
+    void useCache(std::size_t max_bytes);
+    void useHashKey(HashKey key);
+    void useMetrics(int port);
     void start();
 
+    // Picks the server that the request is sent to, using the balancer's strategy. Least connections picks from the
+    // calling worker's own heap.
+    Connection &pick(const AcceptData &request, LeastLoadedHeap &least_loaded);
+
+    // Has the worker's heap catch up on a change to the connection's ongoing transactions, or whether it's available.
+    void updateLoad(const Connection &connection, LeastLoadedHeap &least_loaded) const;
+
+    // Brings every server's load in the worker's heap up to date, since the heap only hears straight away about
+    // transactions the worker started or finished itself. Workers call this between polls.
+    void reconcile(LeastLoadedHeap &least_loaded) const;
+
+    // Rebuilds the tables that the strategy picks from, if any servers were added or changed health since they were
+    // last built. The first worker calls this between polls.
+    void refreshTables();
+
 private:
-    AcceptData checkForNewQueries();
-    void resolveFinishedTransactions();
-    void testServers();
-    void createTransaction(Connection &connection, const AcceptData &client_request, int attempted = 0);
+    friend class Worker;
 
+    void runWorker(Worker &worker);
+    void runHealthChecks();
+    void refreshAliasTable();
+    void refreshHashTable();
 
-    void startWeightedRoundRobin();
-    void startLeastConnections();
-    void startRandom();
+    Connection &pickWeightedRoundRobin();
+    Connection &pickLeastConnections(LeastLoadedHeap &least_loaded);
+    Connection &pickRandom();
+    Connection &pickPowerOfTwoChoices();
+    Connection &pickConsistentHashing(const AcceptData &request);
 
 private:
-    Server _proxy;
-    std::vector<Connection> _connections;
-    std::shared_mutex _connections_mutex;
-    std::vector<Transaction> _transactions;
-    std::vector<Transaction> _personalTransactions;
-    std::queue<TransactionFailure> _failures;
+    Rcu<Backends> _backends{Backends{}};
+    alignas(cache_line_size) std::atomic_uint64_t _rotation = 0; // The next turn in the weighted round robin
+    int _next_id = 1;
     Strategy _strategy = Strategy::WEIGHTED_ROUND_ROBIN;
-    std::mt19937 gen{std::random_device{}()};
+    int _worker_count = 1;
+    bool _pin_workers = false;
+    bool _is_io_uring = false; // Workers' event loops fall back to epoll if io_uring isn't available
+    UpstreamPool::Limits _pool_limits{.max_idle = 32,
+                                      .max_connections = 0,
+                                      .idle_timeout = std::chrono::seconds(60),
+                                      .connect_timeout = std::chrono::seconds(10),
+                                      .first_byte_timeout = std::chrono::seconds(60)};
+    Server::KeepAlive _keep_alive{.idle_timeout = std::chrono::seconds(60), .max_requests = 1000};
+    std::chrono::seconds _header_timeout{60};
+    std::chrono::seconds _request_timeout{120}; // How long a request has to be answered, retries included
+    std::unique_ptr<RetryBudget> _retry_budget; // Only set up when retries are budgeted
+    Hedging _hedging{.delay = std::chrono::milliseconds(0), .percentile = 0};
+    HealthChecker::Settings _health_checks;
+    OutlierDetector::Settings _outlier_detection{.error_percent = 0,
+                                                 .latency_factor = 0,
+                                                 .max_ejected_percent = 0,
+                                                 .ejection_time = std::chrono::seconds(0),
+                                                 .max_ejection_time = std::chrono::seconds(0)};
+    bool _is_streaming = false;
+    std::unique_ptr<ResponseCache> _cache; // Only set up when caching is turned on
+    HashKey _hash_key{.kind = HashKey::Kind::TARGET, .header = ""};
+    int _metrics_port = 0;             // 0 when metrics are turned off
+    std::unique_ptr<Metrics> _metrics; // Only set up once the balancer starts, with metrics turned on
 
+    const int _port;
+    const int _connections_accepted;
     const int _retries;
     const std::atomic_bool &_quit_signal;
     const clock::duration _stale_timout;
 };
 
-} // namespace ls
\ No newline at end of file
+} // namespace ls
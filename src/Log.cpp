@@ -1,11 +1,177 @@
 #include "Log.hpp"
-
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 namespace out {
 
 int level = 3;
 
-__NullBuffer __null_buffer{};
-std::ostream __null_stream{&__null_buffer};
+// How long the background thread sleeps for when there's nothing to write.
+static constexpr std::chrono::milliseconds idle_interval{5};
+
+// Set once the background thread is gone, after which lines are written straight away instead of pushed to a ring.
+static std::atomic_bool is_stopped = false;
+
+void __LogRing::push(std::string_view text) {
+    // Lines go in whole or not at all, so a dropped line never leaves half of itself behind
+    const auto head = _head.load(std::memory_order_relaxed);
+    const auto room = capacity - (head - _tail.load(std::memory_order_acquire));
+    if (text.length() > room) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // The text may wrap around the end of the buffer, in which case it's copied in two pieces
+    const auto start = head % capacity;
+    const auto first = std::min(text.length(), capacity - start);
+    text.copy(_buffer.get() + start, first);
+    text.substr(first).copy(_buffer.get(), text.length() - first);
+    _head.store(head + text.length(), std::memory_order_release);
+}
+
+bool __LogRing::drain(std::string &into) {
+    const auto head = _head.load(std::memory_order_acquire);
+    const auto tail = _tail.load(std::memory_order_relaxed);
+    if (head == tail) { return false; }
+
+    const auto start = tail % capacity;
+    const auto length = head - tail;
+    const auto first = std::min<std::size_t>(length, capacity - start);
+    into.append(_buffer.get() + start, first);
+    into.append(_buffer.get(), length - first);
+    _tail.store(head, std::memory_order_release);
+    return true;
+}
+
+std::uint64_t __LogRing::takeDropped() { return _dropped.exchange(0, std::memory_order_relaxed); }
+
+// Owns every thread's ring, and the background thread writing them out.
+class Writer {
+public:
+    ~Writer() { stop(); }
+
+    // Returns the ring to push to, or nothing if lines should be written straight away instead.
+    __LogRing *ringFor(std::shared_ptr<__LogRing> &owned) {
+        if (owned != nullptr) { return is_stopped.load(std::memory_order_relaxed) ? nullptr : owned.get(); }
+
+        std::scoped_lock lock{_mutex};
+        if (is_stopped) { return nullptr; }
+        owned = std::make_shared<__LogRing>();
+        _rings.push_back(owned);
+        if (!_thread.joinable()) { _thread = std::thread{&Writer::run, this}; }
+        return owned.get();
+    }
+
+    void stop() {
+        {
+            std::scoped_lock lock{_mutex};
+            if (is_stopped) { return; }
+            is_stopped = true;
+        }
+        if (_thread.joinable()) { _thread.join(); }
+        writeAll();
+    }
+
+private:
+    void run() {
+        while (!is_stopped.load(std::memory_order_relaxed)) {
+            if (!writeAll()) { std::this_thread::sleep_for(idle_interval); }
+        }
+    }
+
+    // Writes out everything in every ring. Returns false if there was nothing to write.
+    bool writeAll() {
+        {
+            std::scoped_lock lock{_mutex};
+            _draining = _rings;
+        }
+
+        _batch.clear();
+        for (const auto &ring : _draining) {
+            ring->drain(_batch);
+            if (const auto dropped = ring->takeDropped(); dropped > 0) {
+                _batch += "(warn): dropped " + std::to_string(dropped) +
+                          " log line(s) logged faster than they could be written\n";
+            }
+        }
+        if (_batch.empty()) { return false; }
+
+        std::size_t written = 0;
+        while (written < _batch.length()) {
+            const auto len = ::write(STDERR_FILENO, _batch.data() + written, _batch.length() - written);
+            if (len < 0 && errno == EINTR) { continue; }
+            if (len <= 0) { break; }
+            written += static_cast<std::size_t>(len);
+        }
+        return true;
+    }
+
+private:
+    std::mutex _mutex; // Guards the list of rings, not the rings themselves
+    std::vector<std::shared_ptr<__LogRing>> _rings;
+    std::vector<std::shared_ptr<__LogRing>> _draining; // Only used by the background thread (or by stop)
+    std::string _batch;
+    std::thread _thread;
+};
+
+static Writer writer;
+
+// Renders lines into a string that's kept between lines, so rendering doesn't allocate once it's grown large enough.
+class LineBuffer : public std::streambuf {
+public:
+    LineBuffer() : stream(this) {}
+
+    inline std::string_view text() const { return _text; }
+    inline void clear() { _text.clear(); }
+
+protected:
+    int overflow(int c) override {
+        if (c != traits_type::eof()) { _text.push_back(static_cast<char>(c)); }
+        return c;
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        _text.append(s, static_cast<std::size_t>(n));
+        return n;
+    }
+
+public:
+    std::ostream stream;
+    std::shared_ptr<__LogRing> ring; // Kept alive by the writer too, so it's written out after the thread exits
+
+private:
+    std::string _text;
+};
+
+static thread_local LineBuffer line_buffer;
+
+std::ostream *__beginLine(const char *prefix) {
+    line_buffer.stream << prefix;
+    return &line_buffer.stream;
+}
+
+void __endLine(std::ostream &os, std::ostream &rendered) {
+    // Only std::cerr is written from the background thread, since that's the stream it writes to
+    auto *ring = &os == &std::cerr ? writer.ringFor(line_buffer.ring) : nullptr;
+    if (ring != nullptr) {
+        ring->push(line_buffer.text());
+    } else {
+        os << line_buffer.text();
+    }
+
+    // Manipulators (like std::boolalpha) only last for the line they're used on
+    line_buffer.clear();
+    rendered.clear();
+    rendered.flags(std::ios_base::dec | std::ios_base::skipws);
+}
+
+void flush() {
+    writer.stop();
+}
 
-} // namespace out
\ No newline at end of file
+} // namespace out
@@ -10,25 +10,34 @@
 // For example:
 //    std::cout << out::info << "Information here" << ...
 // Using this, this will only print if the logging level is set to 3 or above.
+//
+// Lines logged to std::cerr are never written from the thread logging them. Each line is rendered into a buffer of the
+// logging thread's own, and once the statement ends, copied into that thread's ring of log lines. A background thread
+// empties every thread's ring and writes them out, so logging never waits on the terminal (or takes a lock) on the hot
+// path. If the ring is full, the line is dropped (and counted) rather than holding up the thread.
+//
+// Nothing is rendered at all for lines above the logging level, and lines above OUT_MAX_LEVEL (set at compile time)
+// don't even check it. Either way, the values streamed into a line are still worked out at the call site, so anything
+// costly to work out only for a log line is best kept behind a check of out::level.
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <ostream>
-#include <streambuf>
+#include <string>
+#include <string_view>
 
+// The most verbose level that's compiled in. Lines above it can't be turned on by the logging level.
+#ifndef OUT_MAX_LEVEL
+#define OUT_MAX_LEVEL 5
+#endif
 
 namespace out {
 
-// https://stackoverflow.com/a/11826666
-// The following set of objects provides a null output stream.
-// This is similar to std::cout or std::cerr, but instead redirects incoming traffic into the void.
-class __NullBuffer : public std::streambuf {
-public:
-    inline int overflow(int c) override { return c; }
-};
-extern __NullBuffer __null_buffer;
-extern std::ostream __null_stream;
-
+constexpr int max_level = OUT_MAX_LEVEL;
 
 // Global int that sets the logging level of the program.
 // The higher the value, the more is logged:
@@ -39,61 +48,128 @@ extern std::ostream __null_stream;
 // - level >= 5: Debug logged
 extern int level;
 
-// Made to be overriden, its only function is to reduce boilerplate.
-struct __log_ostream {
-    inline __log_ostream(std::ostream &os) : os(os) {}
+// A single-producer, single-consumer ring of bytes, that a thread writes its log lines into for the background thread
+// to write out. The producer never waits on the background thread.
+class __LogRing {
+public:
+    static constexpr std::size_t capacity = 1 << 20;
+
+    __LogRing() : _buffer(new char[capacity]) {}
+
+    // Copies the text into the ring, or drops it (and counts it) if there isn't room for all of it.
+    void push(std::string_view text);
+
+    // Appends everything in the ring to the given string, emptying the ring. Returns false if it was already empty.
+    bool drain(std::string &into);
+
+    // Returns the number of lines dropped since the last call.
+    std::uint64_t takeDropped();
 
-    std::ostream &os;
+private:
+    std::unique_ptr<char[]> _buffer;
+    alignas(64) std::atomic_uint64_t _head = 0; // Bytes ever pushed, only written by the producer
+    alignas(64) std::atomic_uint64_t _tail = 0; // Bytes ever drained, only written by the background thread
+    alignas(64) std::atomic_uint64_t _dropped = 0;
 };
 
+// Hands out a stream into the calling thread's buffer, with the prefix already in it.
+std::ostream *__beginLine(const char *prefix);
+// Hands the rendered line off to be written, and clears the buffer for the next one.
+void __endLine(std::ostream &os, std::ostream &rendered);
+
+// A line that's being logged. It's rendered into a buffer held by the thread logging it, and is handed off to be
+// written once the statement it's in ends (when the line is destroyed).
+class __Line {
+public:
+    inline __Line(std::ostream &os, int line_level, const char *prefix) :
+        _os(os), _rendered(line_level <= level ? __beginLine(prefix) : nullptr) {}
+    inline ~__Line() {
+        if (_rendered != nullptr) { __endLine(_os, *_rendered); }
+    }
+
+    // No copying or moving a line, it's only ever a temporary
+    __Line(const __Line &) = delete;
+    __Line &operator=(const __Line &) = delete;
+    __Line(__Line &&) = delete;
+    __Line &operator=(__Line &&) = delete;
+
+    template <typename T>
+    inline __Line &operator<<(const T &v) {
+        if (_rendered != nullptr) { *_rendered << v; }
+        return *this;
+    }
+
+private:
+    std::ostream &_os;
+    std::ostream *_rendered; // Nothing when the line's level isn't being logged
+};
+
+// Stands in for a line whose level isn't compiled in, so that nothing it's given is ever rendered (though it's still
+// worked out by the caller).
+struct __DiscardedLine {
+    template <typename T>
+    constexpr const __DiscardedLine &operator<<(const T &) const {
+        return *this;
+    }
+};
+
+// Writes out anything logged so far, and stops the background thread. Anything logged after this is written straight
+// away, from the thread logging it.
+void flush();
+
 // Allows the use of ... << out::err << ... for displaying errors.
 class __LogError {};
 constexpr __LogError err;
-struct __err_ostream : __log_ostream {};
-inline __err_ostream operator<<(std::ostream &os, __LogError) { return {os}; }
-template <typename T>
-inline std::ostream &operator<<(__err_ostream os, const T &v) {
-    return level >= 1 ? os.os << "(err):  " << v : __null_stream;
+inline auto operator<<(std::ostream &os, __LogError) {
+    if constexpr (max_level >= 1) {
+        return __Line{os, 1, "(err):  "};
+    } else {
+        return __DiscardedLine{};
+    }
 }
 
 // Allows the use of ... << out::warn << ... for displaying warnings.
 class __LogWarning {};
 constexpr __LogWarning warn;
-struct __warn_ostream : __log_ostream {};
-inline __warn_ostream operator<<(std::ostream &os, __LogWarning) { return {os}; }
-template <typename T>
-inline std::ostream &operator<<(__warn_ostream os, const T &v) {
-    return level >= 2 ? os.os << "(warn): " << v : __null_stream;
+inline auto operator<<(std::ostream &os, __LogWarning) {
+    if constexpr (max_level >= 2) {
+        return __Line{os, 2, "(warn): "};
+    } else {
+        return __DiscardedLine{};
+    }
 }
 
 // Allows the use of ... << out::info << ... for displaying info logs.
 class __LogInfo {};
 constexpr __LogInfo info;
-struct __info_ostream : __log_ostream {};
-inline __info_ostream operator<<(std::ostream &os, __LogInfo) { return {os}; }
-template <typename T>
-inline std::ostream &operator<<(__info_ostream os, const T &v) {
-    return level >= 3 ? os.os << "(info): " << v : __null_stream;
+inline auto operator<<(std::ostream &os, __LogInfo) {
+    if constexpr (max_level >= 3) {
+        return __Line{os, 3, "(info): "};
+    } else {
+        return __DiscardedLine{};
+    }
 }
 
 // Allows the use of ... << out::verb << ... for displaying verbose logs.
 class __LogVerbose {};
 constexpr __LogVerbose verb;
-struct __verbose_ostream : __log_ostream {};
-inline __verbose_ostream operator<<(std::ostream &os, __LogVerbose) { return {os}; }
-template <typename T>
-inline std::ostream &operator<<(__verbose_ostream os, const T &v) {
-    return level >= 4 ? os.os << "(verb): " << v : __null_stream;
+inline auto operator<<(std::ostream &os, __LogVerbose) {
+    if constexpr (max_level >= 4) {
+        return __Line{os, 4, "(verb): "};
+    } else {
+        return __DiscardedLine{};
+    }
 }
 
 // Allows the use of ... << out::debug << ... for displaying debug logs.
 class __LogDebug {};
 constexpr __LogDebug debug;
-struct __debug_ostream : __log_ostream {};
-inline __debug_ostream operator<<(std::ostream &os, __LogDebug) { return {os}; }
-template <typename T>
-inline std::ostream &operator<<(__debug_ostream os, const T &v) {
-    return level >= 5 ? os.os << "(debug): " << v : __null_stream;
+inline auto operator<<(std::ostream &os, __LogDebug) {
+    if constexpr (max_level >= 5) {
+        return __Line{os, 5, "(debug): "};
+    } else {
+        return __DiscardedLine{};
+    }
 }
 
-} // namespace out
\ No newline at end of file
+} // namespace out
@@ -0,0 +1,94 @@
+#include "MaglevTable.hpp"
+#include <algorithm>
+
+namespace ls {
+
+// Slots given to each server, on average. More slots spread keys more evenly, at the cost of memory and rebuild time.
+static constexpr std::size_t slots_per_backend = 100;
+
+// The smallest table, which already keeps small clusters within a percent of their fair share.
+static constexpr std::size_t min_table_size = 65537;
+
+static bool isPrime(std::size_t n) {
+    if (n < 2) { return false; }
+    for (std::size_t divisor = 2; divisor * divisor <= n; divisor++) {
+        if (n % divisor == 0) { return false; }
+    }
+    return true;
+}
+
+// The table's size has to be prime, so that every skip walks through every slot.
+static std::size_t tableSize(std::size_t backends) {
+    auto size = std::max(min_table_size, backends * slots_per_backend);
+    while (!isPrime(size)) { size++; }
+    return size;
+}
+
+// FNV-1a, seeded so that a server's offset and skip come out of two unrelated hashes of its name.
+static std::uint64_t hashName(const std::string &name, std::uint64_t seed) {
+    std::uint64_t hash = 14695981039346656037ull ^ seed;
+    for (const char c : name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+MaglevTable::MaglevTable(const std::vector<Backend> &backends) : _slots(tableSize(backends.size()), empty_slot) {
+    const auto size = _slots.size();
+    for (const auto &backend : backends) {
+        _backends.push_back({.offset = hashName(backend.name, 0) % size,
+                             .skip = hashName(backend.name, 0x9e3779b97f4a7c15ull) % (size - 1) + 1,
+                             .weight = backend.weight,
+                             .is_active = backend.is_active});
+    }
+    fill(0);
+}
+
+MaglevTable MaglevTable::without(const std::vector<std::size_t> &removed) const {
+    auto table = *this;
+    for (const auto backend : removed) { table._backends[backend].is_active = false; }
+
+    std::size_t filled = 0;
+    for (auto &slot : table._slots) {
+        if (slot != empty_slot && !table._backends[slot].is_active) { slot = empty_slot; }
+        if (slot != empty_slot) { filled++; }
+    }
+
+    // The remaining servers pick up their permutations from where they left off, only claiming the freed slots
+    table.fill(filled);
+    return table;
+}
+
+void MaglevTable::fill(std::size_t filled) {
+    const auto size = _slots.size();
+    const bool has_claimants = std::any_of(_backends.begin(), _backends.end(), [](const Permutation &backend) {
+        return backend.is_active && backend.weight > 0;
+    });
+    if (!has_claimants) {
+        std::fill(_slots.begin(), _slots.end(), empty_slot);
+        return;
+    }
+
+    // Each turn, servers claim as many slots as their weight
+    while (filled < size) {
+        for (std::uint32_t i = 0; i < _backends.size() && filled < size; i++) {
+            auto &backend = _backends[i];
+            if (!backend.is_active) { continue; }
+
+            for (int claimed = 0; claimed < backend.weight && filled < size; claimed++) {
+                while (true) {
+                    const auto slot = (backend.offset + backend.next * backend.skip) % size;
+                    backend.next++;
+                    if (_slots[slot] == empty_slot) {
+                        _slots[slot] = i;
+                        filled++;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace ls
@@ -0,0 +1,60 @@
+// A consistent-hashing lookup table, as described in Google's Maglev paper. Every server gets its own permutation of
+// the table's slots, and servers take turns claiming the next free slot in their permutation until the table is full.
+// Looking up a key is then a single hash and index, and each server ends up with a share of the slots close to its
+// share of the total weight.
+//
+// Removing a server only hands its own slots to the servers that are left, so keys that hashed to any other server
+// stay where they were.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ls {
+
+class MaglevTable {
+public:
+    struct Backend {
+        std::string name; // Decides the server's permutation, so it should stay the same across restarts
+        int weight;
+        bool is_active;
+    };
+
+    // Marks a slot that no server holds. A table without any active servers is left empty.
+    static constexpr std::uint32_t empty_slot = UINT32_MAX;
+
+    explicit MaglevTable(const std::vector<Backend> &backends);
+
+    // Copies the table, handing the given servers' slots to the ones that are left. No other slot changes hands.
+    [[nodiscard]] MaglevTable without(const std::vector<std::size_t> &removed) const;
+
+    // Returns the index of the server holding the slot the hash lands on, offset by the given number of slots.
+    [[nodiscard]] inline std::uint32_t lookup(std::uint64_t hash, std::size_t offset = 0) const {
+        return _slots[(hash + offset) % _slots.size()];
+    }
+
+    [[nodiscard]] inline bool isActive(std::size_t backend) const { return _backends[backend].is_active; }
+    [[nodiscard]] inline std::size_t backendCount() const { return _backends.size(); }
+    [[nodiscard]] inline bool isEmpty() const { return _slots.front() == empty_slot; }
+
+private:
+    struct Permutation {
+        std::uint64_t offset;
+        std::uint64_t skip;
+        std::uint64_t next = 0; // How far into the permutation the server has claimed slots
+        int weight;
+        bool is_active;
+    };
+
+    // Has active servers take turns claiming free slots until none are left.
+    void fill(std::size_t filled);
+
+private:
+    std::vector<Permutation> _backends;
+    std::vector<std::uint32_t> _slots;
+};
+
+} // namespace ls
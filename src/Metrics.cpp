@@ -0,0 +1,134 @@
+#include "Metrics.hpp"
+#include <algorithm>
+#include <sstream>
+#include "LoadBalancer.hpp"
+
+namespace ls {
+
+Metrics::Shard::Shard(std::size_t backends) {
+    for (std::size_t i = 0; i < backends; i++) { _backends.push_back(std::make_unique<Backend>()); }
+}
+
+void Metrics::Shard::recordTransaction(std::size_t backend, bool is_success, std::chrono::nanoseconds latency,
+                                       std::uint64_t bytes_sent, std::uint64_t bytes_received) {
+    if (backend >= _backends.size()) { return; }
+
+    auto &counters = *_backends[backend];
+    addOwned(counters.requests, 1);
+    if (!is_success) { addOwned(counters.errors, 1); }
+    addOwned(counters.bytes_sent, bytes_sent);
+    addOwned(counters.bytes_received, bytes_received);
+    if (is_success) { counters.latency.record(latency); }
+}
+
+void Metrics::Shard::recordRelayed(std::size_t backend, std::uint64_t bytes) {
+    if (backend >= _backends.size()) { return; }
+    addOwned(_backends[backend]->bytes_received, bytes);
+}
+
+void Metrics::Shard::recordResponse(std::chrono::nanoseconds latency) {
+    _responses.record(latency);
+}
+
+Metrics::Metrics(std::size_t workers, std::size_t backends) {
+    for (std::size_t i = 0; i < workers; i++) { _shards.push_back(std::make_unique<Shard>(backends)); }
+}
+
+// Writes out the histograms as one, with the labels (if any) added to every line
+static void renderHistogram(std::ostringstream &out, const std::string &name, const std::string &labels,
+                            const std::vector<const LatencyHistogram *> &histograms) {
+    std::uint64_t count = 0;
+    std::uint64_t sum_us = 0;
+    for (const auto *histogram : histograms) {
+        count += histogram->count();
+        sum_us += histogram->sumMicroseconds();
+    }
+
+    const auto separator = labels.empty() ? "" : ",";
+    for (const auto bound : Metrics::exported_bounds) {
+        std::uint64_t at_most = 0;
+        const auto bound_us = static_cast<std::uint64_t>(bound * 1e6);
+        for (const auto *histogram : histograms) { at_most += histogram->countAtMost(bound_us); }
+
+        // Shards are read while they're written to, so a bucket could otherwise come out ahead of the count
+        out << name << "_bucket{" << labels << separator << "le=\"" << bound << "\"} " << std::min(at_most, count)
+            << "\n";
+    }
+    out << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << count << "\n";
+    out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " " << static_cast<double>(sum_us) / 1e6
+        << "\n";
+    out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << count << "\n";
+}
+
+std::string Metrics::render(const std::vector<std::shared_ptr<Connection>> &connections) const {
+    std::ostringstream out;
+
+    const auto labels_of = [](const Connection &connection) {
+        return "server=\"" + std::to_string(connection.metadata.id) + "\",address=\"" + connection.client.address() +
+            "\"";
+    };
+    const auto sum_of = [this](std::size_t backend, std::atomic_uint64_t Backend::*counter) {
+        std::uint64_t sum = 0;
+        for (const auto &shard : _shards) {
+            if (backend < shard->_backends.size()) {
+                sum += ((*shard->_backends[backend]).*counter).load(std::memory_order_relaxed);
+            }
+        }
+        return sum;
+    };
+
+    const auto render_counter = [&](const char *name, const char *help, std::atomic_uint64_t Backend::*counter) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n";
+        for (const auto &connection : connections) {
+            out << name << "{" << labels_of(*connection) << "} " << sum_of(connection->index, counter) << "\n";
+        }
+    };
+    render_counter("lb_server_requests_total", "Transactions finished with the server.", &Backend::requests);
+    render_counter("lb_server_errors_total", "Transactions with the server that failed or got a server error.",
+                  &Backend::errors);
+    render_counter("lb_server_sent_bytes_total", "Request bytes sent to the server.", &Backend::bytes_sent);
+    render_counter("lb_server_received_bytes_total", "Response bytes read from the server.", &Backend::bytes_received);
+
+    out << "# HELP lb_server_in_flight Transactions in progress with the server.\n"
+        << "# TYPE lb_server_in_flight gauge\n";
+    for (const auto &connection : connections) {
+        out << "lb_server_in_flight{" << labels_of(*connection) << "} "
+            << connection->ongoing_transactions.load(std::memory_order_relaxed) << "\n";
+    }
+
+    out << "# HELP lb_server_up Whether the server is passing its health checks.\n"
+        << "# TYPE lb_server_up gauge\n";
+    for (const auto &connection : connections) {
+        out << "lb_server_up{" << labels_of(*connection) << "} "
+            << (connection->is_inactive.load(std::memory_order_relaxed) ? 0 : 1) << "\n";
+    }
+
+    out << "# HELP lb_server_ejected Whether the server is ejected as an outlier.\n"
+        << "# TYPE lb_server_ejected gauge\n";
+    for (const auto &connection : connections) {
+        const bool is_ejected = connection->breaker.state() != CircuitBreaker::State::CLOSED;
+        out << "lb_server_ejected{" << labels_of(*connection) << "} " << (is_ejected ? 1 : 0) << "\n";
+    }
+
+    out << "# HELP lb_server_latency_seconds How long the server took to answer, for transactions that succeeded.\n"
+        << "# TYPE lb_server_latency_seconds histogram\n";
+    for (const auto &connection : connections) {
+        std::vector<const LatencyHistogram *> histograms;
+        for (const auto &shard : _shards) {
+            if (connection->index < shard->_backends.size()) {
+                histograms.push_back(&shard->_backends[connection->index]->latency);
+            }
+        }
+        renderHistogram(out, "lb_server_latency_seconds", labels_of(*connection), histograms);
+    }
+
+    out << "# HELP lb_request_duration_seconds How long clients waited on a response, from their request arriving.\n"
+        << "# TYPE lb_request_duration_seconds histogram\n";
+    std::vector<const LatencyHistogram *> histograms;
+    for (const auto &shard : _shards) { histograms.push_back(&shard->_responses); }
+    renderHistogram(out, "lb_request_duration_seconds", "", histograms);
+
+    return out.str();
+}
+
+} // namespace ls
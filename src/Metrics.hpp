@@ -0,0 +1,73 @@
+// Counters and latency histograms for the balancer and each of its servers, served in the Prometheus text format.
+//
+// Every worker records into a shard of its own, which no other thread writes to, so recording never takes a lock or
+// contends over a cache line with another worker. Shards are only added together when the metrics are scraped. Whether
+// a server is up and how many transactions it has in progress are already kept on its connection, so they're read
+// from there at scrape time instead of being recorded twice.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "LatencyHistogram.hpp"
+
+namespace ls {
+
+struct Connection;
+
+class Metrics {
+public:
+    // What one worker has seen of one server.
+    struct Backend {
+        std::atomic_uint64_t requests = 0;
+        std::atomic_uint64_t errors = 0;         // Transactions that failed, or were answered with a server error
+        std::atomic_uint64_t bytes_sent = 0;     // Request bytes sent to the server
+        std::atomic_uint64_t bytes_received = 0; // Response bytes read from the server, relayed bodies included
+        LatencyHistogram latency;
+    };
+
+    // Everything recorded by one worker. Only ever written to by that worker.
+    class Shard {
+    public:
+        explicit Shard(std::size_t backends);
+
+        // Records a finished transaction with the server at the given index.
+        void recordTransaction(std::size_t backend, bool is_success, std::chrono::nanoseconds latency,
+                               std::uint64_t bytes_sent, std::uint64_t bytes_received);
+
+        // Records body bytes relayed from the server after its transaction finished.
+        void recordRelayed(std::size_t backend, std::uint64_t bytes);
+
+        // Records a response sent back to a client, however it was come by.
+        void recordResponse(std::chrono::nanoseconds latency);
+
+    private:
+        friend class Metrics;
+
+        std::vector<std::unique_ptr<Backend>> _backends;
+        LatencyHistogram _responses;
+    };
+
+    // Upper bounds of the histogram buckets that are exported, in seconds.
+    static constexpr std::array<double, 14> exported_bounds{0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                                             0.1,    0.25,  0.5,    1,     2.5,   5,    10};
+
+    // Sets up a shard for each worker, with room for each of the servers. Servers have to be added before this.
+    Metrics(std::size_t workers, std::size_t backends);
+
+    [[nodiscard]] inline Shard &shard(std::size_t worker) { return *_shards[worker]; }
+
+    // Adds up every shard, writing them out in the Prometheus text exposition format.
+    [[nodiscard]] std::string render(const std::vector<std::shared_ptr<Connection>> &connections) const;
+
+private:
+    std::vector<std::unique_ptr<Shard>> _shards;
+};
+
+} // namespace ls
@@ -0,0 +1,92 @@
+#include "OutlierDetector.hpp"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include "LoadBalancer.hpp"
+#include "Log.hpp"
+
+namespace ls {
+
+// How many transactions a server needs over the window before it's judged, so a single unlucky request can't eject it
+static constexpr std::uint64_t min_judged_transactions = 10;
+
+OutlierDetector::OutlierDetector(Settings settings) : _settings(settings) {}
+
+void OutlierDetector::evaluate(const std::vector<std::shared_ptr<Connection>> &connections, clock::time_point now) {
+    if (!_settings.isEnabled()) { return; }
+
+    std::size_t ejected = 0;
+    for (const auto &connection : connections) {
+        if (connection->breaker.update(now)) {
+            std::cerr << out::info << "Letting the ejected server " << connection->metadata.id
+                      << " back in for a trial request...\n";
+        }
+        if (connection->breaker.state() != CircuitBreaker::State::CLOSED) { ejected++; }
+    }
+
+    // At least one server can always be ejected, as long as it isn't the only one (and ejecting is turned on at all)
+    const auto count = connections.size();
+    const auto percent = static_cast<std::size_t>(_settings.max_ejected_percent);
+    const auto allowed = std::max<std::size_t>(1, count * percent / 100);
+    const auto max_ejected = count <= 1 || percent == 0 ? 0 : std::min(count - 1, allowed);
+    if (ejected >= max_ejected) { return; }
+
+    struct Judged {
+        Connection *connection;
+        CircuitBreaker::Window window;
+    };
+
+    std::vector<Judged> judged;
+    std::vector<double> latencies;
+    for (const auto &connection : connections) {
+        if (connection->is_inactive.load(std::memory_order_relaxed)) { continue; }
+        if (connection->breaker.state() != CircuitBreaker::State::CLOSED) { continue; }
+
+        const auto window = connection->breaker.window(now);
+        if (window.transactions < min_judged_transactions) { continue; }
+        judged.push_back({.connection = connection.get(), .window = window});
+        if (window.transactions > window.errors) { latencies.push_back(window.meanLatency()); }
+    }
+    if (judged.empty()) { return; }
+
+    // The lower median is used, so that with two servers, the slower one is compared against the faster one
+    double usual_latency = 0;
+    if (!latencies.empty()) {
+        const auto middle = latencies.begin() + static_cast<std::ptrdiff_t>((latencies.size() - 1) / 2);
+        std::nth_element(latencies.begin(), middle, latencies.end());
+        usual_latency = *middle;
+    }
+
+    const auto isErrorOutlier = [this](const CircuitBreaker::Window &window) {
+        return _settings.error_percent > 0 && window.errorRate() * 100 >= _settings.error_percent;
+    };
+    const auto isLatencyOutlier = [this, usual_latency](const CircuitBreaker::Window &window) {
+        return _settings.latency_factor > 0 && usual_latency > 0 &&
+            window.meanLatency() > usual_latency * _settings.latency_factor;
+    };
+
+    std::vector<Judged> outliers;
+    std::copy_if(judged.begin(), judged.end(), std::back_inserter(outliers), [&](const Judged &server) {
+        return isErrorOutlier(server.window) || isLatencyOutlier(server.window);
+    });
+
+    // When there are more outliers than can be ejected, the worst of them go first
+    std::sort(outliers.begin(), outliers.end(), [](const Judged &a, const Judged &b) {
+        if (a.window.errorRate() != b.window.errorRate()) { return a.window.errorRate() > b.window.errorRate(); }
+        return a.window.meanLatency() > b.window.meanLatency();
+    });
+
+    for (const auto &[connection, window] : outliers) {
+        if (ejected >= max_ejected) { break; }
+
+        const auto time = connection->breaker.eject(now, _settings.ejection_time, _settings.max_ejection_time);
+        ejected++;
+        std::cerr << out::info << "The server " << connection->metadata.id << " failed "
+                  << static_cast<int>(window.errorRate() * 100) << "% of its transactions, taking "
+                  << static_cast<long long>(window.meanLatency() / 1e6) << " ms on average (usually "
+                  << static_cast<long long>(usual_latency / 1e6) << " ms). Ejecting it for "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms...\n";
+    }
+}
+
+} // namespace ls
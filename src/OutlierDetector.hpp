@@ -0,0 +1,46 @@
+// Passively picks out servers that are handling real transactions much worse than the rest, and ejects them through
+// their circuit breakers. Active health checks only ask whether a server answers at all, so a server that answers
+// checks but fails (or drags out) real requests would otherwise keep getting its share of them.
+//
+// A server is an outlier when too many of its transactions over the breaker's window failed, or when the transactions
+// that succeeded took much longer than is usual across the servers. Only so many servers are ever ejected at once, so a
+// problem shared by every server can't empty the pool.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "CircuitBreaker.hpp"
+
+namespace ls {
+
+struct Connection;
+
+class OutlierDetector {
+public:
+    using clock = CircuitBreaker::clock;
+
+    struct Settings {
+        int error_percent;                 // Failed transactions (as a percentage) that eject a server, or 0 to never
+        int latency_factor;                // How many times slower than usual a server is before it's ejected, or 0
+        int max_ejected_percent;           // The most servers (as a percentage) that are ejected at once, or 0 to never
+        clock::duration ejection_time;     // How long a server is first ejected for
+        clock::duration max_ejection_time; // How long a server can be ejected for, however many times it's been ejected
+
+    public:
+        [[nodiscard]] inline bool isEnabled() const {
+            return (error_percent > 0 || latency_factor > 0) && max_ejected_percent > 0;
+        }
+    };
+
+    explicit OutlierDetector(Settings settings);
+
+    // Lets back in servers whose ejections are up, then ejects any new outliers. Only ever called from one thread.
+    void evaluate(const std::vector<std::shared_ptr<Connection>> &connections, clock::time_point now = clock::now());
+
+private:
+    const Settings _settings;
+};
+
+} // namespace ls
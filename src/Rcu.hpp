@@ -0,0 +1,107 @@
+// A read-copy-update cell, holding a value that's read far more often than it changes. Readers get at the current
+// value with a single atomic load, without taking any locks or touching any shared counters. Writers copy the value,
+// change the copy, and swap it in, keeping the old value around until every reader is known to be done with it.
+//
+// Readers find out they're done through quiescent-state-based reclamation. Each reader has a slot, and calls quiescent
+// whenever it isn't holding on to anything it read (like between turns of its event loop). A value that was swapped out
+// can be freed once every reader has called quiescent since the swap.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace ls {
+
+template <typename T>
+class Rcu {
+public:
+    explicit Rcu(T initial) : _current(new T(std::move(initial))) {}
+
+    ~Rcu() {
+        delete _current.load();
+        for (auto &retired : _retired) { delete retired.value; }
+    }
+
+    // No copying or moving a cell, readers hold on to pointers into it
+    Rcu(Rcu &) = delete;
+    Rcu operator=(Rcu &) = delete;
+    Rcu(Rcu &&) = delete;
+    Rcu &operator=(Rcu &&) = delete;
+
+    // Sets up a slot for each reader. This has to be called before any reader starts.
+    void useReaders(std::size_t readers) {
+        _readers = std::make_unique<Reader[]>(readers);
+        _reader_count = readers;
+        for (std::size_t i = 0; i < readers; i++) { _readers[i].seen.store(_epoch.load()); }
+    }
+
+    // The value read stays valid until the reading thread's next call to quiescent.
+    [[nodiscard]] inline const T &read() const { return *_current.load(std::memory_order_acquire); }
+
+    // Marks that the reader isn't holding on to anything it read.
+    inline void quiescent(std::size_t reader) {
+        _readers[reader].seen.store(_epoch.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    // Swaps in a copy of the current value, after it's been passed to change.
+    template <typename Change>
+    void update(Change change) {
+        std::scoped_lock lock{_writer_mutex};
+
+        auto next = std::make_unique<T>(*_current.load());
+        change(*next);
+        T *previous = _current.exchange(next.release(), std::memory_order_acq_rel);
+
+        // Readers that see this epoch (or a later one) have already moved on from the previous value
+        _retired.push_back({_epoch.fetch_add(1) + 1, previous});
+        reclaimRetired();
+    }
+
+    // Frees the values that no reader can still be holding on to.
+    void reclaim() {
+        std::scoped_lock lock{_writer_mutex};
+        reclaimRetired();
+    }
+
+private:
+    struct alignas(64) Reader {
+        std::atomic_uint64_t seen = 0;
+    };
+
+    struct Retired {
+        std::uint64_t epoch;
+        T *value;
+    };
+
+    void reclaimRetired() {
+        std::uint64_t oldest_seen = std::numeric_limits<std::uint64_t>::max();
+        for (std::size_t i = 0; i < _reader_count; i++) {
+            oldest_seen = std::min(oldest_seen, _readers[i].seen.load());
+        }
+
+        const auto is_freeable = [oldest_seen](const Retired &retired) { return retired.epoch <= oldest_seen; };
+        for (auto &retired : _retired) {
+            if (is_freeable(retired)) { delete retired.value; }
+        }
+        _retired.erase(std::remove_if(_retired.begin(), _retired.end(), is_freeable), _retired.end());
+    }
+
+private:
+    std::atomic<T *> _current;
+    std::atomic_uint64_t _epoch = 1;
+    std::unique_ptr<Reader[]> _readers;
+    std::size_t _reader_count = 0;
+
+    std::mutex _writer_mutex; // Writers take turns, readers never wait on it
+    std::vector<Retired> _retired;
+};
+
+} // namespace ls
@@ -0,0 +1,118 @@
+#include "Relay.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <limits>
+#include <string_view>
+#include <unistd.h>
+#include "Log.hpp"
+
+namespace ls {
+
+Relay::Relay(sockets::Socket source, std::uint64_t length, bool is_keep_alive, Finished on_finished) :
+    _source(std::move(source)), _on_finished(std::move(on_finished)), _remaining(length),
+    _is_keep_alive(is_keep_alive) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        std::cerr << out::err << "Failed to create a pipe to relay through: " << std::strerror(errno) << "\n";
+        return;
+    }
+
+    _pipe_read.emplace(pipe_fds[0], "relay pipe");
+    _pipe_write.emplace(pipe_fds[1], "relay pipe");
+}
+
+Relay::Relay(sockets::Socket source, http::Parser parser, std::string received, Finished on_finished) :
+    _source(std::move(source)), _on_finished(std::move(on_finished)), _parser(std::move(parser)),
+    _received(std::move(received)) {
+    _parser->discard(_parser->length());
+}
+
+Relay::~Relay() {
+    // Anything left unsent on the source would be read as the start of the next response
+    _on_finished(std::move(_source), _is_reusable);
+}
+
+sockets::IoStatus Relay::pump(const sockets::Socket &destination) {
+    return _parser.has_value() ? copy(destination) : splice(destination);
+}
+
+sockets::IoStatus Relay::splice(const sockets::Socket &destination) {
+    using sockets::IoStatus;
+    if (!_pipe_read.has_value()) { return IoStatus::FAILED; }
+
+    constexpr auto max_splice = static_cast<std::uint64_t>(std::numeric_limits<int>::max());
+    constexpr unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    while (true) {
+        // The pipe is drained before reading more, so it never holds more than its capacity
+        if (_in_pipe > 0) {
+            const auto len = ::splice(_pipe_read->fd(), nullptr, destination.fd(), nullptr, _in_pipe, flags);
+            if (len < 0) {
+                if (errno == EINTR) { continue; }
+                return errno == EAGAIN ? IoStatus::PENDING : IoStatus::FAILED;
+            }
+            _in_pipe -= len;
+            if (_on_progress) { _on_progress(len); }
+            continue;
+        }
+
+        if (_remaining == 0) {
+            _is_reusable = _is_keep_alive;
+            return IoStatus::COMPLETE;
+        }
+
+        const auto len =
+            ::splice(_source.fd(), nullptr, _pipe_write->fd(), nullptr, std::min(_remaining, max_splice), flags);
+        if (len == 0) { return IoStatus::CLOSED; }
+        if (len < 0) {
+            if (errno == EINTR) { continue; }
+            return errno == EAGAIN ? IoStatus::PENDING : IoStatus::FAILED;
+        }
+        _remaining -= len;
+        _in_pipe += len;
+    }
+}
+
+sockets::IoStatus Relay::copy(const sockets::Socket &destination) {
+    using sockets::IoStatus;
+    using http::Parser;
+
+    while (true) {
+        // Only what's been parsed is sent, the rest may be the start of a line the parser hasn't seen the end of
+        if (_sent < _parser->length()) {
+            const auto parsed = std::string_view(_received).substr(0, _parser->length());
+            const auto status = sockets::transmit(destination, parsed, _sent);
+            if (status != IoStatus::COMPLETE) { return status; }
+        }
+
+        if (_on_progress && _sent > 0) { _on_progress(_sent); }
+        _received.erase(0, _sent);
+        _parser->discard(_sent);
+        _sent = 0;
+
+        if (_parser->status() == Parser::Status::COMPLETE) { return IoStatus::COMPLETE; }
+
+        // Nothing more is read until everything read so far is sent, which holds back servers faster than the client
+        const auto status = sockets::collect(_source, _received, _received.length() + max_copied);
+        if (status == IoStatus::FAILED) { return status; }
+
+        auto parsed = _parser->parse(_received);
+        if (parsed == Parser::Status::INCOMPLETE && status == IoStatus::CLOSED) { parsed = _parser->finish(); }
+        if (parsed == Parser::Status::INVALID) {
+            return status == IoStatus::CLOSED ? IoStatus::CLOSED : IoStatus::FAILED;
+        }
+
+        if (parsed == Parser::Status::COMPLETE) {
+            // Only connections that are left with nothing unread in them can be handed to another transaction
+            _is_reusable = status == IoStatus::PENDING && _parser->length() == _received.length() &&
+                _parser->isKeepAlive();
+        } else if (status == IoStatus::PENDING && _parser->length() == 0) {
+            return IoStatus::PENDING;
+        }
+    }
+}
+
+} // namespace ls
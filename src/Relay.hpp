@@ -0,0 +1,80 @@
+// A relay moves the rest of a response from a backing server's socket to a client's socket, once the response's headers
+// have been read, so the client starts getting the response before the whole of it has arrived.
+//
+// Bodies with a known length are spliced through a pipe, so they stay in the kernel the whole way and never have to be
+// copied into (or held in) the balancer's memory. Other bodies (chunked ones, or ones that run until the connection
+// closes) are copied through a small buffer instead, as the parser has to see them to find where they end.
+//
+// Either way, nothing more is read from the server until what's already been read is sent on to the client, so a slow
+// client holds back the server instead of having the response pile up in the balancer.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include "FileDescriptor.hpp"
+#include "HttpParser.hpp"
+#include "Sockets.hpp"
+
+namespace ls {
+
+class Relay {
+public:
+    // Called once the relay is done with the source socket, with whether it can be used for another request.
+    using Finished = std::function<void(sockets::Socket source, bool is_reusable)>;
+
+    // Called with however many bytes of the body were just sent on to the destination.
+    using Progress = std::function<void(std::uint64_t bytes)>;
+
+    // Splices the next length bytes of the source.
+    Relay(sockets::Socket source, std::uint64_t length, bool is_keep_alive, Finished on_finished);
+    // Copies the rest of a message that the parser has started on. Received holds whatever was read past the bytes the
+    // parser has parsed, and the parser is moved along to start at it.
+    Relay(sockets::Socket source, http::Parser parser, std::string received, Finished on_finished);
+    ~Relay();
+
+    // No copying or moving a relay, the source socket is only handed back once
+    Relay(Relay &) = delete;
+    Relay operator=(Relay &) = delete;
+    Relay(Relay &&) = delete;
+    Relay &operator=(Relay &&) = delete;
+
+    // Moves as much of the body as possible to the destination socket. Both sockets have to be non-blocking.
+    // - COMPLETE: The whole body was sent
+    // - PENDING: One of the sockets would block, pump again once either becomes ready
+    // - CLOSED: The source closed before sending the whole body
+    // - FAILED: Either socket (or the pipe) errored out, or the source sent something that wasn't HTTP
+    [[nodiscard]] sockets::IoStatus pump(const sockets::Socket &destination);
+
+    [[nodiscard]] inline int source() const { return _source.fd(); }
+    inline void onProgress(Progress on_progress) { _on_progress = std::move(on_progress); }
+
+private:
+    // Copied bodies are read this much at a time
+    static constexpr std::size_t max_copied = 64 * 1024;
+
+    sockets::IoStatus splice(const sockets::Socket &destination);
+    sockets::IoStatus copy(const sockets::Socket &destination);
+
+private:
+    sockets::Socket _source;
+    const Finished _on_finished;
+    Progress _on_progress;
+    bool _is_reusable = false;
+
+    // Spliced bodies
+    std::optional<FileDescriptor> _pipe_read;
+    std::optional<FileDescriptor> _pipe_write;
+    std::uint64_t _remaining = 0; // Bytes still to be read from the source
+    std::uint64_t _in_pipe = 0;   // Bytes read from the source, but not yet written to the destination
+    bool _is_keep_alive = false;
+
+    // Copied bodies
+    std::optional<http::Parser> _parser;
+    std::string _received;
+    std::size_t _sent = 0;
+};
+
+} // namespace ls
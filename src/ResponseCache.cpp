@@ -0,0 +1,300 @@
+#include "ResponseCache.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <ctime>
+#include <functional>
+#include "HttpParser.hpp"
+
+namespace ls {
+
+static std::string_view trim(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) { value.remove_prefix(1); }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) { value.remove_suffix(1); }
+    return value;
+}
+
+// Calls visit with each trimmed, non-empty item of a comma-separated header value.
+template <typename Visit>
+static void forEachItem(std::string_view list, Visit visit) {
+    while (!list.empty()) {
+        const auto comma = list.find(',');
+        const auto item = trim(list.substr(0, comma));
+        if (!item.empty()) { visit(item); }
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+    }
+}
+
+// Finds a Cache-Control directive, returning its argument (which is empty for directives without one).
+static std::optional<std::string_view> findDirective(std::string_view cache_control, std::string_view name) {
+    std::optional<std::string_view> found;
+    forEachItem(cache_control, [&](std::string_view item) {
+        const auto equals = item.find('=');
+        if (found.has_value() || !http::equalsIgnoreCase(trim(item.substr(0, equals)), name)) { return; }
+
+        auto argument = equals == std::string_view::npos ? std::string_view{} : trim(item.substr(equals + 1));
+        if (argument.size() >= 2 && argument.front() == '"' && argument.back() == '"') {
+            argument = argument.substr(1, argument.size() - 2);
+        }
+        found = argument;
+    });
+    return found;
+}
+
+static std::optional<std::int64_t> parseSeconds(std::string_view value) {
+    std::int64_t seconds = 0;
+    const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), seconds);
+    if (error != std::errc() || end != value.data() + value.size() || seconds < 0) { return std::nullopt; }
+    return seconds;
+}
+
+// Parses an HTTP date in its preferred format (like "Sun, 06 Nov 1994 08:49:37 GMT").
+static std::optional<std::time_t> parseDate(const std::string &value) {
+    std::tm parsed{};
+    const char *end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parsed);
+    if (end == nullptr || *end != '\0') { return std::nullopt; }
+    return timegm(&parsed);
+}
+
+// Returns the part of a request that identifies what it's asking for, or nothing if it's not a GET request. Everything
+// up to the target is kept, since the target alone doesn't say which host it's on.
+static std::optional<std::string> findBaseKey(std::string_view request) {
+    auto line = request.substr(0, request.find('\n'));
+    if (!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+    const auto method_end = line.find(' ');
+    if (line.substr(0, method_end) != "GET") { return std::nullopt; }
+
+    const auto target_start = method_end + 1;
+    const auto target_end = line.find(' ', target_start);
+    if (target_end == std::string_view::npos) { return std::nullopt; }
+
+    const auto host = http::findHeader(request, "Host").value_or("");
+    return "GET " + host + std::string(line.substr(target_start, target_end - target_start));
+}
+
+// Requests that carry credentials, or that ask not to be answered from a cache, always go to a server.
+static bool isCacheableRequest(std::string_view request) {
+    if (http::findHeader(request, "Authorization").has_value()) { return false; }
+
+    if (const auto pragma = http::findHeader(request, "Pragma"); pragma.has_value()) {
+        if (http::containsIgnoreCase(*pragma, "no-cache")) { return false; }
+    }
+
+    const auto cache_control = http::findHeader(request, "Cache-Control");
+    if (!cache_control.has_value()) { return true; }
+
+    const auto max_age = findDirective(*cache_control, "max-age");
+    return !findDirective(*cache_control, "no-store").has_value() &&
+           !findDirective(*cache_control, "no-cache").has_value() && (!max_age.has_value() || *max_age != "0");
+}
+
+static std::string findVariantKey(const std::string &base_key, const std::vector<std::string> &vary,
+                                  std::string_view request) {
+    auto key = base_key;
+    for (const auto &name : vary) {
+        key += '\n';
+        key += name;
+        key += ':';
+        key += http::findHeader(request, name).value_or("");
+    }
+    return key;
+}
+
+static bool isCacheableStatus(int code) {
+    // Responses that are complete in themselves, and that don't depend on anything but the request
+    switch (code) {
+    case 200:
+    case 203:
+    case 204:
+    case 300:
+    case 301:
+    case 308:
+    case 404:
+    case 405:
+    case 410:
+    case 501: return true;
+    default: return false;
+    }
+}
+
+// Copies the response without the headers that only apply to the connection it came in on, or that go stale.
+static std::string withoutTransientHeaders(std::string_view response, std::size_t headers_length) {
+    static constexpr std::string_view transient[] = {"Connection", "Keep-Alive", "Proxy-Connection", "Age"};
+
+    std::string stripped;
+    stripped.reserve(response.size());
+
+    // Lines end with CRLF or a lone LF, just as the parser allows
+    std::size_t line_start = 0;
+    while (line_start < headers_length) {
+        const auto newline = response.find('\n', line_start);
+        const auto line_end = newline < headers_length ? newline + 1 : headers_length;
+        const auto line = response.substr(line_start, line_end - line_start);
+        const auto name = trim(line.substr(0, line.find(':')));
+
+        const bool is_transient = line_start != 0 && std::any_of(std::begin(transient), std::end(transient),
+                                                                 [&](auto header) {
+                                                                     return http::equalsIgnoreCase(name, header);
+                                                                 });
+        if (!is_transient) { stripped += line; }
+        line_start = line_end;
+    }
+
+    stripped += response.substr(headers_length);
+    return stripped;
+}
+
+ResponseCache::ResponseCache(std::size_t max_bytes, std::size_t shards) :
+    _shard_bytes(max_bytes / std::max<std::size_t>(shards, 1)) {
+    for (std::size_t i = 0; i < std::max<std::size_t>(shards, 1); i++) { _shards.push_back(std::make_unique<Shard>()); }
+}
+
+std::optional<std::string> ResponseCache::lookup(std::string_view request) {
+    const auto base_key = findBaseKey(request);
+    if (!base_key.has_value()) { return std::nullopt; }
+
+    if (!isCacheableRequest(request)) {
+        _misses++;
+        return std::nullopt;
+    }
+
+    auto &shard = shardFor(*base_key);
+    std::scoped_lock lock{shard.mutex};
+
+    const auto variants = shard.variants.find(*base_key);
+    if (variants == shard.variants.end()) {
+        _misses++;
+        return std::nullopt;
+    }
+
+    const auto key = findVariantKey(*base_key, variants->second.vary, request);
+    const auto found = shard.index.find(key);
+    if (found == shard.index.end()) {
+        _misses++;
+        return std::nullopt;
+    }
+
+    const auto entry = found->second;
+    const auto age = entry->initial_age + (clock::now() - entry->stored);
+    if (age >= entry->lifetime) {
+        erase(shard, entry);
+        _misses++;
+        return std::nullopt;
+    }
+
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    _hits++;
+
+    // Clients are told how long the response has been cached, right after the status line
+    const auto status_end = std::min(entry->response.find('\n'), entry->response.size() - 1) + 1;
+    const auto age_seconds = std::chrono::duration_cast<std::chrono::seconds>(age).count();
+    auto response = entry->response.substr(0, status_end);
+    response += "Age: " + std::to_string(age_seconds) + "\r\n";
+    response.append(entry->response, status_end);
+    return response;
+}
+
+void ResponseCache::store(std::string_view request, std::string_view response) {
+    auto base_key = findBaseKey(request);
+    if (!base_key.has_value() || !isCacheableRequest(request)) { return; }
+    if (response.size() > _shard_bytes) { return; }
+
+    // Only whole responses with their length known up front can be sent again as-is
+    http::Parser parser{http::Parser::Kind::RESPONSE};
+    if (parser.parse(response) != http::Parser::Status::COMPLETE || parser.length() != response.size()) { return; }
+    if (!isCacheableStatus(parser.code())) { return; }
+
+    const auto headers = response.substr(0, parser.headersLength());
+    if (http::findHeader(headers, "Set-Cookie").has_value()) { return; }
+
+    // Finds out how long the response stays fresh, preferring the limits meant for shared caches like this one
+    std::optional<std::int64_t> lifetime_seconds;
+    const auto cache_control = http::findHeader(headers, "Cache-Control").value_or("");
+    if (findDirective(cache_control, "no-store").has_value() || findDirective(cache_control, "no-cache").has_value() ||
+        findDirective(cache_control, "private").has_value()) {
+        return;
+    }
+
+    if (const auto s_maxage = findDirective(cache_control, "s-maxage"); s_maxage.has_value()) {
+        lifetime_seconds = parseSeconds(*s_maxage);
+    } else if (const auto max_age = findDirective(cache_control, "max-age"); max_age.has_value()) {
+        lifetime_seconds = parseSeconds(*max_age);
+    } else if (const auto expires = http::findHeader(headers, "Expires"); expires.has_value()) {
+        const auto expires_at = parseDate(*expires);
+        const auto date = http::findHeader(headers, "Date");
+        const auto now = date.has_value() ? parseDate(*date) : std::time(nullptr);
+        if (expires_at.has_value() && now.has_value()) { lifetime_seconds = *expires_at - *now; }
+    }
+    if (!lifetime_seconds.has_value() || *lifetime_seconds <= 0) { return; }
+
+    const auto age_seconds = parseSeconds(http::findHeader(headers, "Age").value_or("0")).value_or(0);
+    if (age_seconds >= *lifetime_seconds) { return; }
+
+    std::vector<std::string> vary;
+    bool is_vary_any = false;
+    forEachItem(http::findHeader(headers, "Vary").value_or(""), [&](std::string_view name) {
+        if (name == "*") { is_vary_any = true; }
+        std::string lowered(name);
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        vary.push_back(std::move(lowered));
+    });
+    if (is_vary_any) { return; }
+
+    auto &shard = shardFor(*base_key);
+    std::scoped_lock lock{shard.mutex};
+
+    // Variants stored under an older set of varying headers can't be found anymore, and are left to be evicted
+    auto key = findVariantKey(*base_key, vary, request);
+    if (const auto found = shard.index.find(key); found != shard.index.end()) { erase(shard, found->second); }
+
+    auto &variants = shard.variants.try_emplace(*base_key, Variants{.vary = {}, .count = 0}).first->second;
+    variants.vary = std::move(vary);
+    variants.count++;
+
+    shard.entries.push_front({.key = std::move(key),
+                              .base_key = std::move(*base_key),
+                              .response = withoutTransientHeaders(response, parser.headersLength()),
+                              .stored = clock::now(),
+                              .initial_age = std::chrono::seconds(age_seconds),
+                              .lifetime = std::chrono::seconds(*lifetime_seconds)});
+    const auto &entry = shard.entries.front();
+    shard.index.emplace(entry.key, shard.entries.begin());
+    shard.bytes += entry.key.size() + entry.base_key.size() + entry.response.size();
+    _stores++;
+
+    while (shard.bytes > _shard_bytes) {
+        erase(shard, std::prev(shard.entries.end()));
+        _evictions++;
+    }
+}
+
+ResponseCache::Stats ResponseCache::stats() const {
+    std::size_t bytes = 0;
+    for (const auto &shard : _shards) {
+        std::scoped_lock lock{shard->mutex};
+        bytes += shard->bytes;
+    }
+
+    return {.hits = _hits.load(),
+            .misses = _misses.load(),
+            .stores = _stores.load(),
+            .evictions = _evictions.load(),
+            .bytes = bytes};
+}
+
+ResponseCache::Shard &ResponseCache::shardFor(const std::string &base_key) {
+    return *_shards[std::hash<std::string>{}(base_key) % _shards.size()];
+}
+
+void ResponseCache::erase(Shard &shard, std::list<Entry>::iterator entry) {
+    shard.bytes -= entry->key.size() + entry->base_key.size() + entry->response.size();
+    shard.index.erase(entry->key);
+
+    const auto variants = shard.variants.find(entry->base_key);
+    if (variants != shard.variants.end() && --variants->second.count == 0) { shard.variants.erase(variants); }
+
+    shard.entries.erase(entry);
+}
+
+} // namespace ls
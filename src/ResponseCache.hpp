@@ -0,0 +1,90 @@
+// An in-memory cache of server responses, answering repeated requests without going to a server at all. Only GET
+// requests are looked up, and only responses that say how long they stay fresh (through Cache-Control or Expires) are
+// stored. Responses that vary on request headers are stored once for each combination of those headers' values.
+//
+// The cache is split into shards, each with its own lock, least-recently-used list, and share of the byte budget, so
+// workers looking up different resources rarely wait on each other.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ls {
+
+class ResponseCache {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Stats {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t stores;
+        std::uint64_t evictions;
+        std::size_t bytes;
+    };
+
+    explicit ResponseCache(std::size_t max_bytes, std::size_t shards = 16);
+
+    // No copying or moving a cache, workers share it by reference
+    ResponseCache(ResponseCache &) = delete;
+    ResponseCache operator=(ResponseCache &) = delete;
+    ResponseCache(ResponseCache &&) = delete;
+    ResponseCache &operator=(ResponseCache &&) = delete;
+
+    // Returns a fresh response to the request, ready to be sent, or nothing if the request has to go to a server.
+    [[nodiscard]] std::optional<std::string> lookup(std::string_view request);
+
+    // Stores the server's complete response to the request, if the response allows it.
+    void store(std::string_view request, std::string_view response);
+
+    [[nodiscard]] Stats stats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::string base_key; // The key without any varying header values
+        std::string response; // Without hop-by-hop or Age headers
+        clock::time_point stored;
+        clock::duration initial_age;
+        clock::duration lifetime;
+    };
+
+    // The request headers that responses to a resource vary on, shared by every variant stored for it
+    struct Variants {
+        std::vector<std::string> vary;
+        std::size_t count;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> entries; // Most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+        std::unordered_map<std::string, Variants> variants;
+        std::size_t bytes = 0;
+    };
+
+    Shard &shardFor(const std::string &base_key);
+    void erase(Shard &shard, std::list<Entry>::iterator entry);
+
+private:
+    std::vector<std::unique_ptr<Shard>> _shards;
+    const std::size_t _shard_bytes;
+
+    std::atomic_uint64_t _hits = 0;
+    std::atomic_uint64_t _misses = 0;
+    std::atomic_uint64_t _stores = 0;
+    std::atomic_uint64_t _evictions = 0;
+};
+
+} // namespace ls
@@ -0,0 +1,42 @@
+#include "RetryBudget.hpp"
+#include <algorithm>
+
+namespace ls {
+
+// The budget starts out with a second's worth of retries, so the first failures after starting up can be retried
+RetryBudget::RetryBudget(Settings settings, clock::time_point now) :
+    _settings(settings), _balance(std::min<std::int64_t>(settings.min_per_second, max_saved) * token),
+    _replenished(now) {}
+
+void RetryBudget::recordRequest() {
+    deposit(_settings.percent * token / 100);
+}
+
+bool RetryBudget::tryRetry() {
+    auto balance = _balance.load(std::memory_order_relaxed);
+    while (balance >= token) {
+        if (_balance.compare_exchange_weak(balance, balance - token, std::memory_order_relaxed)) { return true; }
+    }
+    return false;
+}
+
+void RetryBudget::replenish(clock::time_point now) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _replenished).count();
+    const auto amount = _settings.min_per_second * token * elapsed / 1000;
+    if (amount <= 0) { return; }
+
+    // Whatever was too little to add is carried over to the next top up
+    _replenished += std::chrono::milliseconds(amount * 1000 / (_settings.min_per_second * token));
+    deposit(amount);
+}
+
+void RetryBudget::deposit(std::int64_t amount) {
+    // Workers deposit at the same time, so the balance is swapped in only if no one else changed it first
+    auto balance = _balance.load(std::memory_order_relaxed);
+    while (balance < max_saved * token) {
+        const auto next = std::min(balance + amount, max_saved * token);
+        if (_balance.compare_exchange_weak(balance, next, std::memory_order_relaxed)) { return; }
+    }
+}
+
+} // namespace ls
@@ -0,0 +1,63 @@
+// Caps how many retries (and hedged copies of requests) the balancer sends, as a share of the requests coming in. A
+// fixed number of retries per request lets an overloaded pool of servers be sent several times the traffic it was
+// failing to handle, so retries are paid for out of a budget instead.
+//
+// The budget is a bucket of tokens shared by every worker. Every request puts a fraction of a token into it, and every
+// retry takes a whole one out, so over time retries can't be more than that fraction of the traffic. The bucket is also
+// topped up at a steady rate, so a quiet balancer can still retry the odd failure.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace ls {
+
+class RetryBudget {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Settings {
+        int percent;        // Retries allowed, as a percentage of requests. 0 means retries aren't budgeted at all
+        int min_per_second; // Retries allowed every second, however few requests there are
+
+    public:
+        [[nodiscard]] inline bool isEnabled() const { return percent > 0; }
+    };
+
+    // The most retries that can be saved up, so a long quiet spell can't be spent all at once.
+    static constexpr std::int64_t max_saved = 100;
+
+    explicit RetryBudget(Settings settings, clock::time_point now = clock::now());
+
+    // No copying or moving a budget, it's shared by every worker
+    RetryBudget(RetryBudget &) = delete;
+    RetryBudget operator=(RetryBudget &) = delete;
+    RetryBudget(RetryBudget &&) = delete;
+    RetryBudget &operator=(RetryBudget &&) = delete;
+
+    // Called for every request the balancer accepts.
+    void recordRequest();
+
+    // Takes a retry out of the budget. Returns false, taking nothing, if the budget is spent.
+    [[nodiscard]] bool tryRetry();
+
+    // Adds the retries allowed every second since the last top up. Only ever called from one thread.
+    void replenish(clock::time_point now = clock::now());
+
+    [[nodiscard]] inline const Settings &settings() const { return _settings; }
+
+private:
+    // The balance is kept in thousandths of a retry, so requests can add fractions of one
+    static constexpr std::int64_t token = 1000;
+
+    void deposit(std::int64_t amount);
+
+private:
+    const Settings _settings;
+    std::atomic_int64_t _balance;
+    clock::time_point _replenished;
+};
+
+} // namespace ls
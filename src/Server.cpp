@@ -1,21 +1,27 @@
 #include "Server.hpp"
-#include <asm-generic/socket.h>
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstring>
-#include <fcntl.h>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include "HttpParser.hpp"
 #include "Log.hpp"
 #include "Sockets.hpp"
 
 namespace ls {
 
+constexpr std::uint32_t remote_events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
 
-Server::Server(int port, int connections_accepted) :
-    _port(port), _connections_accepted(connections_accepted), _socket({sockets::createSocket(), "server"}) {
+Server::Server(EventLoop &loop, TimerWheel &timers, int port, int connections_accepted, KeepAlive keep_alive,
+               std::chrono::seconds header_timeout, RequestHandler on_request) :
+    _loop(loop), _timers(timers), _port(port), _connections_accepted(connections_accepted), _keep_alive(keep_alive),
+    _header_timeout(header_timeout), _socket({sockets::createSocket(SOCK_NONBLOCK), "server"}),
+    _on_request(std::move(on_request)) {
     assert(port > 0);
     assert(connections_accepted > 0);
 
@@ -29,10 +35,10 @@ Server::Server(int port, int connections_accepted) :
     _addr.sin_port = htons(port);
     socklen_t addr_len = sizeof(_addr);
 
-    int optval; // This is thrown away
-    code = setsockopt(_socket.fd(), SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &optval, sizeof(optval));
-    timeval timeout{.tv_sec = 0, .tv_usec = 1};
-    code = setsockopt(_socket.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    // Both options are needed for several workers to bind their own listening socket to the same port
+    const int enabled = 1;
+    code = setsockopt(_socket.fd(), SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+    if (code == 0) { code = setsockopt(_socket.fd(), SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled)); }
     if (code != 0) {
         std::cerr << out::err << "Failed to setup server socket: " << std::strerror(errno) << "\n";
         throw std::runtime_error(std::strerror(errno));
@@ -49,56 +55,346 @@ Server::Server(int port, int connections_accepted) :
         std::cerr << out::err << "Failed to listen to server socket: " << std::strerror(errno) << "\n";
         throw std::runtime_error(std::strerror(errno));
     }
+
+    const bool is_accepting = _loop.acceptEach(_socket.fd(), [this](int remote_fd) {
+        sockaddr_in remote_addr{};
+        socklen_t remote_addr_length = sizeof(remote_addr);
+        getpeername(remote_fd, sockets::asGeneric(&remote_addr), &remote_addr_length);
+        accepted(remote_fd, remote_addr.sin_addr);
+    });
+    if (!is_accepting) { _loop.add(_socket.fd(), EPOLLIN | EPOLLET, [this](std::uint32_t) { acceptAll(); }); }
 }
 
-AcceptData Server::tryAcceptLatest(int timeout) {
-    using namespace sockets;
+Server::~Server() {
+    for (const auto &[remote_fd, remote] : _remotes) {
+        if (remote->header_timeout.has_value()) { _timers.cancel(*remote->header_timeout); }
+        _loop.remove(remote_fd);
+    }
+    _loop.remove(_socket.fd());
+}
 
-    constexpr int num_sockets = 1;
-    int code;
+void Server::acceptAll() {
+    // The listener is edge-triggered, so every pending connection has to be taken in one go
+    while (true) {
+        sockaddr_in remote_addr{};
+        socklen_t remote_addr_length = sizeof(remote_addr);
+        const int remote_fd =
+            accept4(_socket.fd(), reinterpret_cast<sockaddr *>(&remote_addr), &remote_addr_length, SOCK_NONBLOCK);
+        if (remote_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << out::err << "Failed to accept a connection: " << std::strerror(errno) << "\n";
+            }
+            return;
+        }
 
-    pollfd connection{.fd = _socket.fd(), .events = POLLIN};
-    code = poll(&connection, num_sockets, timeout);
-    if (code <= 0) { return {.remote_fd = -1}; }
+        accepted(remote_fd, remote_addr.sin_addr);
+    }
+}
 
+void Server::accepted(int remote_fd, in_addr address) {
     std::cerr << out::debug << "Connected~\n";
 
-    socklen_t addr_len = sizeof(_addr);
-    const int remoteFd = accept4(connection.fd, asGeneric(&_addr), &addr_len, 0);
+    const RemoteId remote{remote_fd, _next_serial++};
+    auto client =
+        std::make_unique<Remote>(Remote{.socket = {remote_fd, "remote"}, .serial = remote.serial, .address = address});
+    auto &added = *_remotes.insert_or_assign(remote_fd, std::move(client)).first->second;
 
-    // Check if socket is still open
-    const auto flags = fcntl(_socket.fd(), F_GETFL);
+    // Sockets the loop receives on are only watched for being writable
+    added.is_received = _loop.receiveEach(
+        remote_fd, [this, remote](std::string_view received, int error) { receiveFrom(remote, received, error); });
+    added.is_receiving = added.is_received;
+    _loop.add(remote_fd, added.is_received ? EPOLLOUT | EPOLLET : remote_events,
+              [this, remote](std::uint32_t events) { handleRemote(remote, events); });
+    timeHeaders(remote, added);
+}
 
+void Server::handleRemote(RemoteId remote, std::uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        std::cerr << out::debug << "Client on socket " << remote.fd << " hung up\n";
+        close(remote.fd);
+        return;
+    }
 
-    const auto inserted = _remotes.insert_or_assign(remoteFd, std::make_unique<Socket>(remoteFd, "remote"));
-    const auto &remote = _remotes.at(remoteFd);
-    const auto client_request = collect(*remote);
+    if (events & EPOLLOUT) {
+        const auto *client = find(remote);
+        if (client == nullptr) { return; }
+        if (!client->outgoing.empty() || client->relay != nullptr) { writeTo(remote); }
+    }
 
-    return {client_request, remoteFd};
+    if (events & (EPOLLIN | EPOLLRDHUP)) { readFrom(remote); }
 }
 
-bool Server::respond(int remote_fd, std::string response) {
-    bool result = true;
+void Server::readFrom(RemoteId remote) {
+    auto *client = find(remote);
+    if (client == nullptr) { return; }
 
-    std::cerr << out::info << "Responding to query made on socket " << remote_fd << " with data...\n";
-    std::cerr << out::debug << "sending data..." << response << "\n###\n";
-    ssize_t length_left = response.length();
-    ssize_t length_sent = 0;
-    while (length_sent != response.length()) {
-        int bytes_sent = send(remote_fd, response.c_str() + length_sent, length_left, 0);
-        if (bytes_sent < 0) {
-            std::cerr << out::err << "Failed to respond to client socket: " << std::strerror(errno) << "\n";
-            result = false;
+    // Anything sent after the last request that will be answered is left unread. Paused clients are read from again
+    // once their responses catch up, since the edge-triggered socket won't signal for data that's already arrived.
+    if (client->has_last_request || client->is_reading_paused) { return; }
+
+    // Whatever the loop received for the client is already in, so all that's left is starting it again if it was
+    // stopped, and handing off the requests that were held back
+    if (client->is_received) {
+        if (!client->is_receiving) {
+            client->is_receiving = true;
+            _loop.receiveEach(remote.fd, [this, remote](std::string_view received, int error) {
+                receiveFrom(remote, received, error);
+            });
+        }
+        processRequests(remote);
+        return;
+    }
+
+    const auto status = sockets::collect(client->socket, client->received);
+    if (status == sockets::IoStatus::FAILED) {
+        std::cerr << out::warn << "Failed to read from client socket: " << std::strerror(errno) << "\n";
+        close(remote.fd);
+        return;
+    }
+
+    client->is_peer_closed = status == sockets::IoStatus::CLOSED;
+    client->last_active = std::chrono::steady_clock::now();
+    processRequests(remote);
+}
+
+void Server::receiveFrom(RemoteId remote, std::string_view received, int error) {
+    auto *client = find(remote);
+    if (client == nullptr) { return; }
+
+    if (error != 0) {
+        std::cerr << out::warn << "Failed to read from client socket: " << std::strerror(error) << "\n";
+        close(remote.fd);
+        return;
+    }
+
+    client->received.append(received);
+    client->is_peer_closed = client->is_peer_closed || received.empty();
+    client->last_active = std::chrono::steady_clock::now();
+    processRequests(remote);
+
+    // The loop is stopped from receiving more than the client is read from, leaving the rest in the socket
+    client = find(remote);
+    if (client != nullptr && client->is_receiving && (client->has_last_request || client->is_reading_paused)) {
+        client->is_receiving = false;
+        _loop.stopReceiving(remote.fd);
+    }
+}
+
+void Server::processRequests(RemoteId remote) {
+    // Every request already read is handed off at once, without waiting on the responses to those before it
+    while (true) {
+        auto *client = find(remote);
+        if (client == nullptr) { return; }
+        if (client->has_last_request) { break; }
+        if (client->pending.size() >= max_pipelined_requests) {
+            client->is_reading_paused = true;
+            return;
+        }
+
+        const auto parsed = client->parser.parse(client->received);
+        if (parsed == http::Parser::Status::INVALID) {
+            std::cerr << out::warn << "Client on socket " << remote.fd << " sent a malformed request\n";
+            close(remote.fd);
+            return;
+        }
+        if (parsed == http::Parser::Status::INCOMPLETE) {
+            // A client that stops sending can still be answered, it just won't make any more requests
+            if (client->is_peer_closed) { client->has_last_request = true; }
             break;
         }
-        length_sent += bytes_sent;
-        length_left -= bytes_sent;
+
+        const auto request_number = client->next_request++;
+        const bool is_keep_alive = client->parser.isKeepAlive() && _keep_alive.idle_timeout.count() > 0 &&
+            client->next_request < static_cast<std::uint64_t>(_keep_alive.max_requests);
+        client->pending.push_back({request_number, client->parser.isHead(), is_keep_alive, std::nullopt});
+        client->has_last_request = !is_keep_alive;
+
+        const auto length = client->parser.length();
+        AcceptData request{.data = Buffer::copy(std::string_view(client->received).substr(0, length)),
+                           .remote = {remote.fd, remote.serial, request_number},
+                           .client_address = client->address};
+        client->received.erase(0, length);
+        client->parser.reset();
+
+        // The handler may respond immediately, closing the client, so it's looked up again afterwards
+        _on_request(std::move(request));
+    }
+
+    auto *client = find(remote);
+    if (client == nullptr) { return; }
+    if (client->has_last_request && client->pending.empty() && client->outgoing.empty() && client->relay == nullptr) {
+        close(remote.fd);
+        return;
+    }
+
+    // Clients waiting between requests are left to the idle timeout, until they start sending the next one
+    const bool is_reading_headers = !client->has_last_request && client->parser.headersLength() == 0 &&
+        (!client->received.empty() || client->next_request == 0);
+    if (is_reading_headers) {
+        timeHeaders(remote, *client);
+    } else if (client->header_timeout.has_value()) {
+        _timers.cancel(*client->header_timeout);
+        client->header_timeout.reset();
     }
+}
+
+void Server::timeHeaders(RemoteId remote, Remote &client) {
+    // The deadline isn't pushed back as more of the headers arrive, so they can't be trickled in a byte at a time
+    if (_header_timeout.count() == 0 || client.header_timeout.has_value()) { return; }
+    client.header_timeout = _timers.schedule(_header_timeout, [this, remote] { timeOutHeaders(remote); });
+}
+
+void Server::timeOutHeaders(RemoteId remote) {
+    auto *client = find(remote);
+    if (client == nullptr) { return; }
+    client->header_timeout.reset();
 
+    std::cerr << out::warn << "Client on socket " << remote.fd << " took too long to send a request's headers\n";
+
+    // Requests the client already made are still answered, but nothing more is read from it
+    client->has_last_request = true;
+    if (client->pending.empty() && client->outgoing.empty() && client->relay == nullptr) { close(remote.fd); }
+}
+
+bool Server::respond(RemoteId remote, std::string response, std::unique_ptr<Relay> body) {
+    auto *client = find(remote);
+    if (client == nullptr) {
+        std::cerr << out::warn << "Client on socket " << remote.fd << " left before it could be responded to\n";
+        return false;
+    }
+
+    const auto pending = std::find_if(client->pending.begin(), client->pending.end(),
+                                      [&](const PendingRequest &p) { return p.request == remote.request; });
+    if (pending == client->pending.end()) { return false; }
+
+    std::cerr << out::verb << "Responding to query made on socket " << remote.fd << " with data...\n";
+    std::cerr << out::debug << "sending data..." << response << "\n###\n";
+
+    pending->response = std::move(response);
+    pending->body = std::move(body);
+    queueResponses(remote, *client);
+    return writeTo(remote);
+}
+
+void Server::queueResponses(RemoteId remote, Remote &client) {
+    // Nothing can be queued after a relayed body until the relay is done with it
+    while (!client.is_closing && client.relay == nullptr && !client.pending.empty() &&
+           client.pending.front().response.has_value()) {
+        auto pending = std::move(client.pending.front());
+        client.pending.pop_front();
+        auto &response = *pending.response;
+
+        // The connection can only be reused if the end of the response can be told apart from whatever follows it.
+        // Relayed bodies always have a known length.
+        http::Parser parser{http::Parser::Kind::RESPONSE};
+        if (pending.is_head) { parser.expectNoBody(); }
+        parser.parse(response);
+        if (pending.body == nullptr && parser.status() == http::Parser::Status::INCOMPLETE) { parser.finish(); }
+        const bool is_framed = pending.body != nullptr ||
+            (parser.status() == http::Parser::Status::COMPLETE && parser.length() == response.length());
+
+        if (!pending.is_keep_alive || !is_framed || !parser.isKeepAlive()) {
+            // Let the client know the connection is closing if the server's response didn't already
+            const auto status_line_end = response.find('\n');
+            if (parser.isKeepAlive() && status_line_end != std::string::npos) {
+                response.insert(status_line_end + 1, "Connection: close\r\n");
+            }
+
+            client.is_closing = true;
+            client.pending.clear();
+        }
+
+        client.outgoing.push_back(std::move(response));
+        if (pending.body != nullptr) {
+            client.relay = std::move(pending.body);
+            _loop.rebind(client.relay->source(), [this, remote](std::uint32_t) { writeTo(remote); });
+        }
+    }
+}
+
+bool Server::writeTo(RemoteId remote) {
+    auto *client = find(remote);
+    if (client == nullptr) { return false; }
+
+    while (!client->outgoing.empty() || client->relay != nullptr) {
+        if (!client->outgoing.empty()) {
+            const auto status = sockets::transmit(client->socket, client->outgoing, client->sent);
+            if (status == sockets::IoStatus::PENDING) { return true; }
+            if (status != sockets::IoStatus::COMPLETE) {
+                if (status == sockets::IoStatus::FAILED) {
+                    std::cerr << out::err << "Failed to respond to client socket: " << std::strerror(errno) << "\n";
+                }
+                close(remote.fd);
+                return false;
+            }
+        }
+
+        if (client->relay != nullptr) {
+            const auto status = client->relay->pump(client->socket);
+            if (status == sockets::IoStatus::PENDING) { return true; }
+            if (status != sockets::IoStatus::COMPLETE) {
+                // Part of the response was already sent, so all that can be done is cutting the client off
+                std::cerr << out::warn << "Failed to relay a response body to client socket " << remote.fd << "\n";
+                close(remote.fd);
+                return false;
+            }
+
+            // Handing back the server's connection can start other transactions, so the client is looked up again
+            auto relay = std::move(client->relay);
+            relay.reset();
+            client = find(remote);
+            if (client == nullptr) { return false; }
+            queueResponses(remote, *client);
+        }
+    }
+
+    client->last_active = std::chrono::steady_clock::now();
+
+    if (client->is_closing || (client->has_last_request && client->pending.empty())) {
+        close(remote.fd);
+        return true;
+    }
+
+    if (client->is_reading_paused && client->pending.size() < max_pipelined_requests) {
+        client->is_reading_paused = false;
+        readFrom(remote);
+    }
+    return true;
+}
+
+void Server::closeIdle() {
+    if (_keep_alive.idle_timeout.count() == 0) { return; }
+
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<int> idle;
+    for (const auto &[remote_fd, remote] : _remotes) {
+        const bool is_waiting = remote->pending.empty() && remote->outgoing.empty() && remote->relay == nullptr;
+        if (is_waiting && now - remote->last_active >= _keep_alive.idle_timeout) { idle.push_back(remote_fd); }
+    }
+
+    for (const int remote_fd : idle) {
+        std::cerr << out::debug << "Closing idle client on socket " << remote_fd << "\n";
+        close(remote_fd);
+    }
+}
+
+void Server::close(int remote_fd) {
+    const auto found = _remotes.find(remote_fd);
+    if (found == _remotes.end()) { return; }
+
+    // Dropping a client hands any relayed server connections back, which can start other transactions, so it's only
+    // destroyed once it's out of the table
+    const auto remote = std::move(found->second);
+    _remotes.erase(found);
+    _loop.remove(remote_fd);
+    if (remote->header_timeout.has_value()) { _timers.cancel(*remote->header_timeout); }
+}
 
-    const auto &remote = _remotes.at(remote_fd);
-    _remotes.erase(remote_fd);
-    return result;
+Server::Remote *Server::find(RemoteId remote) {
+    const auto client = _remotes.find(remote.fd);
+    if (client == _remotes.end() || client->second->serial != remote.serial) { return nullptr; }
+    return client->second.get();
 }
 
-} // namespace ls
\ No newline at end of file
+} // namespace ls
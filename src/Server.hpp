@@ -1,22 +1,54 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <netinet/in.h>
-#include <poll.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "BufferPool.hpp"
+#include "EventLoop.hpp"
+#include "HttpParser.hpp"
+#include "Relay.hpp"
 #include "Sockets.hpp"
+#include "TimerWheel.hpp"
 
 namespace ls {
 
+// Identifies a request made by a client. File descriptors are reused by the kernel as soon as they are closed, so the
+// serial guards against answering a new client with a response meant for an old one. Clients can send several requests
+// on one connection before any are answered, so the request number tells which of them a response belongs to.
+struct RemoteId {
+    int fd;
+    std::uint64_t serial;
+    std::uint64_t request = 0;
+};
+
 struct AcceptData {
-    sockets::data data;
-    int remote_fd;
+    Buffer data; // Shared by every copy of the request, rather than copied along with it
+    RemoteId remote;
+    in_addr client_address = {}; // Where the client connected from
+    std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now(); // When the request was read in
 };
 
 class Server {
 public:
-    Server(int port, int connections_accepted);
-    ~Server() = default;
+    using RequestHandler = std::function<void(AcceptData)>;
+
+    struct KeepAlive {
+        std::chrono::seconds idle_timeout; // 0 closes every connection after its first response
+        int max_requests;                  // Requests answered on one connection before it's closed
+    };
+
+    // Clients have header_timeout (from connecting, or from the first byte of a later request) to send a request's
+    // headers, or they're disconnected. 0 means there's no limit.
+    Server(EventLoop &loop, TimerWheel &timers, int port, int connections_accepted, KeepAlive keep_alive,
+           std::chrono::seconds header_timeout, RequestHandler on_request);
+    ~Server();
 
     // No copying or moving a server
     Server(Server &) = delete;
@@ -24,15 +56,71 @@ public:
     Server(Server &&) = delete;
     Server &operator=(Server &&) = delete;
 
-    AcceptData tryAcceptLatest(int timeout);
-    bool respond(int remoteFd, std::string response);
+    // Responses are sent in the order their requests were made, so a response may be held until earlier ones are sent.
+    // Given a relay, the response is only the start of the message, and the relay sends the rest of the body after it.
+    bool respond(RemoteId remote, std::string response, std::unique_ptr<Relay> body = nullptr);
+
+    // Closes kept-alive connections that haven't made a request within the idle timeout.
+    void closeIdle();
+
+private:
+    // Past this many unanswered requests, a client isn't read from until some of them are answered
+    static constexpr std::size_t max_pipelined_requests = 32;
+
+    struct PendingRequest {
+        std::uint64_t request;
+        bool is_head;
+        bool is_keep_alive;
+        std::optional<std::string> response;
+        std::unique_ptr<Relay> body;
+    };
+
+    struct Remote {
+        sockets::Socket socket;
+        std::uint64_t serial;
+        in_addr address;
+        std::string received;
+        http::Parser parser{http::Parser::Kind::REQUEST};
+        std::deque<PendingRequest> pending;
+        std::uint64_t next_request = 0;
+        std::deque<std::string> outgoing; // Responses waiting to be sent, written out together
+        std::size_t sent = 0;             // How much of the first outgoing response has been sent
+        std::unique_ptr<Relay> relay; // Sends the rest of the last response, once everything before it is sent
+        bool is_received = false;  // Whether the loop receives on the socket for it, rather than it being read from
+        bool is_receiving = false; // Whether the loop's receiving hasn't been stopped
+        bool is_reading_paused = false;
+        bool is_peer_closed = false;
+        bool has_last_request = false;
+        bool is_closing = false;
+        std::chrono::steady_clock::time_point last_active = std::chrono::steady_clock::now();
+        std::optional<TimerWheel::TimerId> header_timeout; // Set while waiting on the headers of a request
+    };
+
+    void acceptAll();
+    void accepted(int remote_fd, in_addr address);
+    void handleRemote(RemoteId remote, std::uint32_t events);
+    void readFrom(RemoteId remote);
+    void receiveFrom(RemoteId remote, std::string_view received, int error);
+    void processRequests(RemoteId remote);
+    void timeHeaders(RemoteId remote, Remote &client);
+    void timeOutHeaders(RemoteId remote);
+    void queueResponses(RemoteId remote, Remote &client);
+    bool writeTo(RemoteId remote);
+    void close(int remote_fd);
+    Remote *find(RemoteId remote);
 
 private:
+    EventLoop &_loop;
+    TimerWheel &_timers;
     const int _port;
     const int _connections_accepted;
+    const KeepAlive _keep_alive;
+    const std::chrono::seconds _header_timeout;
     const sockets::Socket _socket;
-    std::map<int, std::unique_ptr<sockets::Socket>> _remotes;
+    const RequestHandler _on_request;
+    std::map<int, std::unique_ptr<Remote>> _remotes;
+    std::uint64_t _next_serial = 0;
     sockaddr_in _addr;
 };
 
-} // namespace ls
\ No newline at end of file
+} // namespace ls
@@ -4,38 +4,118 @@
 #pragma once
 
 #include <array>
+#include <cerrno>
+#include <deque>
+#include <fcntl.h>
 #include <iostream>
+#include <limits>
 #include <netinet/in.h>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include "FileDescriptor.hpp"
 #include "Log.hpp"
 
 namespace ls::sockets {
 
 constexpr int max_msg_chars = 8192;
+constexpr std::size_t max_gathered = 64; // Pieces written out by one system call
 
 using data = std::optional<std::string>;
 using Socket = FileDescriptor;
 
+// The state a socket is left in after reading or writing as much as possible from it.
+// - COMPLETE: Everything that was asked for was read or written
+// - PENDING: The socket would block, wait for it to become ready again
+// - CLOSED: The remote end closed the connection
+// - FAILED: The socket errored out, or timed out when blocking
+enum class IoStatus { COMPLETE, PENDING, CLOSED, FAILED };
+
 [[nodiscard]] inline int createSocket(int flags = 0) { return socket(AF_INET, SOCK_STREAM | flags, 0); }
 
 [[nodiscard]] inline auto asGeneric(sockaddr_in *addr) { return reinterpret_cast<sockaddr *>(addr); }
 
-[[nodiscard]] inline std::string collect(const Socket &socket) {
-    std::string received_str;
+inline bool setNonBlocking(int fd) {
+    const auto flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
 
-    while (true) {
+// Reads from the socket into received until it would block, closes, or fails. On a blocking socket, this reads until
+// the remote closes the connection or the socket's receive timeout fires. Reading stops early once received holds at
+// least limit bytes, leaving the rest in the socket.
+[[nodiscard]] inline IoStatus collect(const Socket &socket, std::string &received,
+                                     std::size_t limit = std::numeric_limits<std::size_t>::max()) {
+    while (received.length() < limit) {
         std::array<char, max_msg_chars> received_raw;
-        int len = recv(socket.fd(), received_raw.data(), sizeof(received_raw.data()), 0);
-        if (len <= 0) { break; }
+        const auto len = recv(socket.fd(), received_raw.data(), received_raw.size(), 0);
+        if (len == 0) { return IoStatus::CLOSED; }
+        if (len < 0) {
+            if (errno == EINTR) { continue; }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? IoStatus::PENDING : IoStatus::FAILED;
+        }
+
+        std::cerr << out::debug << "received: \n" << std::string_view(received_raw.data(), len) << "\n###\n";
+        received.append(received_raw.data(), len);
+    }
+
+    return IoStatus::COMPLETE;
+}
+
+// Writes data to the socket starting at the sent offset, advancing it until everything is sent or the socket would
+// block. Writing never raises SIGPIPE, a closed remote is reported as a failure instead.
+[[nodiscard]] inline IoStatus transmit(const Socket &socket, std::string_view data, std::size_t &sent) {
+    while (sent < data.length()) {
+        const auto len = send(socket.fd(), data.data() + sent, data.length() - sent, MSG_NOSIGNAL);
+        if (len < 0) {
+            if (errno == EINTR) { continue; }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? IoStatus::PENDING : IoStatus::FAILED;
+        }
+        sent += len;
+    }
+
+    return IoStatus::COMPLETE;
+}
+
+// Writes a queue of pieces to the socket as one stream, gathering as many as it can into each system call, starting
+// at the sent offset into the first piece. Pieces are dropped from the queue once they've been sent, leaving sent as
+// the offset into whichever piece is first.
+[[nodiscard]] inline IoStatus transmit(const Socket &socket, std::deque<std::string> &pieces, std::size_t &sent) {
+    while (true) {
+        while (!pieces.empty() && sent >= pieces.front().length()) {
+            pieces.pop_front();
+            sent = 0;
+        }
+        if (pieces.empty()) { return IoStatus::COMPLETE; }
+
+        std::array<iovec, max_gathered> gathered;
+        std::size_t count = 0;
+        for (auto piece = pieces.begin(); piece != pieces.end() && count < gathered.size(); piece++, count++) {
+            const auto offset = count == 0 ? sent : 0;
+            gathered[count] = {piece->data() + offset, piece->length() - offset};
+        }
 
-        received_str.append(received_raw.data(), len);
-    };
+        msghdr message{};
+        message.msg_iov = gathered.data();
+        message.msg_iovlen = count;
+        const auto len = sendmsg(socket.fd(), &message, MSG_NOSIGNAL);
+        if (len < 0) {
+            if (errno == EINTR) { continue; }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? IoStatus::PENDING : IoStatus::FAILED;
+        }
 
-    std::cerr << out::debug << "received: \n" << received_str << "\n###\n";
-    return received_str;
+        for (auto written = static_cast<std::size_t>(len); written > 0;) {
+            const auto left = pieces.front().length() - sent;
+            if (written < left) {
+                sent += written;
+                break;
+            }
+            written -= left;
+            pieces.pop_front();
+            sent = 0;
+        }
+    }
 }
 
-} // namespace ls::sockets
\ No newline at end of file
+} // namespace ls::sockets
@@ -1,52 +1,304 @@
 #include "TcpClient.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <array>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <netinet/in.h>
 #include <string>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include "HttpParser.hpp"
 #include "Log.hpp"
 #include "Sockets.hpp"
 
 namespace ls {
 
+// The state of a non-blocking query, kept alive by the event loop handler watching its socket.
+struct TcpClient::PendingQuery {
+    sockets::Socket socket;
+    Buffer request;
+    TcpClient::Callback on_complete;
+    bool is_streamed;
+    bool is_reused;
+    std::chrono::steady_clock::time_point deadline;
+    std::shared_ptr<TcpClient::Ticket> ticket;
+    std::optional<TimerWheel::TimerId> timeout; // Fails the query once the current phase (or the deadline) runs out
+    std::size_t sent = 0;
+    std::string response;
+    http::Parser parser{http::Parser::Kind::RESPONSE};
+    bool is_connected = false;
+    bool has_heard_back = false; // Set once anything is read, even an interim response that's since been dropped
+    bool is_finished = false;
+};
+
 TcpClient::TcpClient(std::string ip, int port) : _ip(ip), _port(port) {
     _addr.sin_family = AF_INET;
     inet_pton(AF_INET, ip.c_str(), &_addr.sin_addr);
     _addr.sin_port = htons(port);
 }
 
-sockets::data TcpClient::query(std::string data) {
-    int code;
+TcpClient::Cancel TcpClient::query(UpstreamPool &pool, Buffer data, Callback on_complete, bool is_streamed,
+                                   std::chrono::steady_clock::time_point deadline) {
+    std::cerr << out::debug << "sending a request with data...\n" << data.view() << "\n###\n";
+
+    auto ticket = std::make_shared<Ticket>();
+    send(pool, ticket, std::move(data), std::move(on_complete), is_streamed, deadline);
+
+    // The query's socket (if it has one yet) is closed rather than handed back, since the response may be half read
+    return [this, &pool, ticket] {
+        ticket->is_cancelled = true;
+        if (const auto query = ticket->query.lock(); query != nullptr && close(pool, *query, false)) {
+            std::cerr << out::debug << "Abandoned a query to " << address() << "\n";
+        }
+    };
+}
+
+void TcpClient::send(UpstreamPool &pool, const std::shared_ptr<Ticket> &ticket, Buffer data,
+                     Callback on_complete, bool is_streamed, std::chrono::steady_clock::time_point deadline) {
+    // Waiting on the pool for a free slot counts towards connecting, so a busy server fails the query like one that
+    // won't accept the connection
+    auto wait_deadline = deadline;
+    if (pool.limits().connect_timeout.count() > 0) {
+        wait_deadline = std::min(deadline, std::chrono::steady_clock::now() + pool.limits().connect_timeout);
+    }
+
+    // Only one of the lease and its expiry is ever called, so they share the callback
+    auto callback = std::make_shared<Callback>(std::move(on_complete));
+    pool.acquire(
+        [this, &pool, ticket, data = std::move(data), callback, is_streamed,
+         deadline](std::optional<sockets::Socket> idle) mutable {
+            start(pool, ticket, std::move(idle), std::move(data), std::move(*callback), is_streamed, deadline);
+        },
+        wait_deadline,
+        [this, ticket, callback] {
+            if (ticket->is_cancelled) { return; }
+            std::cerr << out::debug << "Gave up waiting on a connection to " << address() << "\n";
+            (*callback)(std::nullopt, nullptr);
+        });
+}
+
+void TcpClient::start(UpstreamPool &pool, const std::shared_ptr<Ticket> &ticket, std::optional<sockets::Socket> idle,
+                      Buffer data, Callback on_complete, bool is_streamed,
+                      std::chrono::steady_clock::time_point deadline) {
+    // Queries cancelled while waiting on the pool hand their connection straight back
+    if (ticket->is_cancelled) {
+        pool.release(std::move(idle));
+        return;
+    }
+
+    // Queries can wait on the pool for a connection, and may have run out of time before they get one
+    if (std::chrono::steady_clock::now() >= deadline) {
+        pool.release(std::move(idle));
+        on_complete(std::nullopt, nullptr);
+        return;
+    }
+
+    const bool is_head = data.view().substr(0, 5) == "HEAD ";
+    if (idle.has_value()) {
+        const int fd = idle->fd();
+        auto query = std::make_shared<PendingQuery>(PendingQuery{std::move(*idle), std::move(data),
+                                                                 std::move(on_complete), is_streamed, true, deadline,
+                                                                 ticket});
+        ticket->query = query;
+        query->is_connected = true;
+        if (is_head) { query->parser.expectNoBody(); }
+        armTimeout(pool, query, pool.limits().first_byte_timeout);
+
+        // The socket is already writable, so there won't be a new edge to start sending on
+        pool.loop().rebind(fd, [this, &pool, query](std::uint32_t events) { handle(pool, query, events); });
+        handle(pool, query, EPOLLOUT);
+        return;
+    }
+
+    const int fd = sockets::createSocket(SOCK_NONBLOCK);
+    if (fd < 0) {
+        std::cerr << out::err << "Failed to create client socket: " << std::strerror(errno) << "\n";
+        pool.release(std::nullopt);
+        on_complete(std::nullopt, nullptr);
+        return;
+    }
+
+    auto query = std::make_shared<PendingQuery>(
+        PendingQuery{{fd, "client"}, std::move(data), std::move(on_complete), is_streamed, false, deadline, ticket});
+    ticket->query = query;
+    if (is_head) { query->parser.expectNoBody(); }
+    armTimeout(pool, query, pool.limits().connect_timeout);
+
+    const int code = connect(fd, sockets::asGeneric(&_addr), sizeof(_addr));
+    if (code < 0 && errno != EINPROGRESS) {
+        finish(pool, *query, std::nullopt, false);
+        return;
+    }
+
+    pool.loop().add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                    [this, &pool, query](std::uint32_t events) { handle(pool, query, events); });
+}
+
+void TcpClient::handle(UpstreamPool &pool, const std::shared_ptr<PendingQuery> &query, std::uint32_t events) {
+    if (query->is_finished) { return; }
+
+    if (!query->is_connected) {
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        getsockopt(query->socket.fd(), SOL_SOCKET, SO_ERROR, &error, &error_len);
+        if (error != 0) {
+            std::cerr << out::debug << "Failed to connect: " << std::strerror(error) << "\n";
+            finish(pool, *query, std::nullopt, false);
+            return;
+        }
+        if (!(events & EPOLLOUT)) { return; }
+        query->is_connected = true;
+        armTimeout(pool, query, pool.limits().first_byte_timeout);
+    }
 
-    std::cerr << out::debug << "sending a request with data...\n" << data << "\n###\n";
+    // A reused connection may have been closed by the server before it saw the request. That says nothing about the
+    // server itself, so the request is sent again on another connection.
+    const auto fail = [&] {
+        if (!query->is_reused || query->has_heard_back) {
+            finish(pool, *query, std::nullopt, false);
+            return;
+        }
 
-    const sockets::Socket socket{sockets::createSocket(), "client"};
+        std::cerr << out::debug << "Kept-alive connection " << query->socket.fd() << " went stale, retrying...\n";
+        query->is_finished = true;
+        if (query->timeout.has_value()) { pool.timers().cancel(*query->timeout); }
+        pool.loop().remove(query->socket.fd());
+        pool.release(std::nullopt);
+        send(pool, query->ticket, std::move(query->request), std::move(query->on_complete), query->is_streamed,
+             query->deadline);
+    };
 
-    int optval; // This is thrown away
-    code = setsockopt(socket.fd(), SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &optval, sizeof(optval));
-    timeval timeout{.tv_sec = 10, .tv_usec = 0};
-    code = setsockopt(socket.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    if (code != 0) {
-        std::cerr << out::err << "Failed to setup server socket: " << std::strerror(errno) << "\n";
-        throw std::runtime_error(std::strerror(errno));
+    if (query->sent < query->request.length()) {
+        const auto status = sockets::transmit(query->socket, query->request, query->sent);
+        if (status == sockets::IoStatus::FAILED) {
+            fail();
+            return;
+        }
     }
-    socklen_t addr_len = sizeof(_addr);
 
-    code = setsockopt(socket.fd(), SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &optval, sizeof(optval));
-    timeout = {.tv_sec = 60, .tv_usec = 0};
-    code = setsockopt(socket.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    if (code != 0) {
-        std::cerr << out::err << "Failed to setup server socket: " << std::strerror(errno) << "\n";
-        throw std::runtime_error(std::strerror(errno));
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) { return; }
+
+    // Responses are read a buffer at a time, so that a body can be relayed as soon as its headers arrive
+    auto status = sockets::IoStatus::COMPLETE;
+    while (status == sockets::IoStatus::COMPLETE) {
+        status = sockets::collect(query->socket, query->response, query->response.length() + sockets::max_msg_chars);
+        if (status == sockets::IoStatus::FAILED ||
+            (status == sockets::IoStatus::CLOSED && query->response.empty())) {
+            fail();
+            return;
+        }
+
+        // Once the server has started responding, only the deadline is left to run out
+        if (!query->has_heard_back && !query->response.empty()) {
+            query->has_heard_back = true;
+            armTimeout(pool, query, std::chrono::seconds(0));
+        }
+
+        auto parsed = query->parser.parse(query->response);
+
+        // Interim responses are dropped as soon as they're parsed, so only the final response is passed on
+        if (const auto interim = query->parser.interimLength(); interim > 0) {
+            query->response.erase(0, interim);
+            query->parser.discard(interim);
+        }
+        if (parsed == http::Parser::Status::INCOMPLETE && status == sockets::IoStatus::CLOSED) {
+            parsed = query->parser.finish();
+        }
+
+        if (parsed == http::Parser::Status::INVALID) {
+            std::cerr << out::warn << "Received a malformed or cut off response from " << address() << "\n";
+            finish(pool, *query, std::nullopt, false);
+            return;
+        } else if (parsed == http::Parser::Status::COMPLETE) {
+            // Only connections that are left with nothing unread in them can be handed to another transaction
+            if (status == sockets::IoStatus::COMPLETE) { status = sockets::collect(query->socket, query->response); }
+            const bool keep_alive = status == sockets::IoStatus::PENDING &&
+                query->parser.length() == query->response.length() && query->parser.isKeepAlive();
+            finish(pool, *query, std::move(query->response), keep_alive);
+            return;
+        } else if (query->parser.remainingBody() >= min_relayed_body ||
+                   (query->is_streamed && query->parser.headersLength() > 0)) {
+            relay(pool, *query);
+            return;
+        }
+    }
+}
+
+void TcpClient::armTimeout(UpstreamPool &pool, const std::shared_ptr<PendingQuery> &query,
+                           std::chrono::seconds phase_timeout) {
+    if (query->timeout.has_value()) { pool.timers().cancel(*query->timeout); }
+    query->timeout.reset();
+
+    // Whichever runs out first, the phase or the whole query, times the query out
+    const auto now = std::chrono::steady_clock::now();
+    auto ends = query->deadline;
+    if (phase_timeout.count() > 0 && phase_timeout < ends - now) { ends = now + phase_timeout; }
+    if (ends == std::chrono::steady_clock::time_point::max()) { return; }
+
+    // The timer is cancelled whenever the query finishes, so it never outlives the query it holds on to
+    query->timeout = pool.timers().schedule(ends - now, [this, &pool, query] {
+        query->timeout.reset();
+        const char *phase = "reading from ";
+        if (!query->is_connected) {
+            phase = "connecting to ";
+        } else if (!query->has_heard_back) {
+            phase = "waiting on ";
+        }
+        std::cerr << out::warn << "Timed out " << phase << address() << "\n";
+        finish(pool, *query, std::nullopt, false);
+    });
+}
+
+void TcpClient::finish(UpstreamPool &pool, PendingQuery &query, sockets::data result, bool keep_alive) {
+    if (!close(pool, query, keep_alive)) { return; }
+    query.on_complete(std::move(result), nullptr);
+}
+
+bool TcpClient::close(UpstreamPool &pool, PendingQuery &query, bool keep_alive) {
+    if (query.is_finished) { return false; }
+    query.is_finished = true;
+    if (query.timeout.has_value()) { pool.timers().cancel(*query.timeout); }
+
+    if (keep_alive) {
+        pool.release(std::move(query.socket));
+    } else {
+        pool.loop().remove(query.socket.fd());
+        pool.release(std::nullopt);
     }
-    code = connect(socket.fd(), sockets::asGeneric(&_addr), addr_len);
-    if (code < 0) { return std::nullopt; }
+    return true;
+}
+
+void TcpClient::relay(UpstreamPool &pool, PendingQuery &query) {
+    query.is_finished = true;
+    if (query.timeout.has_value()) { pool.timers().cancel(*query.timeout); }
+    std::cerr << out::debug << "Relaying the rest of a response from " << address() << "\n";
 
-    code = send(socket.fd(), data.c_str(), data.length(), 0);
-    if (code < 0) { return std::nullopt; }
+    // Nothing more is read from the socket until the client is ready for the rest of the body
+    pool.loop().rebind(query.socket.fd(), [](std::uint32_t) {});
 
-    return sockets::collect(socket);
+    const auto on_relayed = [&pool](sockets::Socket source, bool is_reusable) {
+        if (is_reusable) {
+            pool.release(std::move(source));
+        } else {
+            pool.loop().remove(source.fd());
+            pool.release(std::nullopt);
+        }
+    };
+
+    // Large bodies of a known length are spliced, while the rest have to be parsed as they're copied
+    std::unique_ptr<Relay> body;
+    if (query.parser.remainingBody() >= min_relayed_body) {
+        body = std::make_unique<Relay>(std::move(query.socket), query.parser.remainingBody(),
+                                       query.parser.isKeepAlive(), on_relayed);
+    } else {
+        auto unparsed = query.response.substr(query.parser.length());
+        query.response.resize(query.parser.length());
+        body = std::make_unique<Relay>(std::move(query.socket), query.parser, std::move(unparsed), on_relayed);
+    }
+    query.on_complete(std::move(query.response), std::move(body));
 }
 
-} // namespace ls
\ No newline at end of file
+} // namespace ls
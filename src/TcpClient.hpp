@@ -1,17 +1,67 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <netinet/in.h>
+#include <optional>
 #include <string>
+#include "BufferPool.hpp"
+#include "Relay.hpp"
 #include "Sockets.hpp"
+#include "UpstreamPool.hpp"
 
 namespace ls {
 
 class TcpClient {
 public:
+    // Called with the response, or with nothing if the remote couldn't be reached. Large (or streamed) bodies aren't
+    // read into the response, which then only holds the start of the message, with the relay moving the rest.
+    using Callback = std::function<void(sockets::data, std::unique_ptr<Relay>)>;
+
+    // Abandons a query that hasn't been called back yet, closing its connection without ever calling its callback.
+    // Does nothing once the query has been called back.
+    using Cancel = std::function<void()>;
+
     TcpClient(std::string ip, int port = 80);
-    [[nodiscard]] sockets::data query(std::string data);
+
+    // Queries the remote without blocking, on a connection from the given pool, driving the socket through the pool's
+    // event loop. The callback is called exactly once. Connections the remote keeps alive are returned to the pool
+    // afterwards, once any relayed body has been sent. Streamed responses are called back with as soon as their
+    // headers arrive, relaying whatever body they have.
+    //
+    // The query fails if connecting or waiting on the response's first byte takes longer than the pool allows, or if
+    // the response hasn't arrived by the deadline.
+    Cancel query(UpstreamPool &pool, Buffer data, Callback on_complete, bool is_streamed = false,
+               std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
 
     [[nodiscard]] inline std::string address() const { return _ip + ":" + std::to_string(_port); }
+    [[nodiscard]] inline const sockaddr_in &socketAddress() const { return _addr; }
+
+private:
+    // Bodies with at least this many bytes left to read once the headers arrive are relayed instead of read
+    static constexpr std::uint64_t min_relayed_body = 64 * 1024;
+
+    struct PendingQuery;
+
+    // Shared between a query and whoever can cancel it, since the query may still be waiting on the pool.
+    struct Ticket {
+        bool is_cancelled = false;
+        std::weak_ptr<PendingQuery> query;
+    };
+
+    void send(UpstreamPool &pool, const std::shared_ptr<Ticket> &ticket, Buffer data, Callback on_complete,
+              bool is_streamed, std::chrono::steady_clock::time_point deadline);
+    void start(UpstreamPool &pool, const std::shared_ptr<Ticket> &ticket, std::optional<sockets::Socket> idle,
+               Buffer data, Callback on_complete, bool is_streamed,
+               std::chrono::steady_clock::time_point deadline);
+    void armTimeout(UpstreamPool &pool, const std::shared_ptr<PendingQuery> &query,
+                    std::chrono::seconds phase_timeout);
+    void handle(UpstreamPool &pool, const std::shared_ptr<PendingQuery> &query, std::uint32_t events);
+    void finish(UpstreamPool &pool, PendingQuery &query, sockets::data result, bool keep_alive);
+    bool close(UpstreamPool &pool, PendingQuery &query, bool keep_alive);
+    void relay(UpstreamPool &pool, PendingQuery &query);
 
 private:
     std::string _ip;
@@ -19,4 +69,4 @@ private:
     sockaddr_in _addr;
 };
 
-} // namespace ls
\ No newline at end of file
+} // namespace ls
@@ -0,0 +1,95 @@
+#include "TimerWheel.hpp"
+#include <algorithm>
+
+namespace ls {
+
+TimerWheel::TimerWheel(clock::duration tick, clock::time_point start) : _tick(std::max(tick, clock::duration(1))),
+    _start(start) {
+    _wheels[0].resize(std::size_t{1} << first_wheel_bits);
+    for (std::size_t wheel = 1; wheel < wheel_count; wheel++) { _wheels[wheel].resize(std::size_t{1} << wheel_bits); }
+}
+
+TimerWheel::TimerId TimerWheel::schedule(clock::duration delay, Callback callback) {
+    // The delay is counted from now rather than the last tick that was run, which may be a while ago between polls.
+    // Timers are never due on the current tick, since its slot has already been run.
+    const auto ticks = (std::max(delay, clock::duration::zero()) + _tick - clock::duration(1)) / _tick;
+    const auto now = std::max(static_cast<std::uint64_t>((clock::now() - _start) / _tick), _current);
+    const auto due = std::max<std::uint64_t>(now + ticks, _current + 1);
+
+    const auto id = _next_id++;
+    _timers.emplace(id, Timer{due, std::move(callback)});
+    place(id, due);
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId timer) {
+    return _timers.erase(timer) > 0;
+}
+
+void TimerWheel::advance(clock::time_point now) {
+    if (now < _start) { return; }
+    const auto target = static_cast<std::uint64_t>((now - _start) / _tick);
+
+    while (_current < target) {
+        _current++;
+
+        // Whenever a wheel comes back around, the next slot of the wheel above it is spread out over it
+        if ((_current & ((1 << first_wheel_bits) - 1)) == 0) {
+            std::size_t wheel = 1;
+            auto position = _current >> first_wheel_bits;
+            while (wheel + 1 < wheel_count && (position & ((1 << wheel_bits) - 1)) == 0) {
+                wheel++;
+                position >>= wheel_bits;
+            }
+            for (; wheel >= 1; wheel--) { cascade(wheel); }
+        }
+
+        // Callbacks may schedule timers into this same slot, so it's emptied out before any of them run
+        Slot due;
+        std::swap(due, _wheels[0][_current & ((1 << first_wheel_bits) - 1)]);
+        for (const auto id : due) {
+            const auto found = _timers.find(id);
+            if (found == _timers.end()) { continue; }
+
+            if (found->second.due > _current) {
+                place(id, found->second.due);
+                continue;
+            }
+
+            auto callback = std::move(found->second.callback);
+            _timers.erase(found);
+            callback();
+        }
+    }
+}
+
+void TimerWheel::place(TimerId id, std::uint64_t due) {
+    // Each wheel reaches further ahead than the one below it. Timers too far ahead for every wheel wait in the last
+    // wheel's furthest slot, and are placed again once it comes around.
+    const auto ahead = due - _current;
+    std::size_t shift = 0;
+    std::size_t bits = first_wheel_bits;
+    for (std::size_t wheel = 0; wheel < wheel_count; wheel++) {
+        if (ahead < (std::uint64_t{1} << (shift + bits)) || wheel + 1 == wheel_count) {
+            const auto capped = std::min(due, _current + (std::uint64_t{1} << (shift + bits)) - 1);
+            _wheels[wheel][(capped >> shift) & ((std::uint64_t{1} << bits) - 1)].push_back(id);
+            return;
+        }
+        shift += bits;
+        bits = wheel_bits;
+    }
+}
+
+void TimerWheel::cascade(std::size_t wheel) {
+    const auto shift = first_wheel_bits + (wheel - 1) * wheel_bits;
+    auto &slot = _wheels[wheel][(_current >> shift) & ((1 << wheel_bits) - 1)];
+
+    Slot timers;
+    std::swap(timers, slot);
+    for (const auto id : timers) {
+        const auto found = _timers.find(id);
+        if (found != _timers.end()) { place(id, found->second.due); }
+    }
+}
+
+} // namespace ls
@@ -0,0 +1,67 @@
+// A hierarchical timer wheel, for keeping track of large numbers of timers that are mostly cancelled before they fire
+// (like timeouts). Time is split into ticks, and timers are dropped into a slot of the wheel by the tick they're due
+// on. The first wheel has a slot for each of the next 256 ticks, and every wheel after it covers 64 slots of the wheel
+// before it, with timers trickling down a wheel as their time comes closer. Scheduling and cancelling a timer takes
+// constant time, as does each tick.
+//
+// The wheel doesn't keep time itself. Whoever owns it calls advance with the current time, which runs every timer due
+// by then, usually between polls of an event loop.
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace ls {
+
+class TimerWheel {
+public:
+    using clock = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+    using TimerId = std::uint64_t;
+
+    explicit TimerWheel(clock::duration tick, clock::time_point start = clock::now());
+
+    // Runs the callback once the delay has passed, rounded up to the next tick.
+    TimerId schedule(clock::duration delay, Callback callback);
+
+    // Stops a timer from running. Returns false if it already ran (or was already cancelled).
+    bool cancel(TimerId timer);
+
+    // Runs every timer that's due by now, in the order they're due. Callbacks are free to schedule or cancel timers.
+    void advance(clock::time_point now = clock::now());
+
+    [[nodiscard]] inline std::size_t size() const { return _timers.size(); }
+    [[nodiscard]] inline clock::duration tick() const { return _tick; }
+
+private:
+    static constexpr std::size_t first_wheel_bits = 8;
+    static constexpr std::size_t wheel_bits = 6;
+    static constexpr std::size_t wheel_count = 4;
+
+    struct Timer {
+        std::uint64_t due; // The tick the timer runs on
+        Callback callback;
+    };
+
+    using Slot = std::vector<TimerId>;
+
+    void place(TimerId id, std::uint64_t due);
+    void cascade(std::size_t wheel);
+
+private:
+    const clock::duration _tick;
+    const clock::time_point _start;
+    std::uint64_t _current = 0; // The last tick that was run
+
+    std::array<std::vector<Slot>, wheel_count> _wheels;
+    std::unordered_map<TimerId, Timer> _timers; // Cancelled timers are only removed from here, and skipped in slots
+    TimerId _next_id = 0;
+};
+
+} // namespace ls
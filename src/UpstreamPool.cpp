@@ -0,0 +1,115 @@
+#include "UpstreamPool.hpp"
+#include <algorithm>
+#include <iostream>
+#include "Log.hpp"
+
+namespace ls {
+
+UpstreamPool::UpstreamPool(EventLoop &loop, TimerWheel &timers, Limits limits) :
+    _loop(loop), _timers(timers), _limits(limits) {}
+
+UpstreamPool::~UpstreamPool() {
+    for (auto &idle : _idle) { _loop.remove(idle.socket.fd()); }
+    for (auto &waiting : _waiting) {
+        if (waiting.timeout.has_value()) { _timers.cancel(*waiting.timeout); }
+    }
+}
+
+void UpstreamPool::acquire(Lease lease, std::chrono::steady_clock::time_point deadline, Expiry on_expired) {
+    if (!_idle.empty()) {
+        // The most recently used connection is the least likely to have been closed by the server
+        auto socket = std::move(_idle.back().socket);
+        _idle.pop_back();
+        lease(std::move(socket));
+        return;
+    }
+
+    if (_limits.max_connections != 0 && _open >= _limits.max_connections) {
+        const auto waiting = _waiting.insert(_waiting.end(), {std::move(lease), std::move(on_expired), std::nullopt});
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            waiting->timeout = _timers.schedule(deadline - std::chrono::steady_clock::now(), [this, waiting] {
+                auto on_expired = std::move(waiting->on_expired);
+                _waiting.erase(waiting);
+                on_expired();
+            });
+        }
+        return;
+    }
+
+    _open++;
+    lease(std::nullopt);
+}
+
+void UpstreamPool::release(std::optional<sockets::Socket> socket) {
+    if (!_waiting.empty()) {
+        handOut(std::move(socket));
+        return;
+    }
+
+    if (!socket.has_value()) {
+        _open--;
+        return;
+    }
+
+    if (_idle.size() >= _limits.max_idle) {
+        _loop.remove(socket->fd());
+        _open--;
+        return;
+    }
+
+    const int fd = socket->fd();
+    _idle.push_back({std::move(*socket), std::chrono::steady_clock::now()});
+    _loop.rebind(fd, [this, fd](std::uint32_t) {
+        // An idle connection has nothing to say, so anything from it means the server is closing it
+        std::cerr << out::debug << "Idle upstream connection " << fd << " was closed by the server\n";
+        evict(fd);
+    });
+}
+
+void UpstreamPool::clear() {
+    while (!_idle.empty()) {
+        auto socket = std::move(_idle.back().socket);
+        _idle.pop_back();
+        close(std::move(socket));
+    }
+}
+
+void UpstreamPool::sweep() {
+    const auto now = std::chrono::steady_clock::now();
+    while (!_idle.empty() && now - _idle.front().since >= _limits.idle_timeout) {
+        auto socket = std::move(_idle.front().socket);
+        _idle.pop_front();
+        close(std::move(socket));
+    }
+}
+
+void UpstreamPool::evict(int fd) {
+    const auto found =
+        std::find_if(_idle.begin(), _idle.end(), [fd](const Idle &idle) { return idle.socket.fd() == fd; });
+    if (found == _idle.end()) { return; }
+
+    auto socket = std::move(found->socket);
+    _idle.erase(found);
+    close(std::move(socket));
+}
+
+void UpstreamPool::close(sockets::Socket socket) {
+    _loop.remove(socket.fd());
+    _open--;
+
+    // Closing a connection frees up a slot for anything waiting on one
+    if (!_waiting.empty()) {
+        _open++;
+        handOut(std::nullopt);
+    }
+}
+
+void UpstreamPool::handOut(std::optional<sockets::Socket> socket) {
+    // Waiting transactions are handed the connection directly, or the slot it frees up if it was closed
+    auto waiting = std::move(_waiting.front());
+    _waiting.pop_front();
+    if (waiting.timeout.has_value()) { _timers.cancel(*waiting.timeout); }
+    waiting.lease(std::move(socket));
+}
+
+} // namespace ls
@@ -0,0 +1,96 @@
+// A pool of kept-alive connections to one backing server, owned by a single worker. Connections are checked out for a
+// transaction and returned once the response is read, so that later transactions can skip connecting altogether.
+//
+// Idle connections stay registered with the worker's event loop. If the backing server closes one (or sends anything
+// at all) while it sits idle, it's dropped from the pool right away. The pool also caps how many connections can be
+// open to the server at once, holding further transactions back until a connection is returned, or until they've
+// waited as long as they can.
+//
+// Transactions on the pool's connections are timed out through the worker's timer wheel, which the pool hands out
+// along with its event loop.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <list>
+#include <optional>
+#include "EventLoop.hpp"
+#include "Sockets.hpp"
+#include "TimerWheel.hpp"
+
+namespace ls {
+
+class UpstreamPool {
+public:
+    struct Limits {
+        std::size_t max_idle;                    // Idle connections kept open, anything over this is closed
+        std::size_t max_connections;             // Connections open at once, idle or not. 0 means there's no limit
+        std::chrono::seconds idle_timeout;       // How long a connection can sit idle before it's closed
+        std::chrono::seconds connect_timeout;    // How long connecting (or waiting to) can take. 0 means no limit
+        std::chrono::seconds first_byte_timeout; // How long the server can take to start responding. 0 means no limit
+    };
+
+    // Called with an idle connection to reuse, or with nothing if a new connection should be opened instead.
+    using Lease = std::function<void(std::optional<sockets::Socket>)>;
+    // Called instead of the lease if it's still waiting on a connection by its deadline.
+    using Expiry = std::function<void()>;
+
+    UpstreamPool(EventLoop &loop, TimerWheel &timers, Limits limits);
+    ~UpstreamPool();
+
+    // No copying or moving a pool, its idle connections' handlers point back into it
+    UpstreamPool(UpstreamPool &) = delete;
+    UpstreamPool operator=(UpstreamPool &) = delete;
+    UpstreamPool(UpstreamPool &&) = delete;
+    UpstreamPool &operator=(UpstreamPool &&) = delete;
+
+    // Hands out a connection, immediately if the pool isn't at its limit, or otherwise once one is released. Leases
+    // still waiting by the deadline are dropped, and expired instead.
+    void acquire(Lease lease, std::chrono::steady_clock::time_point deadline, Expiry on_expired);
+
+    // Gives back a connection once its transaction is done. Pass nothing if the connection was closed.
+    // The socket is expected to still be registered with the event loop.
+    void release(std::optional<sockets::Socket> socket);
+
+    // Closes every idle connection, like when the backing server is found to be down.
+    void clear();
+
+    // Closes idle connections that have been idle for too long.
+    void sweep();
+
+    [[nodiscard]] inline EventLoop &loop() { return _loop; }
+    [[nodiscard]] inline TimerWheel &timers() { return _timers; }
+    [[nodiscard]] inline const Limits &limits() const { return _limits; }
+    [[nodiscard]] inline std::size_t idle() const { return _idle.size(); }
+    [[nodiscard]] inline std::size_t open() const { return _open; }
+
+private:
+    struct Idle {
+        sockets::Socket socket;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    struct Waiting {
+        Lease lease;
+        Expiry on_expired;
+        std::optional<TimerWheel::TimerId> timeout;
+    };
+
+    // Hands the connection (or the slot it frees up) to the lease that's been waiting longest.
+    void handOut(std::optional<sockets::Socket> socket);
+    void evict(int fd);
+    void close(sockets::Socket socket);
+
+private:
+    EventLoop &_loop;
+    TimerWheel &_timers;
+    const Limits _limits;
+    std::deque<Idle> _idle;
+    std::list<Waiting> _waiting; // Oldest first, and each lease's timeout erases it straight from the list
+    std::size_t _open = 0;
+};
+
+} // namespace ls
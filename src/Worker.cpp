@@ -0,0 +1,305 @@
+#include "Worker.hpp"
+#include <algorithm>
+#include <iostream>
+#include "Http.hpp"
+#include "HttpParser.hpp"
+#include "Log.hpp"
+
+namespace ls {
+
+Worker::Worker(LoadBalancer &balancer, int id, int port, int connections_accepted) :
+    _balancer(balancer), _id(id),
+    _loop(balancer._is_io_uring ? EventLoop::Backend::IO_URING : EventLoop::Backend::EPOLL), _timers(timeout_tick),
+    _pools(),
+    _proxy(_loop, _timers, port, connections_accepted, balancer._keep_alive, balancer._header_timeout,
+           [this](AcceptData client_request) { acceptQuery(std::move(client_request)); }) {
+    if (balancer._metrics != nullptr) {
+        _metrics = &balancer._metrics->shard(static_cast<std::size_t>(id));
+
+        // Metrics are served from the first worker, on a port of their own so they're never mixed up with traffic
+        if (id == 0) {
+            _admin = std::make_unique<Server>(_loop, _timers, balancer._metrics_port, connections_accepted,
+                                              balancer._keep_alive, balancer._header_timeout,
+                                              [this](AcceptData request) { serveAdmin(std::move(request)); });
+        }
+    }
+
+    const auto &hedging = balancer._hedging;
+    if (hedging.percentile == 0 && hedging.delay.count() > 0) { _hedge_delay = hedging.delay; }
+    _latencies.reserve(hedge_samples);
+}
+
+void Worker::poll(int timeout_ms) {
+    // New queries and finished transactions are both handled by the event loop as their sockets become ready
+    _loop.poll(timeout_ms);
+    _timers.advance();
+    retryFailures();
+
+    // Nothing read from the balancer's servers is held between polls
+    _balancer._backends.quiescent(_id);
+}
+
+void Worker::tidy() {
+    _proxy.closeIdle();
+    updateHedgeDelay();
+    _balancer.reconcile(_least_loaded);
+
+    for (auto &[connection, pool] : _pools) {
+        if (connection->is_inactive) { pool.clear(); }
+        pool.sweep();
+    }
+}
+
+void Worker::acceptQuery(AcceptData client_request) {
+    const auto &connections = _balancer._backends.read().connections;
+
+    // Ignore transactions if there are no server connections
+    if (connections.size() == 0) {
+        std::cerr << out::err << "No connected servers to query. Responding with 503...\n";
+        respond(client_request, http::Response::respond503().construct());
+        return;
+    }
+
+    // Servers ejected as outliers count as down, since the strategies pass them over just the same
+    const bool are_all_servers_down = std::none_of(connections.begin(), connections.end(),
+                                                   [](const auto &c) { return c->isAvailable(); });
+    if (are_all_servers_down) {
+        std::cerr << out::err << "All connected servers are down or ejected. Responding with 503...\n";
+        respond(client_request, http::Response::respond503().construct());
+        return;
+    }
+
+    // Fresh cached responses are sent straight back, without a server ever seeing the request
+    if (_balancer._cache != nullptr) {
+        if (auto cached = _balancer._cache->lookup(client_request.data); cached.has_value()) {
+            std::cerr << out::verb << "worker " << _id << " answering from the cache\n";
+            respond(client_request, std::move(*cached));
+            return;
+        }
+    }
+
+    // Retries don't get any more time, so the deadline is set once for every attempt at the request
+    const auto timeout = _balancer._request_timeout;
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (timeout.count() > 0) { deadline = std::chrono::steady_clock::now() + timeout; }
+
+    if (_balancer._retry_budget != nullptr) { _balancer._retry_budget->recordRequest(); }
+
+    // Only requests that are safe to send twice are hedged, and only on their first attempt
+    const bool is_hedged = _hedge_delay.has_value() && http::isIdempotent(client_request.data);
+    auto &connection = _balancer.pick(client_request, _least_loaded);
+    const auto transaction_id = createTransaction(connection, std::move(client_request), 0, deadline);
+    if (is_hedged) {
+        if (const auto found = _transactions.find(transaction_id); found != _transactions.end()) {
+            found->second.hedge = _timers.schedule(*_hedge_delay, [this, transaction_id] { hedge(transaction_id); });
+        }
+    }
+}
+
+void Worker::retryFailures() {
+    // Retries that fail straight away are queued again, and are left for the next pass
+    for (auto remaining = _failures.size(); remaining > 0; remaining--) {
+        auto [request, connection, attempted, deadline] = std::move(_failures.front());
+        _failures.pop();
+
+        std::cerr << out::info << "retrying a request made to " << connection.metadata.id << "...\n";
+        auto &next = _balancer.pick(request, _least_loaded);
+        createTransaction(next, std::move(request), attempted + 1, deadline);
+    }
+}
+
+void Worker::resolveTransaction(std::uint64_t transaction_id, sockets::data response, std::unique_ptr<Relay> body) {
+    const auto found = _transactions.find(transaction_id);
+    if (found == _transactions.end()) { return; }
+
+    auto [deadline, sent, request, connection, attempted, sibling, hedge, cancel] = std::move(found->second);
+    _transactions.erase(found);
+    if (hedge.has_value()) { _timers.cancel(*hedge); }
+
+    connection.ongoing_transactions--;
+    if (response.has_value()) { connection.is_inactive = false; }
+    if (response.has_value() && http::statusCode(*response) < 500) { connection.last_refreshed = clock::now(); }
+
+    // Server errors don't mark a server inactive (it's still answering), but do count against it as an outlier
+    const auto latency = std::chrono::steady_clock::now() - sent;
+    if (_balancer._outlier_detection.isEnabled()) {
+        const bool is_success = response.has_value() && http::statusCode(*response) < 500;
+        if (connection.breaker.record(is_success, latency)) {
+            std::cerr << out::info << "The ejected server " << connection.metadata.id
+                      << (is_success ? " passed" : " failed") << " its trial request\n";
+        }
+    }
+    _balancer.updateLoad(connection, _least_loaded);
+    if (_metrics != nullptr) {
+        const bool is_success = response.has_value() && http::statusCode(*response) < 500;
+        const auto received = response.has_value() ? response->length() : 0;
+        _metrics->recordTransaction(connection.index, is_success, latency, request.data.length(), received);
+
+        // Relayed bodies are counted as they're sent on, long after the transaction is done with
+        if (body != nullptr) {
+            body->onProgress([metrics = _metrics, backend = connection.index](std::uint64_t bytes) {
+                metrics->recordRelayed(backend, bytes);
+            });
+        }
+    }
+
+    // Whichever copy of a hedged request is answered first wins, and the other is abandoned
+    const bool is_sibling_waiting = sibling.has_value() && _transactions.count(*sibling) != 0;
+    if (response.has_value()) {
+        if (is_sibling_waiting) { abandon(*sibling); }
+        connection.recordLatency(latency);
+        recordHedgeLatency(latency);
+        if (_balancer._cache != nullptr && body == nullptr) { _balancer._cache->store(request.data, *response); }
+        respond(request, std::move(*response), std::move(body));
+    } else {
+        // Requests that ran out of time aren't retried, and the server isn't marked inactive, since it may only be slow
+        const bool is_timed_out = std::chrono::steady_clock::now() >= deadline;
+        const auto mark_inactive = [&] {
+            connection.is_inactive = true;
+            _balancer.updateLoad(connection, _least_loaded);
+            poolFor(connection).clear();
+        };
+
+        if (is_sibling_waiting) {
+            std::cerr << out::debug << "leaving the request to its other copy\n";
+            _transactions.at(*sibling).sibling.reset();
+            if (!is_timed_out) { mark_inactive(); }
+        } else if (is_timed_out) {
+            std::cerr << out::info << "timed out waiting on server " << connection.metadata.id << "\n";
+            respond(request, http::Response::respond504().construct());
+        } else if (attempted > _balancer._retries) {
+            std::cerr << out::info << "failed to get data \n";
+            respond(request, http::Response::respond503().construct());
+        } else if (_balancer._retry_budget != nullptr && !_balancer._retry_budget->tryRetry()) {
+            std::cerr << out::info << "out of retries to spend, giving up on the request\n";
+            respond(request, http::Response::respond503().construct());
+        } else {
+            std::cerr << out::debug << "attempting to retry the response (" << attempted << "<" << _balancer._retries
+                      << ")\n";
+            mark_inactive();
+            _failures.push({std::move(request), connection, attempted, deadline});
+        }
+    }
+}
+
+void Worker::hedge(std::uint64_t transaction_id) {
+    const auto found = _transactions.find(transaction_id);
+    if (found == _transactions.end()) { return; }
+    auto &transaction = found->second;
+    transaction.hedge.reset();
+
+    Connection *next = nullptr;
+    for (std::size_t i = 0; i < max_hedge_picks && next == nullptr; i++) {
+        auto &picked = _balancer.pick(transaction.request, _least_loaded);
+        if (&picked != &transaction.connection && picked.isAvailable()) { next = &picked; }
+    }
+    if (next == nullptr) { return; }
+
+    // Hedges add to the servers' load just as retries do, so they're paid for out of the same budget
+    if (_balancer._retry_budget != nullptr && !_balancer._retry_budget->tryRetry()) { return; }
+
+    std::cerr << out::verb << "worker " << _id << " hedging a request to server " << transaction.connection.metadata.id
+              << " on server " << next->metadata.id << "\n";
+    createTransaction(*next, transaction.request, transaction.attempted, transaction.deadline, transaction_id);
+}
+
+void Worker::abandon(std::uint64_t transaction_id) {
+    const auto found = _transactions.find(transaction_id);
+    if (found == _transactions.end()) { return; }
+
+    auto transaction = std::move(found->second);
+    _transactions.erase(found);
+    if (transaction.hedge.has_value()) { _timers.cancel(*transaction.hedge); }
+    if (transaction.cancel) { transaction.cancel(); }
+
+    // The server never got to answer, so nothing is held against it
+    auto &connection = transaction.connection;
+    connection.ongoing_transactions--;
+    connection.breaker.recordAbandoned();
+    _balancer.updateLoad(connection, _least_loaded);
+}
+
+void Worker::recordHedgeLatency(std::chrono::nanoseconds latency) {
+    if (_balancer._hedging.percentile == 0) { return; }
+
+    if (_latencies.size() < hedge_samples) {
+        _latencies.push_back(latency);
+    } else {
+        _latencies[_next_latency] = latency;
+    }
+    _next_latency = (_next_latency + 1) % hedge_samples;
+}
+
+void Worker::updateHedgeDelay() {
+    const auto percentile = static_cast<std::size_t>(_balancer._hedging.percentile);
+    if (percentile == 0 || _latencies.size() < min_hedge_samples) { return; }
+
+    auto sorted = _latencies;
+    const auto nth = sorted.begin() + static_cast<std::ptrdiff_t>(std::min(sorted.size() * percentile / 100,
+                                                                             sorted.size() - 1));
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    _hedge_delay = std::chrono::duration_cast<std::chrono::milliseconds>(*nth);
+}
+
+void Worker::respond(const AcceptData &request, std::string response, std::unique_ptr<Relay> body) {
+    if (_metrics != nullptr) { _metrics->recordResponse(std::chrono::steady_clock::now() - request.received); }
+    _proxy.respond(request.remote, std::move(response), std::move(body));
+}
+
+void Worker::serveAdmin(AcceptData request) {
+    const auto data = request.data.view();
+    const auto target_start = data.find(' ') + 1;
+    const auto target = data.substr(target_start, data.find(' ', target_start) - target_start);
+    if (target != "/metrics") {
+        _admin->respond(request.remote, http::Response::respond404().construct());
+        return;
+    }
+
+    const http::Response metrics{.code = 200,
+                                 .status_text = "OK",
+                                 .headers = {{"Content-Type", "text/plain; version=0.0.4"}},
+                                 .body = _balancer._metrics->render(_balancer._backends.read().connections)};
+    _admin->respond(request.remote, metrics.construct());
+}
+
+std::uint64_t Worker::createTransaction(Connection &connection, AcceptData client_request, int attempted,
+                                        std::chrono::steady_clock::time_point deadline,
+                                        std::optional<std::uint64_t> sibling) {
+    std::cerr << out::verb << std::boolalpha << "worker " << _id << " querying server " << connection.metadata.id
+              << " (weight: " << connection.metadata.weight << ", is active?: " << !connection.is_inactive << ")\n";
+    connection.ongoing_transactions++;
+    connection.breaker.recordSent();
+    _balancer.updateLoad(connection, _least_loaded);
+
+    // The transaction holds on to the original request in case it needs to be retried, sharing it with the query
+    const auto transaction_id = _next_transaction_id++;
+    auto data = client_request.data;
+    _transactions.emplace(transaction_id, Transaction{.deadline = deadline,
+                                                      .sent = std::chrono::steady_clock::now(),
+                                                      .request = std::move(client_request),
+                                                      .connection = connection,
+                                                      .attempted = attempted,
+                                                      .sibling = sibling});
+    // Both copies of a hedged request are linked before either can fail, since a query can fail straight away
+    if (sibling.has_value()) { _transactions.at(*sibling).sibling = transaction_id; }
+
+    auto cancel = connection.client.query(
+        poolFor(connection), std::move(data),
+        [this, transaction_id](sockets::data response, std::unique_ptr<Relay> body) {
+            resolveTransaction(transaction_id, std::move(response), std::move(body));
+        },
+        _balancer._is_streaming, deadline);
+    if (const auto found = _transactions.find(transaction_id); found != _transactions.end()) {
+        found->second.cancel = std::move(cancel);
+    }
+    return transaction_id;
+}
+
+UpstreamPool &Worker::poolFor(const Connection &connection) {
+    const auto found = _pools.find(&connection);
+    if (found != _pools.end()) { return found->second; }
+
+    return _pools.try_emplace(&connection, _loop, _timers, _balancer._pool_limits).first->second;
+}
+
+} // namespace ls
@@ -0,0 +1,80 @@
+// A worker runs one event loop with a listening socket of its own, accepting and answering clients independently of
+// any other workers. Every worker binds to the same port through SO_REUSEPORT, letting the kernel spread incoming
+// connections across them. Workers keep their own transaction tables and heaps of servers' load, only sharing the
+// balancer's backing servers.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include "EventLoop.hpp"
+#include "LoadBalancer.hpp"
+#include "Metrics.hpp"
+#include "Relay.hpp"
+#include "Server.hpp"
+#include "Sockets.hpp"
+#include "TimerWheel.hpp"
+#include "UpstreamPool.hpp"
+
+namespace ls {
+
+class Worker {
+public:
+    Worker(LoadBalancer &balancer, int id, int port, int connections_accepted);
+
+    // No copying or moving a worker, its server's handlers point back into it
+    Worker(Worker &) = delete;
+    Worker operator=(Worker &) = delete;
+    Worker(Worker &&) = delete;
+    Worker &operator=(Worker &&) = delete;
+
+    // Handles any sockets that become ready within timeout_ms milliseconds, runs any timeouts that are due, then
+    // retries failed transactions.
+    void poll(int timeout_ms);
+
+    // Closes idle clients and upstream connections that have timed out, along with those leading to servers that have
+    // gone down, and catches the worker's heap up on every server's load.
+    void tidy();
+
+    [[nodiscard]] inline int id() const { return _id; }
+
+private:
+    void acceptQuery(AcceptData client_request);
+    void retryFailures();
+    void resolveTransaction(std::uint64_t transaction_id, sockets::data response, std::unique_ptr<Relay> body);
+    void hedge(std::uint64_t transaction_id);
+    void abandon(std::uint64_t transaction_id);
+    void recordHedgeLatency(std::chrono::nanoseconds latency);
+    void updateHedgeDelay();
+    void respond(const AcceptData &request, std::string response, std::unique_ptr<Relay> body = nullptr);
+    void serveAdmin(AcceptData request);
+    std::uint64_t createTransaction(Connection &connection, AcceptData client_request, int attempted,
+                                    std::chrono::steady_clock::time_point deadline,
+                                    std::optional<std::uint64_t> sibling = std::nullopt);
+    UpstreamPool &poolFor(const Connection &connection);
+
+private:
+    LoadBalancer &_balancer;
+    const int _id;
+    EventLoop _loop;
+    TimerWheel _timers; // Times out clients, server connections, and transactions alike
+    // Relays held by the server hand their connections back to these pools, so the pools have to outlive it
+    std::unordered_map<const Connection *, UpstreamPool> _pools;
+    Server _proxy;
+    std::unique_ptr<Server> _admin;     // Serves metrics, only on the first worker
+    Metrics::Shard *_metrics = nullptr; // Only set when metrics are turned on
+    LeastLoadedHeap _least_loaded; // Only kept up to date for least connections
+    std::unordered_map<std::uint64_t, Transaction> _transactions;
+    std::uint64_t _next_transaction_id = 0;
+    std::queue<TransactionFailure> _failures;
+    std::optional<std::chrono::milliseconds> _hedge_delay; // Unset until the worker knows how long to wait
+    std::vector<std::chrono::nanoseconds> _latencies;      // Recent response times, for hedging by a percentile
+    std::size_t _next_latency = 0;
+};
+
+} // namespace ls
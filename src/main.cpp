@@ -15,6 +15,29 @@ using namespace std::chrono_literals;
 constexpr int default_connections_accepted = 5;
 constexpr int default_port = 40192;
 constexpr int default_retries = 3;
+constexpr int default_workers = 1;
+constexpr int default_pool_idle = 32;
+constexpr int default_pool_max = 0;
+constexpr std::chrono::seconds default_pool_timeout = 60s;
+constexpr std::chrono::seconds default_keep_alive = 60s;
+constexpr std::chrono::seconds default_connect_timeout = 10s;
+constexpr std::chrono::seconds default_header_timeout = 60s;
+constexpr std::chrono::seconds default_first_byte_timeout = 60s;
+constexpr std::chrono::seconds default_request_timeout = 120s;
+constexpr int default_keep_alive_requests = 1000;
+constexpr int default_retry_budget = 20;
+constexpr std::chrono::seconds default_check_timeout = 10s;
+constexpr int default_check_jitter = 10;
+constexpr int default_rise = 1;
+constexpr int default_fall = 1;
+// Ejecting outliers is left off unless asked for, since it takes servers out of rotation on its own judgement
+constexpr int default_eject_errors = 0;
+constexpr int default_eject_latency = 0;
+constexpr int default_max_ejected = 50;
+constexpr std::chrono::seconds default_ejection_time = 10s;
+constexpr std::chrono::seconds default_max_ejection_time = 300s;
+constexpr int default_cache_megabytes = 0;
+constexpr int default_metrics_port = 0;
 constexpr clock::duration default_stale_timeout = 30s;
 
 // Signal handling code based on:
@@ -32,12 +55,25 @@ struct SetupArgs {
     inline static void printUsageMessage(char **argv) {
         std::cerr << "Usage: " << argv[0]
                   << " [-h | --help] [-p | --port PORT] [-t | --stale SECONDS] [-r | --retries RETRIES]"
-                  << " [-c | --connections CONNECTIONS] [--log LEVEL] [strategy] "
+                  << " [-c | --connections CONNECTIONS] [-w | --workers WORKERS] [--pin] [--io-uring]"
+                  << " [--pool-idle IDLE] [--pool-max MAX] [--pool-timeout SECONDS]"
+                  << " [--keep-alive SECONDS] [--keep-alive-requests REQUESTS]"
+                  << " [--connect-timeout SECONDS] [--header-timeout SECONDS] [--first-byte-timeout SECONDS]"
+                  << " [--request-timeout SECONDS] [--retry-budget PERCENT] [--hedge DELAY]"
+                  << " [--check-timeout SECONDS] [--check-jitter PERCENT] [--rise CHECKS] [--fall CHECKS]"
+                  << " [--eject-errors PERCENT] [--eject-latency FACTOR] [--ejection-time SECONDS]"
+                  << " [--max-ejected PERCENT]"
+                  << " [--stream] [--cache MEGABYTES] [--hash-key KEY] [--metrics-port PORT]"
+                  << " [--log LEVEL] [strategy] "
                   << "{ ip_addr1   port1   weight1 } ... \n \n"
                   << "Valid strategy types: \n"
                   << "\t--robin: Starts the load balancer using a weighted round robin algorithm\n"
                   << "\t--least: Starts the load balancer using a least connections algorithm\n"
-                  << "\t--random: Starts the load balancer randomly selecting connected servers\n";
+                  << "\t--random: Starts the load balancer randomly selecting servers by weight\n"
+                  << "\t--p2c: Starts the load balancer picking the faster of two randomly sampled servers\n"
+                  << "\t--hash: Starts the load balancer sending requests with the same key to the same server\n"
+                  << "Valid hash keys: path, host, ip, header:NAME\n"
+                  << "Valid hedge delays: MILLISECONDS, or pPERCENTILE (like p95) of recent response times\n";
     }
 
 public:
@@ -46,6 +82,21 @@ public:
     LoadBalancer::Strategy strategy;
     int retries;
     clock::duration stale_timeout;
+    int workers;
+    bool pin_workers;
+    bool is_io_uring;
+    UpstreamPool::Limits pool_limits;
+    Server::KeepAlive keep_alive;
+    std::chrono::seconds header_timeout;
+    std::chrono::seconds request_timeout;
+    int retry_budget;
+    Hedging hedging;
+    HealthChecker::Settings health_checks;
+    OutlierDetector::Settings outlier_detection;
+    bool is_streaming;
+    int cache_megabytes;
+    HashKey hash_key;
+    int metrics_port;
     int starting_arg;
 };
 
@@ -84,8 +135,22 @@ int main(int argc, char **argv) {
     }
 
     lb.use(args.strategy);
+    lb.useWorkers(args.workers, args.pin_workers);
+    lb.useIoUring(args.is_io_uring);
+    lb.usePool(args.pool_limits);
+    lb.useKeepAlive(args.keep_alive);
+    lb.useTimeouts(args.header_timeout, args.request_timeout);
+    lb.useRetryBudget(args.retry_budget);
+    lb.useHedging(args.hedging);
+    lb.useHealthChecks(args.health_checks);
+    lb.useOutlierDetection(args.outlier_detection);
+    lb.useStreaming(args.is_streaming);
+    lb.useCache(static_cast<std::size_t>(args.cache_megabytes) * 1024 * 1024);
+    lb.useHashKey(args.hash_key);
+    lb.useMetrics(args.metrics_port);
     lb.start();
 
+    out::flush();
     return 0;
 }
 
@@ -96,6 +161,26 @@ int getIntMinBounded(std::string s, int min = 0) {
     return val;
 }
 
+HashKey getHashKey(std::string s) {
+    static const std::string header_prefix = "header:";
+    if (s == "path") { return {.kind = HashKey::Kind::TARGET, .header = ""}; }
+    if (s == "host") { return {.kind = HashKey::Kind::HOST, .header = ""}; }
+    if (s == "ip") { return {.kind = HashKey::Kind::CLIENT_IP, .header = ""}; }
+    if (s.rfind(header_prefix, 0) == 0 && s.size() > header_prefix.size()) {
+        return {.kind = HashKey::Kind::HEADER, .header = s.substr(header_prefix.size())};
+    }
+    throw std::invalid_argument{s + " isn't a valid hash key"};
+}
+
+Hedging getHedging(std::string s) {
+    if (!s.empty() && s[0] == 'p') {
+        const int percentile = getIntMinBounded(s.substr(1), 1);
+        if (percentile > 100) { throw std::invalid_argument{s + " isn't a valid percentile"}; }
+        return {.delay = std::chrono::milliseconds(0), .percentile = percentile};
+    }
+    return {.delay = std::chrono::milliseconds(getIntMinBounded(s)), .percentile = 0};
+}
+
 SetupArgs SetupArgs::getFlags(int argc, char **argv) {
     using Strategy = LoadBalancer::Strategy;
 
@@ -105,6 +190,33 @@ SetupArgs SetupArgs::getFlags(int argc, char **argv) {
                    .strategy = Strategy::WEIGHTED_ROUND_ROBIN,
                    .retries = default_retries,
                    .stale_timeout = default_stale_timeout,
+                   .workers = default_workers,
+                   .pin_workers = false,
+                   .is_io_uring = false,
+                   .pool_limits = {.max_idle = default_pool_idle,
+                                   .max_connections = default_pool_max,
+                                   .idle_timeout = default_pool_timeout,
+                                   .connect_timeout = default_connect_timeout,
+                                   .first_byte_timeout = default_first_byte_timeout},
+                   .keep_alive = {.idle_timeout = default_keep_alive, .max_requests = default_keep_alive_requests},
+                   .header_timeout = default_header_timeout,
+                   .request_timeout = default_request_timeout,
+                   .retry_budget = default_retry_budget,
+                   .hedging = {.delay = std::chrono::milliseconds(0), .percentile = 0},
+                   .health_checks = {.interval = default_stale_timeout,
+                                     .jitter_percent = default_check_jitter,
+                                     .rise = default_rise,
+                                     .fall = default_fall,
+                                     .timeout = default_check_timeout},
+                   .outlier_detection = {.error_percent = default_eject_errors,
+                                         .latency_factor = default_eject_latency,
+                                         .max_ejected_percent = default_max_ejected,
+                                         .ejection_time = default_ejection_time,
+                                         .max_ejection_time = default_max_ejection_time},
+                   .is_streaming = false,
+                   .cache_megabytes = default_cache_megabytes,
+                   .hash_key = {.kind = HashKey::Kind::TARGET, .header = ""},
+                   .metrics_port = default_metrics_port,
                    .starting_arg = 1};
 
     // Giant if-else statements don't look that great, but they're easy to setup and are good at handling
@@ -118,6 +230,9 @@ SetupArgs SetupArgs::getFlags(int argc, char **argv) {
             if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
 
             out::level = getIntMinBounded(argv[i + 1]);
+            if (out::level > out::max_level) {
+                std::cerr << out::warn << "Only logs up to level " << out::max_level << " were compiled in\n";
+            }
             args.starting_arg += 2;
             i++;
         } else if (flag == "-p" || flag == "--port") {
@@ -142,9 +257,163 @@ SetupArgs SetupArgs::getFlags(int argc, char **argv) {
             if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
 
             args.stale_timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1], 1));
+            args.health_checks.interval = args.stale_timeout;
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "-w" || flag == "--workers") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.workers = getIntMinBounded(argv[i + 1], 1);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--pool-idle") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.pool_limits.max_idle = getIntMinBounded(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--pool-max") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.pool_limits.max_connections = getIntMinBounded(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--pool-timeout") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.pool_limits.idle_timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1], 1));
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--keep-alive") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.keep_alive.idle_timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1]));
             args.starting_arg += 2;
             i++;
-        } else if (flag == "--robin" || flag == "--least" || flag == "--random") {
+        } else if (flag == "--keep-alive-requests") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.keep_alive.max_requests = getIntMinBounded(argv[i + 1], 1);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--connect-timeout") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.pool_limits.connect_timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1]));
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--header-timeout") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.header_timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1]));
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--first-byte-timeout") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.pool_limits.first_byte_timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1]));
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--request-timeout") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.request_timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1]));
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--retry-budget") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.retry_budget = getIntMinBounded(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--hedge") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.hedging = getHedging(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--check-timeout") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.health_checks.timeout = std::chrono::seconds(getIntMinBounded(argv[i + 1], 1));
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--check-jitter") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.health_checks.jitter_percent = getIntMinBounded(argv[i + 1]);
+            if (args.health_checks.jitter_percent > 100) { throw std::invalid_argument{"jitter can't be over 100%"}; }
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--rise") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.health_checks.rise = getIntMinBounded(argv[i + 1], 1);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--fall") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.health_checks.fall = getIntMinBounded(argv[i + 1], 1);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--eject-errors") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.outlier_detection.error_percent = getIntMinBounded(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--eject-latency") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            // A factor of 1 would eject every server slower than the median, so 0 (never) is the only value below 2
+            args.outlier_detection.latency_factor = getIntMinBounded(argv[i + 1]);
+            if (args.outlier_detection.latency_factor == 1) {
+                throw std::invalid_argument{"latency factor can't be 1"};
+            }
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--ejection-time") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.outlier_detection.ejection_time = std::chrono::seconds(getIntMinBounded(argv[i + 1], 1));
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--max-ejected") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.outlier_detection.max_ejected_percent = getIntMinBounded(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--cache") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.cache_megabytes = getIntMinBounded(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--hash-key") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.hash_key = getHashKey(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--metrics-port") {
+            if (i + 1 >= argc) { throw std::invalid_argument{"No argument for flag given"}; }
+
+            args.metrics_port = getIntMinBounded(argv[i + 1]);
+            args.starting_arg += 2;
+            i++;
+        } else if (flag == "--pin") {
+            args.pin_workers = true;
+            args.starting_arg++;
+        } else if (flag == "--io-uring") {
+            args.is_io_uring = true;
+            args.starting_arg++;
+        } else if (flag == "--stream") {
+            args.is_streaming = true;
+            args.starting_arg++;
+        } else if (flag == "--robin" || flag == "--least" || flag == "--random" || flag == "--p2c" ||
+                   flag == "--hash") {
             if (strategy_specified) { throw std::invalid_argument{"multiple strategies specified"}; }
 
             if (flag == "--robin")
@@ -153,6 +422,10 @@ SetupArgs SetupArgs::getFlags(int argc, char **argv) {
                 args.strategy = Strategy::LEAST_CONNECTIONS;
             else if (flag == "--random")
                 args.strategy = Strategy::RANDOM;
+            else if (flag == "--p2c")
+                args.strategy = Strategy::POWER_OF_TWO_CHOICES;
+            else if (flag == "--hash")
+                args.strategy = Strategy::CONSISTENT_HASHING;
 
             strategy_specified = true;
             args.starting_arg++;
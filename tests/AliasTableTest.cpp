@@ -0,0 +1,91 @@
+// Checks that the alias table picks servers in proportion to their weights, both exactly (by working out every
+// column's split) and in practice (by sampling it), and that servers without any weight are never picked.
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "AliasTable.hpp"
+
+using namespace ls;
+
+static constexpr double coin_sides = 4294967296.0; // 2^32
+
+// Works out the chance of each server being picked, by finding where every column's coin flips from its server to its
+// alias. Every server with any weight gets a column of its own.
+static std::vector<double> sharesOf(const AliasTable &table, std::size_t columns) {
+    std::vector<double> shares(table.serverCount(), 0);
+    for (std::uint64_t column = 0; column < columns; column++) {
+        const auto first = table.sample(column << 32);
+        const auto last = table.sample(column << 32 | 0xFFFFFFFF);
+
+        // The lowest coin flip that lands on the alias
+        std::uint64_t low = 0;
+        std::uint64_t high = 1ull << 32;
+        while (low < high) {
+            const auto middle = (low + high) / 2;
+            if (table.sample(column << 32 | middle) != first) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        shares[first] += low / coin_sides / columns;
+        shares[last] += (coin_sides - low) / coin_sides / columns;
+    }
+    return shares;
+}
+
+static double totalOf(const std::vector<int> &weights) {
+    double total = 0;
+    for (const auto weight : weights) { total += std::max(weight, 0); }
+    return total;
+}
+
+TEST(AliasTableTest, SharesMatchWeights) {
+    const std::vector<int> weights{5, 1, 0, 3, 1, 10, 7};
+    const AliasTable table{weights};
+    const auto shares = sharesOf(table, weights.size() - 1); // The server without any weight has no column
+    for (std::size_t server = 0; server < weights.size(); server++) {
+        EXPECT_NEAR(shares[server], weights[server] / totalOf(weights), 1e-6) << "server " << server;
+    }
+}
+
+TEST(AliasTableTest, SkewedWeightsKeepTheirShares) {
+    // One heavy server has to top up every other column
+    const std::vector<int> weights{1000, 1, 1, 1, 1};
+    const AliasTable table{weights};
+    const auto shares = sharesOf(table, weights.size());
+    for (std::size_t server = 0; server < weights.size(); server++) {
+        EXPECT_NEAR(shares[server], weights[server] / totalOf(weights), 1e-6) << "server " << server;
+    }
+}
+
+TEST(AliasTableTest, SamplesFollowWeights) {
+    const std::vector<int> weights{4, 2, 1, 0, 1};
+    const AliasTable table{weights};
+    std::mt19937_64 gen{42};
+
+    constexpr int samples = 1'000'000;
+    std::vector<int> counts(weights.size(), 0);
+    for (int i = 0; i < samples; i++) { counts[table.sample(gen())]++; }
+
+    EXPECT_EQ(counts[3], 0);
+    for (std::size_t server = 0; server < weights.size(); server++) {
+        EXPECT_NEAR(static_cast<double>(counts[server]) / samples, weights[server] / totalOf(weights), 0.005)
+            << "server " << server;
+    }
+}
+
+TEST(AliasTableTest, ServersWithoutWeightAreLeftOut) {
+    const AliasTable table{{0, 3, -1}};
+    EXPECT_FALSE(table.includes(0));
+    EXPECT_TRUE(table.includes(1));
+    EXPECT_FALSE(table.includes(2));
+    for (std::uint64_t random : {0ull, 0xFFFFFFFFull, 0xDEADBEEFCAFEull, ~0ull}) {
+        EXPECT_EQ(table.sample(random), 1u);
+    }
+
+    EXPECT_TRUE(AliasTable({0, 0}).isEmpty());
+}
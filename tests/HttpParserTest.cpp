@@ -0,0 +1,116 @@
+// Checks where the parser finds the end of requests and responses, and that it refuses messages whose end could be
+// read more than one way.
+
+#include <gtest/gtest.h>
+#include <string>
+#include "HttpParser.hpp"
+
+using namespace ls;
+using Status = http::Parser::Status;
+
+static Status parseRequest(const std::string &request) {
+    http::Parser parser{http::Parser::Kind::REQUEST};
+    return parser.parse(request);
+}
+
+TEST(HttpParserTest, FramesByContentLength) {
+    const std::string request = "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET";
+    http::Parser parser{http::Parser::Kind::REQUEST};
+    EXPECT_EQ(parser.parse(request), Status::COMPLETE);
+    EXPECT_EQ(parser.length(), request.size() - 3);
+}
+
+TEST(HttpParserTest, FramesChunkedBodies) {
+    const std::string response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"
+                                 "5\r\nhello\r\n0\r\nTrailer: x\r\n\r\n";
+    http::Parser parser{http::Parser::Kind::RESPONSE};
+    EXPECT_EQ(parser.parse(response), Status::COMPLETE);
+    EXPECT_EQ(parser.length(), response.size());
+    EXPECT_TRUE(parser.isChunked());
+}
+
+TEST(HttpParserTest, PicksUpWhereItLeftOff) {
+    const std::string response = "HTTP/1.1 200 OK\nContent-Length: 3\n\nabc";
+    http::Parser parser{http::Parser::Kind::RESPONSE};
+    for (std::size_t length = 1; length < response.size(); length++) {
+        ASSERT_EQ(parser.parse(std::string_view(response).substr(0, length)), Status::INCOMPLETE);
+    }
+    EXPECT_EQ(parser.parse(response), Status::COMPLETE);
+    EXPECT_EQ(parser.code(), 200);
+}
+
+TEST(HttpParserTest, RunsResponsesWithoutALengthUntilClose) {
+    http::Parser parser{http::Parser::Kind::RESPONSE};
+    EXPECT_EQ(parser.parse("HTTP/1.1 200 OK\r\n\r\nabc"), Status::INCOMPLETE);
+    EXPECT_EQ(parser.finish(), Status::COMPLETE);
+    EXPECT_FALSE(parser.isKeepAlive());
+}
+
+TEST(HttpParserTest, AcceptsRepeatedMatchingContentLengths) {
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\nhi"), Status::COMPLETE);
+}
+
+TEST(HttpParserTest, RejectsContentLengthsThatArentAllDigits) {
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: 10x\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: +1\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: 1, 1\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length:\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n"), Status::INVALID);
+}
+
+TEST(HttpParserTest, RejectsConflictingContentLengths) {
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 3\r\n\r\nhi"), Status::INVALID);
+}
+
+TEST(HttpParserTest, RejectsContentLengthWithTransferEncoding) {
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"),
+              Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n"),
+              Status::INVALID);
+}
+
+TEST(HttpParserTest, RejectsTransferEncodingsNotEndingInChunked) {
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nTransfer-Encoding: gzip, notchunked\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n\r\n"),
+              Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nTransfer-Encoding: xchunked\r\n\r\n"), Status::INVALID);
+}
+
+TEST(HttpParserTest, RejectsMalformedHeaderLines) {
+    EXPECT_EQ(parseRequest("GET / HTTP/1.1\r\nHost example\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("GET / HTTP/1.1\r\n: empty\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nTransfer-Encoding : chunked\r\n\r\n"), Status::INVALID);
+    EXPECT_EQ(parseRequest("GET / HTTP/1.1\r\nHost: example\r\n folded\r\n\r\n"), Status::INVALID);
+}
+
+TEST(HttpParserTest, RejectsChunkSizesWithTrailingJunk) {
+    EXPECT_EQ(parseRequest("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5x\r\nhello\r\n0\r\n\r\n"),
+              Status::INVALID);
+}
+
+TEST(HttpParserTest, SkipsInterimResponses) {
+    const std::string interim = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 103 Early Hints\r\nLink: </a.css>\r\n\r\n";
+    const std::string final = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    http::Parser parser{http::Parser::Kind::RESPONSE};
+
+    EXPECT_EQ(parser.parse(interim), Status::INCOMPLETE);
+    EXPECT_EQ(parser.interimLength(), interim.size());
+    EXPECT_EQ(parser.parse(interim + final), Status::COMPLETE);
+    EXPECT_EQ(parser.code(), 200);
+    EXPECT_EQ(parser.length(), interim.size() + final.size());
+
+    // Once the interim responses are dropped from the buffer, the parser only covers the final response
+    parser.discard(parser.interimLength());
+    EXPECT_EQ(parser.interimLength(), 0);
+    EXPECT_EQ(parser.length(), final.size());
+    EXPECT_EQ(parser.headersLength(), final.size() - 2);
+}
+
+TEST(HttpParserTest, TreatsSwitchingProtocolsAsFinal) {
+    http::Parser parser{http::Parser::Kind::RESPONSE};
+    EXPECT_EQ(parser.parse("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n\r\n"), Status::COMPLETE);
+    EXPECT_EQ(parser.code(), 101);
+    EXPECT_EQ(parser.interimLength(), 0);
+}
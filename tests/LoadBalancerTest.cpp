@@ -0,0 +1,85 @@
+// Checks that weighted round robin spreads each server's turns out across the schedule rather than sending them in a
+// burst, whether the servers were all there from the start or added one at a time.
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <vector>
+#include "LoadBalancer.hpp"
+#include "Log.hpp"
+
+using namespace ls;
+using namespace std::chrono_literals;
+
+static const std::atomic_bool never_quit{false};
+
+// Adds a server for each weight, numbered from 1 in the order they're given.
+static void addServers(LoadBalancer &balancer, const std::vector<int> &weights) {
+    for (const auto weight : weights) {
+        auto metadata = Metadata::makeDefault();
+        metadata.weight = weight;
+        balancer.addConnection("127.0.0.1", 80, metadata);
+    }
+}
+
+class WeightedRoundRobinTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        out::level = 0;
+        balancer.use(LoadBalancer::Strategy::WEIGHTED_ROUND_ROBIN);
+    }
+
+    // The ids of the servers picked for the next count requests.
+    std::vector<int> picks(int count) {
+        std::vector<int> ids;
+        for (int i = 0; i < count; i++) { ids.push_back(balancer.pick(request, least_loaded).metadata.id); }
+        return ids;
+    }
+
+    LoadBalancer balancer{0, 1, 0, 30s, never_quit};
+    const AcceptData request{.data = Buffer::copy("GET / HTTP/1.1\r\nHost: test\r\n\r\n"), .remote = {-1, 0}};
+    LeastLoadedHeap least_loaded; // Unused by round robin, but every pick is made with one
+};
+
+TEST_F(WeightedRoundRobinTest, TurnsAreInterleaved) {
+    addServers(balancer, {4, 2, 1});
+
+    // Server 1's turns come at 1/8, 3/8, 5/8, and 7/8 of the way through, server 2's at 1/4 and 3/4, and server 3's
+    // at 1/2
+    const std::vector<int> schedule{1, 2, 1, 3, 1, 2, 1};
+    EXPECT_EQ(picks(7), schedule);
+    EXPECT_EQ(picks(7), schedule);
+}
+
+TEST_F(WeightedRoundRobinTest, TiesGoToTheFirstServerAdded) {
+    addServers(balancer, {3, 1});
+
+    // Server 2's only turn lands halfway through, alongside server 1's second
+    EXPECT_EQ(picks(8), (std::vector<int>{1, 1, 2, 1, 1, 1, 2, 1}));
+}
+
+TEST_F(WeightedRoundRobinTest, AddedServersAreMergedIntoTheSchedule) {
+    addServers(balancer, {4, 2});
+    EXPECT_EQ(picks(6), (std::vector<int>{1, 2, 1, 1, 2, 1}));
+
+    // The new server's turn is merged into the same schedule as if it had been there from the start. The rotation
+    // carries on from the 7th turn of it, where the last 6 picks left off.
+    addServers(balancer, {1});
+    EXPECT_EQ(picks(7), (std::vector<int>{1, 1, 2, 1, 3, 1, 2}));
+}
+
+TEST_F(WeightedRoundRobinTest, UnavailableServersAreSkipped) {
+    addServers(balancer, {4, 2, 1});
+    EXPECT_EQ(picks(1), std::vector<int>{1});
+
+    // Marking server 2 down leaves its turns to whoever comes next, so servers 1 and 3 keep to their weights
+    auto &second = balancer.pick(request, least_loaded);
+    ASSERT_EQ(second.metadata.id, 2);
+    second.is_inactive = true;
+
+    std::map<int, int> counts;
+    for (const auto id : picks(70)) { counts[id]++; }
+    EXPECT_EQ(counts[2], 0);
+    EXPECT_NEAR(static_cast<double>(counts[1]) / counts[3], 4.0, 0.5);
+}
@@ -0,0 +1,104 @@
+// Checks how many keys change servers when the consistent hashing table changes. Taking servers out of a table should
+// only move the keys they held, while rebuilding the table with a server added or removed should move little more than
+// that server's share. Servers should also end up with slots in proportion to their weights.
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MaglevTable.hpp"
+
+using namespace ls;
+
+// More hashes than the table has slots, so every slot is looked at
+static constexpr std::uint64_t hashes = 200'000;
+
+static std::vector<MaglevTable::Backend> backendsWith(const std::vector<int> &weights) {
+    std::vector<MaglevTable::Backend> backends;
+    for (std::size_t i = 0; i < weights.size(); i++) {
+        const auto name = "10.0.0." + std::to_string(i + 1) + ":80";
+        backends.push_back({.name = name, .weight = weights[i], .is_active = true});
+    }
+    return backends;
+}
+
+// The fraction of hashes that land on a different server in each table.
+static double movedBetween(const MaglevTable &before, const MaglevTable &after) {
+    std::uint64_t moved = 0;
+    for (std::uint64_t hash = 0; hash < hashes; hash++) { moved += before.lookup(hash) != after.lookup(hash); }
+    return static_cast<double>(moved) / hashes;
+}
+
+TEST(MaglevTableTest, SlotsFollowWeights) {
+    const std::vector<int> weights{1, 2, 3, 1, 1, 4, 2, 1};
+    const MaglevTable table{backendsWith(weights)};
+
+    std::vector<std::uint64_t> counts(weights.size(), 0);
+    for (std::uint64_t hash = 0; hash < hashes; hash++) { counts[table.lookup(hash)]++; }
+    for (std::size_t backend = 0; backend < weights.size(); backend++) {
+        EXPECT_NEAR(static_cast<double>(counts[backend]) / hashes, weights[backend] / 15.0, 0.01)
+            << "server " << backend;
+    }
+}
+
+TEST(MaglevTableTest, TakingServersOutOnlyMovesTheirKeys) {
+    const MaglevTable table{backendsWith(std::vector<int>(10, 1))};
+    const auto without = table.without({3, 7});
+
+    for (std::uint64_t hash = 0; hash < hashes; hash++) {
+        const auto before = table.lookup(hash);
+        const auto after = without.lookup(hash);
+        if (before == 3 || before == 7) {
+            EXPECT_TRUE(after != 3 && after != 7) << "hash " << hash << " stayed on a removed server";
+        } else {
+            ASSERT_EQ(before, after) << "hash " << hash << " moved off a server that's still there";
+        }
+    }
+    EXPECT_FALSE(without.isActive(3));
+    EXPECT_TRUE(without.isActive(4));
+}
+
+TEST(MaglevTableTest, RebuildingWithoutAServerMovesLittleElse) {
+    auto backends = backendsWith(std::vector<int>(10, 1));
+    const MaglevTable table{backends};
+    backends[5].is_active = false;
+    const MaglevTable rebuilt{backends};
+
+    // The removed server's tenth of the keys have to move, and hardly any of the rest should move with them
+    std::uint64_t moved_elsewhere = 0;
+    std::uint64_t kept = 0;
+    for (std::uint64_t hash = 0; hash < hashes; hash++) {
+        if (table.lookup(hash) == 5) { continue; }
+        kept++;
+        moved_elsewhere += table.lookup(hash) != rebuilt.lookup(hash);
+    }
+    EXPECT_LT(static_cast<double>(moved_elsewhere) / kept, 0.02);
+    EXPECT_LT(movedBetween(table, rebuilt), 0.12);
+}
+
+TEST(MaglevTableTest, AddingAServerMovesAboutItsShare) {
+    auto backends = backendsWith(std::vector<int>(10, 1));
+    const MaglevTable table{backends};
+    backends = backendsWith(std::vector<int>(11, 1));
+    const MaglevTable grown{backends};
+
+    // The new server takes an eleventh of the keys, which is all that should move
+    std::uint64_t moved = 0;
+    std::uint64_t taken = 0;
+    for (std::uint64_t hash = 0; hash < hashes; hash++) {
+        moved += table.lookup(hash) != grown.lookup(hash);
+        taken += grown.lookup(hash) == 10;
+    }
+    EXPECT_NEAR(static_cast<double>(taken) / hashes, 1 / 11.0, 0.01);
+    EXPECT_LT(static_cast<double>(moved - taken) / hashes, 0.02);
+}
+
+TEST(MaglevTableTest, EmptyWithoutActiveServers) {
+    auto backends = backendsWith({1, 1});
+    for (auto &backend : backends) { backend.is_active = false; }
+    EXPECT_TRUE(MaglevTable{backends}.isEmpty());
+
+    const MaglevTable table{backendsWith({1, 1})};
+    EXPECT_TRUE(table.without({0, 1}).isEmpty());
+    EXPECT_FALSE(table.without({0}).isEmpty());
+}
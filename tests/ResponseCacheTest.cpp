@@ -0,0 +1,124 @@
+// Checks which requests and responses the cache takes, what it strips from them, and what it sends back.
+
+#include <gtest/gtest.h>
+#include <string>
+#include "ResponseCache.hpp"
+
+using namespace ls;
+
+static const std::string request = "GET /item HTTP/1.1\r\nHost: cache.test\r\n\r\n";
+
+TEST(ResponseCacheTest, StoresResponsesWithLineFeedOnlyHeaders) {
+    ResponseCache cache{1024 * 1024, 1};
+    cache.store(request, "HTTP/1.1 200 OK\nCache-Control: max-age=60\nConnection: keep-alive\nContent-Length: 2\n\nok");
+
+    const auto cached = cache.lookup(request);
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_EQ(*cached, "HTTP/1.1 200 OK\nAge: 0\r\nCache-Control: max-age=60\nContent-Length: 2\n\nok");
+}
+
+TEST(ResponseCacheTest, StoresRequestsWithLineFeedOnlyHeaders) {
+    const std::string bare_request = "GET /item HTTP/1.1\nHost: cache.test\n\n";
+    ResponseCache cache{1024 * 1024, 1};
+    cache.store(bare_request, "HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\nContent-Length: 2\r\n\r\nok");
+
+    EXPECT_TRUE(cache.lookup(bare_request).has_value());
+    EXPECT_TRUE(cache.lookup(request).has_value());
+}
+
+static std::string requestFor(const std::string &path, const std::string &headers = "") {
+    return "GET " + path + " HTTP/1.1\r\nHost: cache.test\r\n" + headers + "\r\n";
+}
+
+static std::string responseWith(const std::string &headers, int code = 200) {
+    return "HTTP/1.1 " + std::to_string(code) + " Whatever\r\n" + headers + "Content-Length: 2\r\n\r\nok";
+}
+
+TEST(ResponseCacheTest, OnlyStoresResponsesThatSayHowLongTheyStayFresh) {
+    ResponseCache cache{1024 * 1024, 1};
+    cache.store(requestFor("/none"), responseWith(""));
+    cache.store(requestFor("/max-age"), responseWith("Cache-Control: max-age=60\r\n"));
+    cache.store(requestFor("/s-maxage"), responseWith("Cache-Control: max-age=0, s-maxage=60\r\n"));
+    cache.store(requestFor("/expires"), responseWith("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+                                                     "Expires: Sun, 06 Nov 1994 08:50:37 GMT\r\n"));
+    cache.store(requestFor("/stale"), responseWith("Cache-Control: max-age=60\r\nAge: 60\r\n"));
+
+    EXPECT_FALSE(cache.lookup(requestFor("/none")).has_value());
+    EXPECT_TRUE(cache.lookup(requestFor("/max-age")).has_value());
+    EXPECT_TRUE(cache.lookup(requestFor("/s-maxage")).has_value());
+    EXPECT_TRUE(cache.lookup(requestFor("/expires")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/stale")).has_value());
+}
+
+TEST(ResponseCacheTest, RefusesResponsesThatArentShareable) {
+    ResponseCache cache{1024 * 1024, 1};
+    cache.store(requestFor("/private"), responseWith("Cache-Control: private, max-age=60\r\n"));
+    cache.store(requestFor("/no-store"), responseWith("Cache-Control: no-store, max-age=60\r\n"));
+    cache.store(requestFor("/cookie"), responseWith("Cache-Control: max-age=60\r\nSet-Cookie: a=b\r\n"));
+    cache.store(requestFor("/error"), responseWith("Cache-Control: max-age=60\r\n", 500));
+    cache.store(requestFor("/vary-any"), responseWith("Cache-Control: max-age=60\r\nVary: *\r\n"));
+
+    EXPECT_FALSE(cache.lookup(requestFor("/private")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/no-store")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/cookie")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/error")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/vary-any")).has_value());
+    EXPECT_EQ(cache.stats().stores, 0);
+}
+
+TEST(ResponseCacheTest, SendsRequestsThatOptOutToTheServer) {
+    ResponseCache cache{1024 * 1024, 1};
+    const auto response = responseWith("Cache-Control: max-age=60\r\n");
+    cache.store(requestFor("/"), response);
+
+    EXPECT_TRUE(cache.lookup(requestFor("/")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/", "Cache-Control: no-cache\r\n")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/", "Cache-Control: max-age=0\r\n")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/", "Pragma: no-cache\r\n")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/", "Authorization: Basic eDp5\r\n")).has_value());
+    EXPECT_FALSE(cache.lookup("HEAD / HTTP/1.1\r\nHost: cache.test\r\n\r\n").has_value());
+
+    // Requests that don't let their response be shared don't store one either
+    cache.store(requestFor("/secret", "Authorization: Basic eDp5\r\n"), response);
+    EXPECT_FALSE(cache.lookup(requestFor("/secret")).has_value());
+}
+
+TEST(ResponseCacheTest, StripsConnectionHeadersAndRewritesAge) {
+    ResponseCache cache{1024 * 1024, 1};
+    cache.store(requestFor("/"), "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nKeep-Alive: timeout=5\r\nAge: 10\r\n"
+                                 "Cache-Control: max-age=60\r\nContent-Length: 2\r\n\r\nok");
+
+    const auto cached = cache.lookup(requestFor("/"));
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_EQ(*cached, "HTTP/1.1 200 OK\r\nAge: 10\r\nCache-Control: max-age=60\r\nContent-Length: 2\r\n\r\nok");
+}
+
+TEST(ResponseCacheTest, KeepsAVariantForEachValueOfTheVaryingHeaders) {
+    ResponseCache cache{1024 * 1024, 1};
+    const auto gzip = requestFor("/", "Accept-Encoding: gzip\r\n");
+    const auto plain = requestFor("/", "Accept-Encoding: identity\r\n");
+    cache.store(gzip, responseWith("Cache-Control: max-age=60\r\nVary: Accept-Encoding\r\nX-Variant: gzip\r\n"));
+
+    const auto cached = cache.lookup(gzip);
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_NE(cached->find("X-Variant: gzip"), std::string::npos);
+    EXPECT_FALSE(cache.lookup(plain).has_value());
+}
+
+TEST(ResponseCacheTest, EvictsTheLeastRecentlyUsedResponse) {
+    const auto response = responseWith("Cache-Control: max-age=60\r\n");
+    const auto entry_bytes = 2 * std::string("GET cache.test/a").size() + response.size();
+
+    // Room for two entries, but not three
+    ResponseCache cache{entry_bytes * 5 / 2, 1};
+    cache.store(requestFor("/a"), response);
+    cache.store(requestFor("/b"), response);
+    ASSERT_TRUE(cache.lookup(requestFor("/a")).has_value());
+    cache.store(requestFor("/c"), response);
+
+    EXPECT_TRUE(cache.lookup(requestFor("/a")).has_value());
+    EXPECT_FALSE(cache.lookup(requestFor("/b")).has_value());
+    EXPECT_TRUE(cache.lookup(requestFor("/c")).has_value());
+    EXPECT_EQ(cache.stats().evictions, 1);
+    EXPECT_LE(cache.stats().bytes, entry_bytes * 5 / 2);
+}
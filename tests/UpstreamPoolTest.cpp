@@ -0,0 +1,69 @@
+// Checks that transactions held back by the pool's connection limit give up once their deadline passes, and that the
+// ones still waiting are handed connections in order.
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <optional>
+#include <vector>
+#include "EventLoop.hpp"
+#include "TimerWheel.hpp"
+#include "UpstreamPool.hpp"
+
+using namespace ls;
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+static const UpstreamPool::Limits one_connection{
+    .max_idle = 0, .max_connections = 1, .idle_timeout = 60s, .connect_timeout = 10s, .first_byte_timeout = 60s};
+
+TEST(UpstreamPoolTest, WaitingLeasesExpireByTheirDeadline) {
+    EventLoop loop;
+    const auto start = clock_type::now();
+    TimerWheel timers{1ms, start};
+    UpstreamPool pool{loop, timers, one_connection};
+
+    std::vector<int> leased;
+    std::vector<int> expired;
+    const auto acquire = [&](int id, clock_type::time_point deadline) {
+        pool.acquire([&leased, id](std::optional<sockets::Socket>) { leased.push_back(id); }, deadline,
+                     [&expired, id] { expired.push_back(id); });
+    };
+
+    acquire(0, clock_type::time_point::max());
+    acquire(1, start + 50ms);
+    acquire(2, clock_type::time_point::max());
+    acquire(3, start + 50ms);
+    EXPECT_EQ(leased, std::vector<int>{0});
+    EXPECT_EQ(pool.open(), 1u);
+
+    timers.advance(start + 1s);
+    EXPECT_EQ(expired, (std::vector<int>{1, 3}));
+    EXPECT_EQ(timers.size(), 0u);
+
+    // The slot freed up goes to the lease that's still waiting, and the expired ones never hear of it
+    pool.release(std::nullopt);
+    EXPECT_EQ(leased, (std::vector<int>{0, 2}));
+    pool.release(std::nullopt);
+    EXPECT_EQ(leased, (std::vector<int>{0, 2}));
+    EXPECT_EQ(pool.open(), 0u);
+}
+
+TEST(UpstreamPoolTest, HandingOutCancelsTheWait) {
+    EventLoop loop;
+    const auto start = clock_type::now();
+    TimerWheel timers{1ms, start};
+    UpstreamPool pool{loop, timers, one_connection};
+
+    int leased = 0;
+    int expired = 0;
+    for (int i = 0; i < 2; i++) {
+        pool.acquire([&leased](std::optional<sockets::Socket>) { leased++; }, start + 50ms, [&expired] { expired++; });
+    }
+    EXPECT_EQ(timers.size(), 1u);
+
+    pool.release(std::nullopt);
+    EXPECT_EQ(leased, 2);
+    EXPECT_EQ(timers.size(), 0u);
+    timers.advance(start + 1s);
+    EXPECT_EQ(expired, 0);
+}